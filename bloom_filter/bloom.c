@@ -1,3 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "bloom.h"
 
 BloomFilter *BloomFilter_new(size_t size, size_t num_functions, ...) {
@@ -11,6 +17,12 @@ BloomFilter *BloomFilter_new(size_t size, size_t num_functions, ...) {
   filter->num_items = 0;
   filter->bits = createBitArray(size);
   filter->num_functions = num_functions;
+  filter->hash128 = NULL;
+  filter->mode = BLOOM_STANDARD;
+  filter->k = num_functions;
+  filter->num_blocks = 0;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
   filter->hash_functions = (hash64_func *)malloc(sizeof(hash64_func) * num_functions);
 
   if (NULL == filter->hash_functions) {
@@ -26,28 +38,207 @@ BloomFilter *BloomFilter_new(size_t size, size_t num_functions, ...) {
   return filter;
 }
 
-uint64_t murmur64a(const void *key, size_t len) {
-  return murmur64(key, len, 42);
+// Two probes from one murmur64_128 call; the first is the murmur64a bit the
+// former two-function default set too
+BloomFilter *BloomFilter_default(size_t size) {
+  return BloomFilter_new_double(size, 2, murmur64a);
+}
+
+// Blocked (split-block) Bloom filter: the key's hash picks one cache-line
+// sized block with a multiply-shift range reduction, and the low 32 bits,
+// multiplied by a per-bit odd salt, pick the k bits inside that block. A
+// lookup therefore touches a single cache line and hashes the key once.
+static const uint32_t BLOOM_BLOCK_SALTS[BLOOM_BLOCK_MAX_K] = BLOOM_BLOCK_SALTS_INIT;
+
+BloomFilter *BloomFilter_new_blocked(size_t size, size_t k, hash64_func hash_function) {
+  if (k < 1 || k > BLOOM_BLOCK_MAX_K) {
+    fprintf(stderr, "Invalid parameter 1 <= k=%zu <= %d\n", k, BLOOM_BLOCK_MAX_K);
+    exit(EXIT_FAILURE);
+  }
+
+  BloomFilter *filter = (BloomFilter *)malloc(sizeof(*filter));
+  if (NULL == filter) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  filter->num_items = 0;
+  filter->num_blocks = (size + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+  if (filter->num_blocks == 0) {
+    filter->num_blocks = 1;
+  }
+  filter->bits = createAlignedBitArray(filter->num_blocks * BLOOM_BLOCK_BITS, BLOOM_BLOCK_BITS / CHAR_BIT);
+  filter->num_functions = 1;
+  filter->hash128 = NULL;
+  filter->mode = BLOOM_BLOCKED;
+  filter->k = k;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
+  filter->hash_functions = (hash64_func *)malloc(sizeof(hash64_func));
+  if (NULL == filter->hash_functions) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  filter->hash_functions[0] = hash_function;
+  return filter;
 }
 
-uint64_t murmur64b(const void *key, size_t len) {
-  return murmur64(key, len, 1337);
+BloomFilter *BloomFilter_blocked(size_t size) {
+  return BloomFilter_new_blocked(size, BLOOM_BLOCK_DEFAULT_K, murmur64a);
 }
 
-BloomFilter *BloomFilter_default(size_t size) {
-  return BloomFilter_new(size, 2, murmur64a, murmur64b);
+static inline unit_t *BloomFilter_block(const BloomFilter *filter, uint64_t hash_val) {
+  size_t block = (size_t)(((__uint128_t)hash_val * filter->num_blocks) >> 64);
+  return filter->bits->data + block * BLOOM_BLOCK_UNITS;
 }
 
-void free_BloomFilter(BloomFilter *filter) {
+static inline size_t BloomFilter_block_bit(uint64_t hash_val, size_t i) {
+  return (uint32_t)((uint32_t)hash_val * BLOOM_BLOCK_SALTS[i]) >> (32 - 9);  // 9 bits = [0, 512)
+}
+
+// Double hashing with both base hashes taken from one 128-bit call of the
+// function paired with `hash_function` (murmur64a or wyhash64a). Files only
+// record `hash_function`, so they load like any other filter.
+BloomFilter *BloomFilter_new_double(size_t size, size_t k, hash64_func hash_function) {
+  hash128_func hash128 = hash128_from_hash64(hash_function);
+  if (k < 1 || NULL == hash128) {
+    fprintf(stderr, "Invalid parameters k=%zu >= 1, hash function with a 128-bit variant\n", k);
+    exit(EXIT_FAILURE);
+  }
+  BloomFilter *filter = BloomFilter_new(size, 1, hash_function);
+  filter->mode = BLOOM_DOUBLE_HASHING;
+  filter->k = k;
+  filter->hash128 = hash128;
+  return filter;
+}
+
+// Replaces the still empty bit array of a new filter by one placed by
+// `policy`; frees the filter and returns NULL if that fails
+static BloomFilter *BloomFilter_place_bits(BloomFilter *filter, AllocPolicy policy) {
+  size_t size = filter->bits->size;
+  // A file is only reused by a filter that sets the same bits for a key
+  policy.layout = ALLOC_LAYOUT_BLOOM;
+  policy.layout_param =
+      (uint64_t)filter->k | (uint64_t)filter->mode << 8 | (uint64_t)hash64_id(filter->hash_functions[0]) << 16;
   freeBitArray(filter->bits);
+  filter->bits = createBitArrayWith(size, policy);
+  if (NULL == filter->bits) {
+    free(filter->hash_functions);
+    free(filter);
+    return NULL;
+  }
+  return filter;
+}
+
+// BloomFilter_new_double with the bits on huge pages, aligned or in a shared
+// file (see AllocKind). A file that already holds a filter with the same
+// size, k and hash function keeps its bits; num_items only counts the keys
+// put since it was mapped. Processes sharing the file must all write with
+// BloomFilter_put_concurrent, since BloomFilter_put can lose another
+// writer's bits and so cause false negatives.
+BloomFilter *BloomFilter_new_double_with(size_t size, size_t k, hash64_func hash_function, AllocPolicy policy) {
+  return BloomFilter_place_bits(BloomFilter_new_double(size, k, hash_function), policy);
+}
+
+// Blocks must not straddle cache lines, so plain heap memory is aligned too
+BloomFilter *BloomFilter_new_blocked_with(size_t size, size_t k, hash64_func hash_function, AllocPolicy policy) {
+  if (policy.kind == ALLOC_HEAP) {
+    policy.kind = ALLOC_ALIGNED;
+  }
+  return BloomFilter_place_bits(BloomFilter_new_blocked(size, k, hash_function), policy);
+}
+
+// Sizes a double-hashing filter for `n` items at false positive rate `fpr`:
+// m = -n ln(fpr) / ln(2)^2 bits and k = (m / n) ln(2) probes, derived from
+// the two halves of murmur64_128 as h1 + i * h2 (Kirsch-Mitzenmacher).
+BloomFilter *BloomFilter_with_fpr(size_t n, double fpr) {
+  if (n == 0 || !(fpr > 0.0 && fpr < 1.0)) {
+    fprintf(stderr, "Invalid parameters n=%zu > 0, 0 < fpr=%f < 1\n", n, fpr);
+    exit(EXIT_FAILURE);
+  }
+  const double ln2 = log(2.0);
+  double m = ceil(-(double)n * log(fpr) / (ln2 * ln2));
+  size_t k = (size_t)llround(m / (double)n * ln2);
+  if (k < 1) {
+    k = 1;
+  }
+  return BloomFilter_new_double((size_t)m, k, murmur64a);
+}
+
+// A blocked filter answers from the one block a key maps to. Keys spread
+// over the blocks as a Poisson distribution with mean n / num_blocks, and a
+// block holding i keys gives a false positive with probability
+// (1 - (1 - 1/512)^{ki})^k. Crowded blocks make this higher than the
+// standard formula; terms beyond 10 standard deviations are negligible.
+static double BloomFilter_blocked_fpr(const BloomFilter *filter) {
+  if (filter->num_items == 0) {
+    return 0.0;
+  }
+  const double k = (double)filter->k;
+  const double mean = (double)filter->num_items / (double)filter->num_blocks;
+  const double spread = 10.0 * sqrt(mean) + 10.0;
+  const size_t first = mean > spread ? (size_t)(mean - spread) : 0;
+  const size_t last = (size_t)(mean + spread);
+  double fpr = 0.0;
+  for (size_t i = first; i <= last; i++) {
+    double keys = exp((double)i * log(mean) - mean - lgamma((double)i + 1.0));
+    fpr += keys * pow(1.0 - pow(1.0 - 1.0 / BLOOM_BLOCK_BITS, k * (double)i), k);
+  }
+  return fpr;
+}
+
+// FPR = (1 - e^{-kn/m})^k for the items inserted so far, or the blocked
+// filter's rate above
+double BloomFilter_fpr(const BloomFilter *filter) {
+  if (filter->mode == BLOOM_BLOCKED) {
+    return BloomFilter_blocked_fpr(filter);
+  }
+  double k = (double)filter->k;
+  return pow(1.0 - exp(-k * (double)filter->num_items / (double)filter->bits->size), k);
+}
+
+void free_BloomFilter(BloomFilter *filter) {
+  if (filter->mapping) {
+    munmap(filter->mapping, filter->mapping_size);
+    free(filter->bits);
+  } else {
+    freeBitArray(filter->bits);
+  }
   free(filter->hash_functions);
   free(filter);
 }
 
+// Bit index of the i-th probe of a key for the non-blocked modes. For double
+// hashing the two base hashes are computed on the first probe, by one
+// 128-bit call or by two hash functions, and kept in `state` for the rest.
+static inline size_t BloomFilter_index(const BloomFilter *filter, const void *data, size_t size, size_t i,
+                                       uint64_t state[2]) {
+  if (filter->mode == BLOOM_STANDARD) {
+    return filter->hash_functions[i](data, size) % filter->bits->size;
+  }
+  if (i == 0 && filter->hash128) {
+    Hash128 hash = filter->hash128(data, size);
+    state[0] = hash.h1;
+    state[1] = hash.h2;
+  } else if (i == 0) {
+    state[0] = filter->hash_functions[0](data, size);
+    state[1] = filter->hash_functions[1](data, size);
+  }
+  return (state[0] + i * state[1]) % filter->bits->size;
+}
+
 void BloomFilter_put(BloomFilter *filter, const void *data, size_t size) {
-  for (size_t i = 0; i < filter->num_functions; i++) {
-    uint64_t hash_val = filter->hash_functions[i](data, size);
-    size_t bit_index = hash_val % filter->bits->size;
+  if (filter->mode == BLOOM_BLOCKED) {
+    uint64_t hash_val = filter->hash_functions[0](data, size);
+    unit_t *block = BloomFilter_block(filter, hash_val);
+    for (size_t i = 0; i < filter->k; i++) {
+      BIT_SET(block, BloomFilter_block_bit(hash_val, i));
+    }
+    filter->num_items++;
+    return;
+  }
+  uint64_t state[2] = {0, 0};
+  for (size_t i = 0; i < filter->k; i++) {
+    size_t bit_index = BloomFilter_index(filter, data, size, i, state);
     BIT_SET(filter->bits->data, bit_index);
   }
   filter->num_items++;
@@ -58,9 +249,19 @@ void BloomFilter_putStr(BloomFilter *filter, const char *str) {
 }
 
 bool BloomFilter_exists(BloomFilter *filter, const void *data, size_t size) {
-  for (size_t i = 0; i < filter->num_functions; i++) {
-    uint64_t hash_val = filter->hash_functions[i](data, size);
-    size_t bit_index = hash_val % filter->bits->size;
+  if (filter->mode == BLOOM_BLOCKED) {
+    uint64_t hash_val = filter->hash_functions[0](data, size);
+    const unit_t *block = BloomFilter_block(filter, hash_val);
+    for (size_t i = 0; i < filter->k; i++) {
+      if (!BIT_GET(block, BloomFilter_block_bit(hash_val, i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  uint64_t state[2] = {0, 0};
+  for (size_t i = 0; i < filter->k; i++) {
+    size_t bit_index = BloomFilter_index(filter, data, size, i, state);
     if (!BIT_GET(filter->bits->data, bit_index)) {
       return false;
     }
@@ -72,21 +273,496 @@ bool BloomFilter_strExists(BloomFilter *filter, const char *str) {
   return BloomFilter_exists(filter, str, strlen(str));
 }
 
+// Concurrent operations: any number of threads may call these on the same
+// filter. Bits are set with an atomic fetch-or on their 64-bit word, so no
+// update is lost, and `num_items` is updated with an atomic add. They must
+// not be mixed with the plain put functions while other threads are writing.
+
+// Sets the key's bits and returns true when at least one of them was clear,
+// i.e. the key was definitely not in the filter before this call.
+static bool BloomFilter_set_atomic(BloomFilter *filter, const void *data, size_t size) {
+  bool was_absent = false;
+  if (filter->mode == BLOOM_BLOCKED) {
+    uint64_t hash_val = filter->hash_functions[0](data, size);
+    unit_t *block = BloomFilter_block(filter, hash_val);
+    unit_t masks[BLOOM_BLOCK_UNITS] = {0};
+    for (size_t i = 0; i < filter->k; i++) {
+      BIT_SET(masks, BloomFilter_block_bit(hash_val, i));
+    }
+    for (size_t w = 0; w < BLOOM_BLOCK_UNITS; w++) {
+      if (masks[w] && (__atomic_fetch_or(&block[w], masks[w], __ATOMIC_RELAXED) & masks[w]) != masks[w]) {
+        was_absent = true;
+      }
+    }
+    return was_absent;
+  }
+  uint64_t state[2] = {0, 0};
+  for (size_t i = 0; i < filter->k; i++) {
+    size_t bit_index = BloomFilter_index(filter, data, size, i, state);
+    if (!BIT_SET_ATOMIC(filter->bits->data, bit_index)) {
+      was_absent = true;
+    }
+  }
+  return was_absent;
+}
+
+void BloomFilter_put_concurrent(BloomFilter *filter, const void *data, size_t size) {
+  BloomFilter_set_atomic(filter, data, size);
+  __atomic_fetch_add(&filter->num_items, 1, __ATOMIC_RELAXED);
+}
+
+bool BloomFilter_exists_concurrent(BloomFilter *filter, const void *data, size_t size) {
+  if (filter->mode == BLOOM_BLOCKED) {
+    uint64_t hash_val = filter->hash_functions[0](data, size);
+    unit_t *block = BloomFilter_block(filter, hash_val);
+    for (size_t i = 0; i < filter->k; i++) {
+      if (!BIT_GET_ATOMIC(block, BloomFilter_block_bit(hash_val, i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  uint64_t state[2] = {0, 0};
+  for (size_t i = 0; i < filter->k; i++) {
+    size_t bit_index = BloomFilter_index(filter, data, size, i, state);
+    if (!BIT_GET_ATOMIC(filter->bits->data, bit_index)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Lock-free test-and-set: inserts the key and returns true if it was new.
+// `num_items` only counts new keys. Two threads racing on the same new key
+// may both see it as new, since their bits are set one word at a time.
+bool BloomFilter_put_if_absent(BloomFilter *filter, const void *data, size_t size) {
+  if (!BloomFilter_set_atomic(filter, data, size)) {
+    return false;
+  }
+  __atomic_fetch_add(&filter->num_items, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+// Batched operations work on windows of keys: every key in the window is
+// hashed and its bit words are prefetched before any of them is touched, so
+// the cache misses of a whole window overlap instead of stalling per key.
+static size_t BloomFilter_batch_window(const BloomFilter *filter) {
+  if (filter->mode == BLOOM_BLOCKED) {
+    return BLOOM_BATCH_WINDOW;
+  }
+  size_t window = BLOOM_BATCH_MAX_SLOTS / filter->k;
+  return window < BLOOM_BATCH_WINDOW ? window : BLOOM_BATCH_WINDOW;
+}
+
+// __builtin_prefetch needs its read/write hint as a constant
+static inline void BloomFilter_prefetch(const void *address, bool write) {
+  if (write) {
+    __builtin_prefetch(address, 1);
+  } else {
+    __builtin_prefetch(address, 0);
+  }
+}
+
+// Fills `slots` with either one hash per key (blocked) or k bit indexes per
+// key (standard), prefetching the words they land in, for writing when
+// `write` is set so the lines arrive exclusive. Each hash function is applied
+// to the whole window at once, so murmur64 and murmur128a can use SIMD lanes.
+static void BloomFilter_batch_prepare(const BloomFilter *filter, const void *const *keys, const size_t *lens,
+                                      size_t n, uint64_t *slots, bool write) {
+  if (filter->mode == BLOOM_BLOCKED) {
+    hash64_batch(filter->hash_functions[0], keys, lens, n, slots);
+    for (size_t i = 0; i < n; i++) {
+      BloomFilter_prefetch(BloomFilter_block(filter, slots[i]), write);
+    }
+    return;
+  }
+  const size_t k = filter->k;
+  const size_t size = filter->bits->size;
+  uint64_t h1[BLOOM_BATCH_WINDOW];
+  uint64_t h2[BLOOM_BATCH_WINDOW];
+  if (filter->mode == BLOOM_DOUBLE_HASHING) {
+    if (filter->hash128) {
+      hash128_batch(filter->hash128, keys, lens, n, h1, h2);
+    } else {
+      hash64_batch(filter->hash_functions[0], keys, lens, n, h1);
+      hash64_batch(filter->hash_functions[1], keys, lens, n, h2);
+    }
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < k; j++) {
+        slots[i * k + j] = (h1[i] + j * h2[i]) % size;
+      }
+    }
+  } else {
+    for (size_t j = 0; j < k; j++) {
+      hash64_batch(filter->hash_functions[j], keys, lens, n, h1);
+      for (size_t i = 0; i < n; i++) {
+        slots[i * k + j] = h1[i] % size;
+      }
+    }
+  }
+  for (size_t i = 0; i < n * k; i++) {
+    BloomFilter_prefetch(&filter->bits->data[BIT_INDEX(slots[i])], write);
+  }
+}
+
+void BloomFilter_put_batch(BloomFilter *filter, const void *const *keys, const size_t *lens, size_t n) {
+  const size_t window = BloomFilter_batch_window(filter);
+  if (window == 0) {
+    for (size_t i = 0; i < n; i++) {
+      BloomFilter_put(filter, keys[i], lens[i]);
+    }
+    return;
+  }
+
+  uint64_t slots[BLOOM_BATCH_MAX_SLOTS];
+  for (size_t start = 0; start < n; start += window) {
+    size_t count = n - start < window ? n - start : window;
+    BloomFilter_batch_prepare(filter, keys + start, lens + start, count, slots, true);
+    if (filter->mode == BLOOM_BLOCKED) {
+      for (size_t i = 0; i < count; i++) {
+        unit_t *block = BloomFilter_block(filter, slots[i]);
+        for (size_t j = 0; j < filter->k; j++) {
+          BIT_SET(block, BloomFilter_block_bit(slots[i], j));
+        }
+      }
+    } else {
+      for (size_t i = 0; i < count * filter->k; i++) {
+        BIT_SET(filter->bits->data, slots[i]);
+      }
+    }
+  }
+  filter->num_items += n;
+}
+
+// `results` is a bitmap of at least (n + 63) / 64 words; bit i is set when
+// keys[i] may be in the filter.
+void BloomFilter_exists_batch(BloomFilter *filter, const void *const *keys, const size_t *lens, size_t n,
+                              unit_t *results) {
+  const size_t window = BloomFilter_batch_window(filter);
+  if (window == 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (BloomFilter_exists(filter, keys[i], lens[i])) {
+        BIT_SET(results, i);
+      } else {
+        BIT_CLEAR(results, i);
+      }
+    }
+    return;
+  }
+
+  uint64_t slots[BLOOM_BATCH_MAX_SLOTS];
+  for (size_t start = 0; start < n; start += window) {
+    size_t count = n - start < window ? n - start : window;
+    BloomFilter_batch_prepare(filter, keys + start, lens + start, count, slots, false);
+    for (size_t i = 0; i < count; i++) {
+      bool found = true;
+      if (filter->mode == BLOOM_BLOCKED) {
+        const unit_t *block = BloomFilter_block(filter, slots[i]);
+        for (size_t j = 0; j < filter->k && found; j++) {
+          found = BIT_GET(block, BloomFilter_block_bit(slots[i], j));
+        }
+      } else {
+        const uint64_t *bit_indexes = slots + i * filter->k;
+        for (size_t j = 0; j < filter->k && found; j++) {
+          found = BIT_GET(filter->bits->data, bit_indexes[j]);
+        }
+      }
+      if (found) {
+        BIT_SET(results, start + i);
+      } else {
+        BIT_CLEAR(results, start + i);
+      }
+    }
+  }
+}
+
 size_t countBitsSet(BitArray *bits) {
   if (!bits || !bits->data) {
     fprintf(stderr, "Invalid BitArray pointer\n");
     return 0;
   }
+  return BitArray_popcount(bits);
+}
+
+// Set algebra. Filters can only be combined when they were built with the
+// same size, mode, k and hash functions, so equal keys map to equal bits.
+bool BloomFilter_compatible(const BloomFilter *a, const BloomFilter *b) {
+  if (!a || !b || a->bits->size != b->bits->size || a->mode != b->mode || a->k != b->k ||
+      a->num_functions != b->num_functions) {
+    return false;
+  }
+  for (size_t i = 0; i < a->num_functions; i++) {
+    if (a->hash_functions[i] != b->hash_functions[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The union filter is exactly the filter of the union of both key sets.
+bool BloomFilter_union(BloomFilter *dest, const BloomFilter *src) {
+  if (!BloomFilter_compatible(dest, src)) {
+    fprintf(stderr, "Error: Bloom filters are not compatible.\n");
+    return false;
+  }
+  BitArray_or(dest->bits, src->bits);
+  dest->num_items += src->num_items;
+  return true;
+}
+
+// The intersection filter contains every common key, but may have more bits
+// set than a filter built from the common keys alone.
+bool BloomFilter_intersect(BloomFilter *dest, const BloomFilter *src) {
+  if (!BloomFilter_compatible(dest, src)) {
+    fprintf(stderr, "Error: Bloom filters are not compatible.\n");
+    return false;
+  }
+  BitArray_and(dest->bits, src->bits);
+  dest->num_items = (size_t)llround(BloomFilter_estimate_cardinality(dest));
+  return true;
+}
+
+// Swamidass & Baldi: with X of the m bits set, n ~= -(m / k) ln(1 - X / m)
+static double BloomFilter_cardinality_from_bits(const BloomFilter *filter, size_t bits_set) {
+  double m = (double)filter->bits->size;
+  double x = (double)bits_set;
+  if (x >= m) {
+    x = m - 0.5;  // Saturated: report the largest finite estimate
+  }
+  return -m / (double)filter->k * log(1.0 - x / m);
+}
+
+double BloomFilter_estimate_cardinality(const BloomFilter *filter) {
+  return BloomFilter_cardinality_from_bits(filter, BitArray_popcount(filter->bits));
+}
+
+double BloomFilter_estimate_union(const BloomFilter *a, const BloomFilter *b) {
+  if (!BloomFilter_compatible(a, b)) {
+    fprintf(stderr, "Error: Bloom filters are not compatible.\n");
+    return 0.0;
+  }
+  return BloomFilter_cardinality_from_bits(a, BitArray_popcount_or(a->bits, b->bits));
+}
+
+// |A n B| = |A| + |B| - |A u B|, each estimated from its bit count
+double BloomFilter_estimate_intersection(const BloomFilter *a, const BloomFilter *b) {
+  double union_size = BloomFilter_estimate_union(a, b);
+  if (union_size == 0.0) {
+    return 0.0;
+  }
+  double intersection =
+      BloomFilter_estimate_cardinality(a) + BloomFilter_estimate_cardinality(b) - union_size;
+  return intersection > 0.0 ? intersection : 0.0;
+}
+
+double BloomFilter_jaccard(const BloomFilter *a, const BloomFilter *b) {
+  double union_size = BloomFilter_estimate_union(a, b);
+  if (union_size == 0.0) {
+    return 0.0;
+  }
+  return BloomFilter_estimate_intersection(a, b) / union_size;
+}
+
+typedef char BloomFileHeader_size_check[sizeof(BloomFileHeader) == BLOOM_FILE_HEADER_SIZE ? 1 : -1];
+
+static size_t BloomFilter_payload_size(size_t num_bits) {
+  return (num_bits + BITS_PER_UNIT - 1) / BITS_PER_UNIT * sizeof(unit_t);
+}
+
+static uint64_t BloomFileHeader_checksum(const BloomFileHeader *header) {
+  return murmur64(header, offsetof(BloomFileHeader, header_checksum), BLOOM_FILE_CHECKSUM_SEED);
+}
 
-  size_t count = 0;
-  size_t num_bytes = (bits->size + 63) / 64;  // Number of 64-bit elements
-  for (size_t i = 0; i < num_bytes; i++) {
-    uint64_t element = bits->data[i];
-    // Count bits in uint64_t (using Kernighan's algorithm)
-    while (element) {
-      element &= (element - 1);  // clear the lowest set bit
-      count++;
+bool BloomFilter_save(const BloomFilter *filter, const char *path) {
+  if (filter->num_functions > BLOOM_FILE_MAX_FUNCTIONS) {
+    fprintf(stderr, "Error: Cannot save a filter with more than %d hash functions.\n", BLOOM_FILE_MAX_FUNCTIONS);
+    return false;
+  }
+
+  BloomFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BLOOM_FILE_MAGIC, sizeof(header.magic));
+  header.version = BLOOM_FILE_VERSION;
+  header.mode = (uint32_t)filter->mode;
+  header.num_bits = filter->bits->size;
+  header.k = filter->k;
+  header.num_items = filter->num_items;
+  header.num_blocks = filter->num_blocks;
+  header.num_functions = (uint32_t)filter->num_functions;
+  for (size_t i = 0; i < filter->num_functions; i++) {
+    header.hash_ids[i] = hash64_id(filter->hash_functions[i]);
+    if (header.hash_ids[i] == HASH_ID_UNKNOWN) {
+      fprintf(stderr, "Error: Hash function %zu has no registered identifier.\n", i);
+      return false;
     }
   }
-  return count;
+  size_t payload_size = BloomFilter_payload_size(filter->bits->size);
+  header.payload_checksum = murmur64(filter->bits->data, payload_size, BLOOM_FILE_CHECKSUM_SEED);
+  header.header_checksum = BloomFileHeader_checksum(&header);
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    perror("Failed to open file");
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(filter->bits->data, 1, payload_size, file) == payload_size;
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error: Failed to write Bloom filter to %s.\n", path);
+  }
+  return ok;
+}
+
+// Validates the header against the file size and builds a filter whose
+// BitArray has no data yet.
+static BloomFilter *BloomFilter_from_header(const BloomFileHeader *header, size_t file_size) {
+  if (memcmp(header->magic, BLOOM_FILE_MAGIC, sizeof(header->magic)) != 0) {
+    fprintf(stderr, "Error: Not a Bloom filter file.\n");
+    return NULL;
+  }
+  if (header->version != BLOOM_FILE_VERSION) {
+    fprintf(stderr, "Error: Unsupported Bloom filter file version %u.\n", header->version);
+    return NULL;
+  }
+  if (header->header_checksum != BloomFileHeader_checksum(header)) {
+    fprintf(stderr, "Error: Bloom filter header checksum mismatch.\n");
+    return NULL;
+  }
+  // Bound num_bits by the file before sizing the payload, which wraps near 2^64
+  if (header->num_functions == 0 || header->num_functions > BLOOM_FILE_MAX_FUNCTIONS ||
+      header->mode > BLOOM_DOUBLE_HASHING || header->num_bits == 0 || file_size < BLOOM_FILE_HEADER_SIZE ||
+      header->num_bits > (uint64_t)(file_size - BLOOM_FILE_HEADER_SIZE) * 8 ||
+      file_size < BLOOM_FILE_HEADER_SIZE + BloomFilter_payload_size(header->num_bits)) {
+    fprintf(stderr, "Error: Corrupt Bloom filter header.\n");
+    return NULL;
+  }
+
+  BloomFilter *filter = (BloomFilter *)malloc(sizeof(*filter));
+  BitArray *bits = (BitArray *)malloc(sizeof(BitArray));
+  hash64_func *hash_functions = (hash64_func *)malloc(sizeof(hash64_func) * header->num_functions);
+  if (NULL == filter || NULL == bits || NULL == hash_functions) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < header->num_functions; i++) {
+    hash_functions[i] = hash64_from_id(header->hash_ids[i]);
+    if (NULL == hash_functions[i]) {
+      fprintf(stderr, "Error: Unknown hash function identifier %u.\n", header->hash_ids[i]);
+      free(hash_functions);
+      free(bits);
+      free(filter);
+      return NULL;
+    }
+  }
+  // Double hashing keeps either both base functions or one with a 128-bit pair
+  filter->hash128 = NULL;
+  if (header->mode == BLOOM_DOUBLE_HASHING && header->num_functions == 1) {
+    filter->hash128 = hash128_from_hash64(hash_functions[0]);
+  }
+  // k and num_blocks index the salts, the hash functions and the payload
+  bool valid = header->k >= 1;
+  if (header->mode == BLOOM_BLOCKED) {
+    valid = valid && header->k <= BLOOM_BLOCK_MAX_K && header->num_functions == 1 && header->num_blocks >= 1 &&
+            header->num_blocks <= header->num_bits / BLOOM_BLOCK_BITS;
+  } else if (header->mode == BLOOM_STANDARD) {
+    valid = valid && header->k == header->num_functions;
+  } else {
+    valid = valid && (header->num_functions >= 2 || NULL != filter->hash128);
+  }
+  if (!valid) {
+    fprintf(stderr, "Error: Corrupt Bloom filter header.\n");
+    free(hash_functions);
+    free(bits);
+    free(filter);
+    return NULL;
+  }
+  bits->data = NULL;
+  bits->size = header->num_bits;
+  bits->storage = (Allocation){NULL, NULL, 0, ALLOC_HEAP};
+  filter->bits = bits;
+  filter->hash_functions = hash_functions;
+  filter->num_functions = header->num_functions;
+  filter->num_items = header->num_items;
+  filter->mode = (BloomMode)header->mode;
+  filter->k = header->k;
+  filter->num_blocks = header->num_blocks;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
+  return filter;
+}
+
+// Reads the whole file into memory and verifies the payload checksum.
+BloomFilter *BloomFilter_load(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror("Failed to open file");
+    return NULL;
+  }
+  BloomFileHeader header;
+  struct stat st;
+  BloomFilter *filter = NULL;
+  if (fstat(fileno(file), &st) == 0 && fread(&header, sizeof(header), 1, file) == 1) {
+    filter = BloomFilter_from_header(&header, (size_t)st.st_size);
+  } else {
+    fprintf(stderr, "Error: Failed to read Bloom filter header from %s.\n", path);
+  }
+  if (!filter) {
+    fclose(file);
+    return NULL;
+  }
+
+  BitArray *bits = filter->mode == BLOOM_BLOCKED
+                       ? createAlignedBitArray(header.num_bits, BLOOM_BLOCK_BITS / CHAR_BIT)
+                       : createBitArray(header.num_bits);
+  free(filter->bits);
+  filter->bits = bits;
+  size_t payload_size = BloomFilter_payload_size(header.num_bits);
+  bool ok = fread(bits->data, 1, payload_size, file) == payload_size;
+  fclose(file);
+  if (!ok || murmur64(bits->data, payload_size, BLOOM_FILE_CHECKSUM_SEED) != header.payload_checksum) {
+    fprintf(stderr, "Error: Bloom filter payload is truncated or corrupt.\n");
+    free_BloomFilter(filter);
+    return NULL;
+  }
+  return filter;
+}
+
+// Maps the file read-only and queries straight from the page cache: opening
+// is O(1) and pages are faulted in on first access, so several processes can
+// share one filter. Only the header is verified; the returned filter must not
+// be written to.
+BloomFilter *BloomFilter_mmap(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("Failed to open file");
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < BLOOM_FILE_HEADER_SIZE) {
+    fprintf(stderr, "Error: %s is too small to be a Bloom filter file.\n", path);
+    close(fd);
+    return NULL;
+  }
+  size_t mapping_size = (size_t)st.st_size;
+  void *mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    perror("Failed to map file");
+    return NULL;
+  }
+
+  BloomFilter *filter = BloomFilter_from_header((const BloomFileHeader *)mapping, mapping_size);
+  if (!filter) {
+    munmap(mapping, mapping_size);
+    return NULL;
+  }
+  // Lookups hit random pages, so read-ahead would only waste I/O
+  posix_madvise(mapping, mapping_size, POSIX_MADV_RANDOM);
+  filter->bits->data = (unit_t *)((char *)mapping + BLOOM_FILE_HEADER_SIZE);
+  filter->mapping = mapping;
+  filter->mapping_size = mapping_size;
+  return filter;
 }
@@ -1,6 +1,7 @@
 #ifndef BLOOM_H
 #define BLOOM_H
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -10,20 +11,136 @@
 #include "../lib/hash.h"
 #include "../lib/bitarray.h"
 
+#define BLOOM_BLOCK_BITS 512  // One 64-byte cache line
+#define BLOOM_BLOCK_UNITS (BLOOM_BLOCK_BITS / BITS_PER_UNIT)
+#define BLOOM_BLOCK_MAX_K 16
+#define BLOOM_BLOCK_DEFAULT_K 8
+#define BLOOM_BATCH_WINDOW 16    // Keys hashed and prefetched ahead of the bit updates
+#define BLOOM_BATCH_MAX_SLOTS 256
+
+// Odd multipliers that pick the k bits of a key inside its block
+#define BLOOM_BLOCK_SALTS_INIT                          \
+	{                                                   \
+		0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, \
+		0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U, \
+		0x9e3779b1U, 0x85ebca77U, 0xc2b2ae3dU, 0x27d4eb2fU, \
+		0x165667b1U, 0xfd7046c5U, 0xb55a4f09U, 0x61c88647U, \
+	}
+
+typedef enum {
+	BLOOM_STANDARD,  // One hash function per bit, spread over the whole array
+	BLOOM_BLOCKED,   // One hash per key, all k bits inside a single block
+	BLOOM_DOUBLE_HASHING,  // k bits from two hashes, h1 + i * h2
+} BloomMode;
+
 typedef struct {
 	BitArray *bits;
 	hash64_func *hash_functions;
 	size_t num_functions;
+	hash128_func hash128;  // Double hashing with one function: h1 and h2 from one call
 	size_t num_items;
+	BloomMode mode;
+	size_t k;           // Bits set per key
+	size_t num_blocks;  // Number of BLOOM_BLOCK_BITS blocks (BLOOM_BLOCKED only)
+	void *mapping;      // File mapping backing `bits` (BloomFilter_mmap only)
+	size_t mapping_size;
 } BloomFilter;
 
+// On-disk format: a fixed little-endian header followed by the raw BitArray
+// words, which start BLOOM_FILE_HEADER_SIZE bytes in so they stay 64-byte
+// aligned when the file is mapped.
+#define BLOOM_FILE_MAGIC "PDSBLOOM"
+#define BLOOM_FILE_VERSION 1
+#define BLOOM_FILE_HEADER_SIZE 128
+#define BLOOM_FILE_MAX_FUNCTIONS 8
+#define BLOOM_FILE_CHECKSUM_SEED 0x5eed
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t mode;
+	uint64_t num_bits;
+	uint64_t k;
+	uint64_t num_items;
+	uint64_t num_blocks;
+	uint32_t num_functions;
+	uint32_t hash_ids[BLOOM_FILE_MAX_FUNCTIONS];
+	uint32_t reserved[7];
+	uint64_t payload_checksum;  // murmur64 of the BitArray words
+	uint64_t header_checksum;   // murmur64 of every preceding header byte
+} BloomFileHeader;
+
 BloomFilter *BloomFilter_new(size_t size, size_t num_functions, ...);
 BloomFilter *BloomFilter_default(size_t size);
+BloomFilter *BloomFilter_new_blocked(size_t size, size_t k, hash64_func hash_function);
+BloomFilter *BloomFilter_blocked(size_t size);
+BloomFilter *BloomFilter_new_double(size_t size, size_t k, hash64_func hash_function);
+BloomFilter *BloomFilter_new_double_with(size_t size, size_t k, hash64_func hash_function, AllocPolicy policy);
+BloomFilter *BloomFilter_new_blocked_with(size_t size, size_t k, hash64_func hash_function, AllocPolicy policy);
+BloomFilter *BloomFilter_with_fpr(size_t n, double fpr);
+double BloomFilter_fpr(const BloomFilter *filter);
 void BloomFilter_put(BloomFilter *filter, const void *data, size_t size);
 void BloomFilter_putStr(BloomFilter *filter, const char *str);
 bool BloomFilter_exists(BloomFilter *filter, const void *data, size_t size);
 bool BloomFilter_strExists(BloomFilter *filter, const char *str);
+void BloomFilter_put_batch(BloomFilter *filter, const void *const *keys, const size_t *lens, size_t n);
+void BloomFilter_exists_batch(BloomFilter *filter, const void *const *keys, const size_t *lens, size_t n,
+                              unit_t *results);
+void BloomFilter_put_concurrent(BloomFilter *filter, const void *data, size_t size);
+bool BloomFilter_exists_concurrent(BloomFilter *filter, const void *data, size_t size);
+bool BloomFilter_put_if_absent(BloomFilter *filter, const void *data, size_t size);
+bool BloomFilter_save(const BloomFilter *filter, const char *path);
+BloomFilter *BloomFilter_load(const char *path);
+BloomFilter *BloomFilter_mmap(const char *path);
 void free_BloomFilter(BloomFilter *filter);
 size_t countBitsSet(BitArray *bits);
+bool BloomFilter_compatible(const BloomFilter *a, const BloomFilter *b);
+bool BloomFilter_union(BloomFilter *dest, const BloomFilter *src);
+bool BloomFilter_intersect(BloomFilter *dest, const BloomFilter *src);
+double BloomFilter_estimate_cardinality(const BloomFilter *filter);
+double BloomFilter_estimate_union(const BloomFilter *a, const BloomFilter *b);
+double BloomFilter_estimate_intersection(const BloomFilter *a, const BloomFilter *b);
+double BloomFilter_jaccard(const BloomFilter *a, const BloomFilter *b);
+
+// Declares name_new, name_put, name_putStr and name_exists for blocked
+// filters with a fixed size in bits, K bits per key and hash function
+// `hashfn`. The hash is a direct call the compiler can inline, the block
+// count and K are constants, and the k-bit loop has a constant trip count the
+// compiler may unroll. The gain is marginal: memory and hashing dominate an
+// add, not the call. The filters are ordinary BLOOM_BLOCKED filters that every
+// generic function accepts.
+#define PDS_DEFINE_BLOOM(name, BITS, K, hashfn)                                                           \
+	typedef char name##_k_check[(K) >= 1 && (K) <= BLOOM_BLOCK_MAX_K ? 1 : -1];                           \
+	PDS_SPECIALIZED BloomFilter *name##_new(void) {                                                      \
+		return BloomFilter_new_blocked((BITS), (K), hashfn);                                              \
+	}                                                                                                     \
+	PDS_SPECIALIZED unit_t *name##_block(const BloomFilter *filter, uint64_t hash_val) {                 \
+		const uint64_t num_blocks = (uint64_t)(BITS) > BLOOM_BLOCK_BITS                                   \
+		                                ? ((uint64_t)(BITS) + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS    \
+		                                : 1;                                                              \
+		return filter->bits->data + (size_t)(((__uint128_t)hash_val * num_blocks) >> 64) * BLOOM_BLOCK_UNITS; \
+	}                                                                                                     \
+	PDS_SPECIALIZED void name##_put(BloomFilter *filter, const void *data, size_t size) {                \
+		static const uint32_t salts[BLOOM_BLOCK_MAX_K] = BLOOM_BLOCK_SALTS_INIT;                          \
+		uint64_t hash_val = hashfn(data, size);                                                           \
+		unit_t *block = name##_block(filter, hash_val);                                                   \
+		for (size_t i = 0; i < (K); i++) {                                                                \
+			BIT_SET(block, (uint32_t)((uint32_t)hash_val * salts[i]) >> (32 - 9));                        \
+		}                                                                                                 \
+		filter->num_items++;                                                                              \
+	}                                                                                                     \
+	PDS_SPECIALIZED void name##_putStr(BloomFilter *filter, const char *str) {                           \
+		name##_put(filter, str, strlen(str));                                                             \
+	}                                                                                                     \
+	PDS_SPECIALIZED bool name##_exists(const BloomFilter *filter, const void *data, size_t size) {       \
+		static const uint32_t salts[BLOOM_BLOCK_MAX_K] = BLOOM_BLOCK_SALTS_INIT;                          \
+		uint64_t hash_val = hashfn(data, size);                                                           \
+		const unit_t *block = name##_block(filter, hash_val);                                             \
+		bool found = true;                                                                                \
+		for (size_t i = 0; i < (K); i++) {                                                                \
+			found &= BIT_GET(block, (uint32_t)((uint32_t)hash_val * salts[i]) >> (32 - 9)) != 0;          \
+		}                                                                                                 \
+		return found;                                                                                     \
+	}
 
 #endif
@@ -0,0 +1,117 @@
+#include "counting_bloom.h"
+#include "bloom.h"
+
+CountingBloomFilter *CountingBloomFilter_new(size_t size, size_t num_functions, ...) {
+  va_list argp;
+
+  CountingBloomFilter *filter = (CountingBloomFilter *)malloc(sizeof(*filter));
+  if (NULL == filter) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  filter->num_items = 0;
+  filter->size = size;
+  filter->num_units = (size + COUNTERS_PER_UNIT - 1) / COUNTERS_PER_UNIT;
+  filter->counters = (unit_t *)calloc(filter->num_units, sizeof(unit_t));
+  filter->num_functions = num_functions;
+  filter->hash_functions = (hash64_func *)malloc(sizeof(hash64_func) * num_functions);
+
+  if (NULL == filter->counters || NULL == filter->hash_functions) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  va_start(argp, num_functions);
+  for (size_t i = 0; i < num_functions; i++) {
+    filter->hash_functions[i] = va_arg(argp, hash64_func);
+  }
+  va_end(argp);
+  return filter;
+}
+
+CountingBloomFilter *CountingBloomFilter_default(size_t size) {
+  return CountingBloomFilter_new(size, 2, murmur64a, murmur64b);
+}
+
+void free_CountingBloomFilter(CountingBloomFilter *filter) {
+  free(filter->counters);
+  free(filter->hash_functions);
+  free(filter);
+}
+
+void CountingBloomFilter_add(CountingBloomFilter *filter, const void *data, size_t size) {
+  for (size_t i = 0; i < filter->num_functions; i++) {
+    size_t index = filter->hash_functions[i](data, size) % filter->size;
+    if (COUNTER_GET(filter->counters, index) < COUNTER_MAX) {
+      filter->counters[index / COUNTERS_PER_UNIT] += (unit_t)1 << COUNTER_SHIFT(index);
+    }
+  }
+  filter->num_items++;
+}
+
+// Returns false, leaving the filter untouched, when the key is definitely
+// not present. Removing a key that was never added corrupts the filter.
+bool CountingBloomFilter_remove(CountingBloomFilter *filter, const void *data, size_t size) {
+  if (!CountingBloomFilter_exists(filter, data, size)) {
+    return false;
+  }
+  for (size_t i = 0; i < filter->num_functions; i++) {
+    size_t index = filter->hash_functions[i](data, size) % filter->size;
+    size_t counter = COUNTER_GET(filter->counters, index);
+    // A saturated counter has lost its true count, so it has to stay put
+    if (counter > 0 && counter < COUNTER_MAX) {
+      filter->counters[index / COUNTERS_PER_UNIT] -= (unit_t)1 << COUNTER_SHIFT(index);
+    }
+  }
+  if (filter->num_items > 0) {
+    filter->num_items--;
+  }
+  return true;
+}
+
+bool CountingBloomFilter_exists(CountingBloomFilter *filter, const void *data, size_t size) {
+  for (size_t i = 0; i < filter->num_functions; i++) {
+    size_t index = filter->hash_functions[i](data, size) % filter->size;
+    if (COUNTER_GET(filter->counters, index) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CountingBloomFilter_clear(CountingBloomFilter *filter) {
+  memset(filter->counters, 0, filter->num_units * sizeof(unit_t));
+  filter->num_items = 0;
+}
+
+// Adds 16 pairs of 4-bit counters at once, saturating at COUNTER_MAX. The low
+// three bits of each nibble are summed without carrying into the next nibble;
+// a nibble overflows when both top bits are set, or one is set and the low sum
+// carried into it. Branch-free, so the merge loop vectorizes.
+static inline unit_t saturating_add_nibbles(unit_t a, unit_t b) {
+  const unit_t low_bits = 0x7777777777777777ULL;
+  const unit_t high_bits = 0x8888888888888888ULL;
+  unit_t sum = (a & low_bits) + (b & low_bits);
+  unit_t high_a = a & high_bits;
+  unit_t high_b = b & high_bits;
+  unit_t overflow = (high_a & high_b) | ((high_a | high_b) & sum);
+  unit_t saturate = overflow | (overflow - (overflow >> 3));
+  return (sum ^ high_a ^ high_b) | saturate;
+}
+
+void CountingBloomFilter_merge(CountingBloomFilter *dest, const CountingBloomFilter *src) {
+  if (!dest || !src) {
+    fprintf(stderr, "Error: One or both counting Bloom filters are NULL.\n");
+    return;
+  }
+  if (dest->size != src->size || dest->num_functions != src->num_functions) {
+    fprintf(stderr, "Error: Counting Bloom filters have incompatible sizes.\n");
+    return;
+  }
+  unit_t *restrict d = dest->counters;
+  const unit_t *restrict s = src->counters;
+  for (size_t i = 0; i < dest->num_units; i++) {
+    d[i] = saturating_add_nibbles(d[i], s[i]);
+  }
+  dest->num_items += src->num_items;
+}
@@ -0,0 +1,37 @@
+#ifndef COUNTING_BLOOM_H
+#define COUNTING_BLOOM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/hash.h"
+#include "../lib/bitarray.h"
+
+#define COUNTER_BITS 4
+#define COUNTER_MAX ((1U << COUNTER_BITS) - 1)  // Saturated counters are never decremented
+#define COUNTERS_PER_UNIT (BITS_PER_UNIT / COUNTER_BITS)
+#define COUNTER_SHIFT(i) (((i) % COUNTERS_PER_UNIT) * COUNTER_BITS)
+#define COUNTER_GET(counters, i) (((counters)[(i) / COUNTERS_PER_UNIT] >> COUNTER_SHIFT(i)) & COUNTER_MAX)
+
+typedef struct {
+	unit_t *counters;  // COUNTERS_PER_UNIT 4-bit counters per word
+	size_t size;       // Number of counters
+	size_t num_units;
+	hash64_func *hash_functions;
+	size_t num_functions;
+	size_t num_items;
+} CountingBloomFilter;
+
+CountingBloomFilter *CountingBloomFilter_new(size_t size, size_t num_functions, ...);
+CountingBloomFilter *CountingBloomFilter_default(size_t size);
+void CountingBloomFilter_add(CountingBloomFilter *filter, const void *data, size_t size);
+bool CountingBloomFilter_remove(CountingBloomFilter *filter, const void *data, size_t size);
+bool CountingBloomFilter_exists(CountingBloomFilter *filter, const void *data, size_t size);
+void CountingBloomFilter_clear(CountingBloomFilter *filter);
+void CountingBloomFilter_merge(CountingBloomFilter *dest, const CountingBloomFilter *src);
+void free_CountingBloomFilter(CountingBloomFilter *filter);
+
+#endif
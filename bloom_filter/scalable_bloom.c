@@ -0,0 +1,112 @@
+#include "scalable_bloom.h"
+
+// Scalable Bloom filter (Almeida et al.): once the newest sub-filter holds
+// the number of items it was sized for, a new one is chained with
+// SCALABLE_BLOOM_GROWTH times the capacity and SCALABLE_BLOOM_TIGHTENING times
+// the error rate. Sub-filter i gets fpr * (1 - r) * r^i, so the compounded
+// rate of the chain stays below `fpr` however many sub-filters are added.
+
+static void ScalableBloomFilter_grow(ScalableBloomFilter *filter) {
+  if (filter->num_filters == filter->max_filters) {
+    size_t max_filters = filter->max_filters * 2;
+    BloomFilter **filters = (BloomFilter **)realloc(filter->filters, sizeof(BloomFilter *) * max_filters);
+    if (NULL == filters) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    filter->filters = filters;
+    filter->max_filters = max_filters;
+  }
+
+  size_t i = filter->num_filters;
+  double fpr = filter->fpr * (1.0 - SCALABLE_BLOOM_TIGHTENING) * pow(SCALABLE_BLOOM_TIGHTENING, (double)i);
+  filter->active_capacity = i == 0 ? filter->initial_capacity : filter->active_capacity * SCALABLE_BLOOM_GROWTH;
+  filter->filters[i] = BloomFilter_with_fpr(filter->active_capacity, fpr);
+  filter->num_filters++;
+}
+
+ScalableBloomFilter *ScalableBloomFilter_new(size_t initial_capacity, double fpr) {
+  if (initial_capacity == 0 || !(fpr > 0.0 && fpr < 1.0)) {
+    fprintf(stderr, "Invalid parameters capacity=%zu > 0, 0 < fpr=%f < 1\n", initial_capacity, fpr);
+    exit(EXIT_FAILURE);
+  }
+
+  ScalableBloomFilter *filter = (ScalableBloomFilter *)malloc(sizeof(*filter));
+  if (NULL == filter) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  filter->max_filters = 4;
+  filter->filters = (BloomFilter **)malloc(sizeof(BloomFilter *) * filter->max_filters);
+  if (NULL == filter->filters) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  filter->num_filters = 0;
+  filter->initial_capacity = initial_capacity;
+  filter->fpr = fpr;
+  filter->num_items = 0;
+  ScalableBloomFilter_grow(filter);
+  return filter;
+}
+
+void free_ScalableBloomFilter(ScalableBloomFilter *filter) {
+  for (size_t i = 0; i < filter->num_filters; i++) {
+    free_BloomFilter(filter->filters[i]);
+  }
+  free(filter->filters);
+  free(filter);
+}
+
+bool ScalableBloomFilter_exists(ScalableBloomFilter *filter, const void *data, size_t size) {
+  // Newest first: it is the largest and holds the most recent items
+  for (size_t i = filter->num_filters; i-- > 0;) {
+    if (BloomFilter_exists(filter->filters[i], data, size)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ScalableBloomFilter_strExists(ScalableBloomFilter *filter, const char *str) {
+  return ScalableBloomFilter_exists(filter, str, strlen(str));
+}
+
+// Returns false without inserting when the key may already be present, so
+// repeated keys do not use up the capacity of the active sub-filter.
+bool ScalableBloomFilter_put(ScalableBloomFilter *filter, const void *data, size_t size) {
+  if (ScalableBloomFilter_exists(filter, data, size)) {
+    return false;
+  }
+  BloomFilter *active = filter->filters[filter->num_filters - 1];
+  if (active->num_items >= filter->active_capacity) {
+    ScalableBloomFilter_grow(filter);
+    active = filter->filters[filter->num_filters - 1];
+  }
+  BloomFilter_put(active, data, size);
+  filter->num_items++;
+  return true;
+}
+
+bool ScalableBloomFilter_putStr(ScalableBloomFilter *filter, const char *str) {
+  return ScalableBloomFilter_put(filter, str, strlen(str));
+}
+
+// 1 - prod(1 - FPR_i) over the sub-filters at their current fill
+double ScalableBloomFilter_fpr(const ScalableBloomFilter *filter) {
+  double none = 1.0;
+  for (size_t i = 0; i < filter->num_filters; i++) {
+    none *= 1.0 - BloomFilter_fpr(filter->filters[i]);
+  }
+  return 1.0 - none;
+}
+
+size_t ScalableBloomFilter_memory_usage(const ScalableBloomFilter *filter) {
+  size_t total = sizeof(*filter) + filter->max_filters * sizeof(BloomFilter *);
+  for (size_t i = 0; i < filter->num_filters; i++) {
+    const BloomFilter *sub = filter->filters[i];
+    total += sizeof(*sub) + sub->num_functions * sizeof(hash64_func) +
+             (sub->bits->size + BITS_PER_UNIT - 1) / BITS_PER_UNIT * sizeof(unit_t);
+  }
+  return total;
+}
@@ -0,0 +1,32 @@
+#ifndef SCALABLE_BLOOM_H
+#define SCALABLE_BLOOM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bloom.h"
+
+#define SCALABLE_BLOOM_GROWTH 2        // Capacity multiplier of each new sub-filter
+#define SCALABLE_BLOOM_TIGHTENING 0.5  // FPR multiplier of each new sub-filter
+
+typedef struct {
+	BloomFilter **filters;
+	size_t num_filters;
+	size_t max_filters;        // Allocated slots in `filters`
+	size_t active_capacity;    // Items the newest sub-filter was sized for
+	size_t initial_capacity;
+	double fpr;                // Target false positive rate of the whole chain
+	size_t num_items;
+} ScalableBloomFilter;
+
+ScalableBloomFilter *ScalableBloomFilter_new(size_t initial_capacity, double fpr);
+bool ScalableBloomFilter_put(ScalableBloomFilter *filter, const void *data, size_t size);
+bool ScalableBloomFilter_putStr(ScalableBloomFilter *filter, const char *str);
+bool ScalableBloomFilter_exists(ScalableBloomFilter *filter, const void *data, size_t size);
+bool ScalableBloomFilter_strExists(ScalableBloomFilter *filter, const char *str);
+double ScalableBloomFilter_fpr(const ScalableBloomFilter *filter);
+size_t ScalableBloomFilter_memory_usage(const ScalableBloomFilter *filter);
+void free_ScalableBloomFilter(ScalableBloomFilter *filter);
+
+#endif
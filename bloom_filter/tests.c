@@ -1,10 +1,16 @@
 #define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "../lib/bitarray.h"
 #include "../lib/hash.h"
 #include "../lib/utilities.h"
 #include "bloom.h"
+#include "counting_bloom.h"
+#include "scalable_bloom.h"
 
 void printArray(int *arr, size_t len) {
   printf("[");
@@ -141,9 +147,533 @@ void test_bloom_filter(void) {
   free_BloomFilter(filter);
 }
 
+void test_blocked_bloom_filter(void) {
+  bool exp, val;
+  BloomFilter *filter = BloomFilter_blocked(64 * 1024);
+  printf("Blocks: %zu, bits per key: %zu\n", filter->num_blocks, filter->k);
+
+  exp = true;
+  BloomFilter_putStr(filter, "abc");
+  val = BloomFilter_strExists(filter, "abc");
+  printf("Inserting value `abc` into filter: ");
+  ASSERT(exp == val, exp, val);
+
+  const int num_elements = 4000;
+  char buf[32];
+  for (int i = 0; i < num_elements; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%d", i);
+    BloomFilter_putStr(filter, buf);
+  }
+  int missing = 0;
+  for (int i = 0; i < num_elements; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%d", i);
+    missing += !BloomFilter_strExists(filter, buf);
+  }
+  printf("Missing inserted elements: ");
+  ASSERT(missing == 0, 0, missing);
+
+  // Enough absent keys to see a rate of a few in ten thousand
+  const int num_probes = 200000;
+  int false_positives = 0;
+  for (int i = 0; i < num_probes; ++i) {
+    snprintf(buf, sizeof(buf), "other_%d", i);
+    false_positives += BloomFilter_strExists(filter, buf);
+  }
+  double measured = (double)false_positives / num_probes;
+  double expected = BloomFilter_fpr(filter);
+  printf("Expected FPR: %.4f%%, measured FPR: %.4f%%\n", 100 * expected, 100 * measured);
+  printf("BitArray utilization: %.2f%%\n", 100.0 * countBitsSet(filter->bits) / filter->bits->size);
+  int within_expected = measured > expected / 2 && measured < 2 * expected;
+  printf("Measured FPR within 2x of the blocked filter's expected rate: ");
+  ASSERT(within_expected, 1, within_expected);
+  free_BloomFilter(filter);
+}
+
+void test_bloom_filter_batch(void) {
+  enum { N = 1000 };
+  char storage[N][32];
+  const void *keys[N];
+  size_t lens[N];
+  for (int i = 0; i < N; ++i) {
+    snprintf(storage[i], sizeof(storage[i]), "batch_%d", i);
+    keys[i] = storage[i];
+    lens[i] = strlen(storage[i]);
+  }
+
+  BloomFilter *filters[2] = {BloomFilter_default(64 * 1024), BloomFilter_blocked(64 * 1024)};
+  for (int f = 0; f < 2; ++f) {
+    BloomFilter *filter = filters[f];
+    unit_t results[(N + BITS_PER_UNIT - 1) / BITS_PER_UNIT];
+
+    // Only the first half is inserted
+    BloomFilter_put_batch(filter, keys, lens, N / 2);
+    BloomFilter_exists_batch(filter, keys, lens, N, results);
+
+    int mismatches = 0;
+    int found = 0;
+    for (int i = 0; i < N; ++i) {
+      bool expected = BloomFilter_exists(filter, keys[i], lens[i]);
+      mismatches += (bool)BIT_GET(results, i) != expected;
+      found += i < N / 2 && BIT_GET(results, i);
+    }
+    printf("%s filter, batch results matching single-key lookups: ", f ? "Blocked" : "Standard");
+    ASSERT(mismatches == 0, 0, mismatches);
+    printf("%s filter, inserted keys found: ", f ? "Blocked" : "Standard");
+    ASSERT(found == N / 2, N / 2, found);
+    free_BloomFilter(filter);
+  }
+}
+
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_KEYS 20000
+
+typedef struct {
+  BloomFilter *filter;
+  size_t offset;
+  size_t new_keys;
+} ConcurrentArgs;
+
+static void *concurrent_worker(void *arg) {
+  ConcurrentArgs *args = (ConcurrentArgs *)arg;
+  char buf[32];
+  // Every thread inserts the same keys, starting from a different offset
+  for (size_t i = 0; i < CONCURRENT_KEYS; ++i) {
+    snprintf(buf, sizeof(buf), "key_%zu", (i + args->offset) % CONCURRENT_KEYS);
+    if (BloomFilter_put_if_absent(args->filter, buf, strlen(buf))) {
+      args->new_keys++;
+    }
+  }
+  return NULL;
+}
+
+void test_bloom_filter_concurrent(void) {
+  BloomFilter *filters[2] = {BloomFilter_default(1 << 20), BloomFilter_blocked(1 << 20)};
+  for (int f = 0; f < 2; ++f) {
+    pthread_t threads[CONCURRENT_THREADS];
+    ConcurrentArgs args[CONCURRENT_THREADS];
+    for (int t = 0; t < CONCURRENT_THREADS; ++t) {
+      args[t] = (ConcurrentArgs){filters[f], (size_t)t * CONCURRENT_KEYS / CONCURRENT_THREADS, 0};
+      pthread_create(&threads[t], NULL, concurrent_worker, &args[t]);
+    }
+    size_t new_keys = 0;
+    for (int t = 0; t < CONCURRENT_THREADS; ++t) {
+      pthread_join(threads[t], NULL);
+      new_keys += args[t].new_keys;
+    }
+
+    int missing = 0;
+    char buf[32];
+    for (size_t i = 0; i < CONCURRENT_KEYS; ++i) {
+      snprintf(buf, sizeof(buf), "key_%zu", i);
+      missing += !BloomFilter_exists_concurrent(filters[f], buf, strlen(buf));
+    }
+    printf("%s filter, %d threads reported %zu new keys out of %d\n", f ? "Blocked" : "Standard",
+           CONCURRENT_THREADS, new_keys, CONCURRENT_KEYS);
+    printf("Missing inserted elements: ");
+    ASSERT(missing == 0, 0, missing);
+    // False positives hide a few new keys and races may report a key twice
+    int close_enough = new_keys > CONCURRENT_KEYS * 0.95 && new_keys < CONCURRENT_KEYS * 1.05;
+    printf("New keys within 5%% of distinct keys: ");
+    ASSERT(close_enough, 1, close_enough);
+    free_BloomFilter(filters[f]);
+  }
+}
+
+void test_counting_bloom_filter(void) {
+  bool exp, val;
+  CountingBloomFilter *filter = CountingBloomFilter_default(64 * 16);
+  printf("Counters: %zu in %zu bytes\n", filter->size, filter->num_units * sizeof(unit_t));
+
+  exp = true;
+  CountingBloomFilter_add(filter, "abc", 3);
+  CountingBloomFilter_add(filter, "abc", 3);
+  val = CountingBloomFilter_exists(filter, "abc", 3);
+  printf("Adding value `abc` twice: ");
+  ASSERT(exp == val, exp, val);
+
+  CountingBloomFilter_remove(filter, "abc", 3);
+  val = CountingBloomFilter_exists(filter, "abc", 3);
+  printf("Removing `abc` once: ");
+  ASSERT(exp == val, exp, val);
+
+  exp = false;
+  CountingBloomFilter_remove(filter, "abc", 3);
+  val = CountingBloomFilter_exists(filter, "abc", 3);
+  printf("Removing `abc` again: ");
+  ASSERT(exp == val, exp, val);
+
+  val = CountingBloomFilter_remove(filter, "abc", 3);
+  printf("Removing an absent value: ");
+  ASSERT(exp == val, exp, val);
+
+  for (int i = 0; i < 20; ++i) {
+    CountingBloomFilter_add(filter, "hot", 3);
+  }
+  size_t index = murmur64a("hot", 3) % filter->size;
+  int counter = COUNTER_GET(filter->counters, index);
+  printf("Counter saturates at %u: ", COUNTER_MAX);
+  ASSERT(counter == COUNTER_MAX, (int)COUNTER_MAX, counter);
+
+  CountingBloomFilter *other = CountingBloomFilter_default(64 * 16);
+  CountingBloomFilter_add(other, "xyz", 3);
+  CountingBloomFilter_add(other, "hot", 3);
+  CountingBloomFilter_merge(filter, other);
+  exp = true;
+  val = CountingBloomFilter_exists(filter, "xyz", 3);
+  printf("Merged filter contains `xyz`: ");
+  ASSERT(exp == val, exp, val);
+  counter = COUNTER_GET(filter->counters, index);
+  printf("Merging into a saturated counter stays at %u: ", COUNTER_MAX);
+  ASSERT(counter == COUNTER_MAX, (int)COUNTER_MAX, counter);
+  index = murmur64b("xyz", 3) % filter->size;
+  counter = COUNTER_GET(filter->counters, index);
+  printf("Merged counter for `xyz` is non-zero: ");
+  ASSERT(counter > 0, 1, counter > 0);
+
+  CountingBloomFilter_clear(filter);
+  exp = false;
+  val = CountingBloomFilter_exists(filter, "xyz", 3);
+  printf("Cleared filter no longer contains `xyz`: ");
+  ASSERT(exp == val, exp, val);
+  free_CountingBloomFilter(other);
+  free_CountingBloomFilter(filter);
+}
+
+void test_bloom_filter_fpr(void) {
+  const size_t n = 10000;
+  const double target = 0.01;
+  BloomFilter *filter = BloomFilter_with_fpr(n, target);
+  printf("Sized for %zu items at %.2f%%: m = %zu bits, k = %zu\n", n, 100 * target, filter->bits->size, filter->k);
+
+  char buf[32];
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%zu", i);
+    BloomFilter_putStr(filter, buf);
+  }
+  int missing = 0;
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%zu", i);
+    missing += !BloomFilter_strExists(filter, buf);
+  }
+  printf("Missing inserted elements: ");
+  ASSERT(missing == 0, 0, missing);
+
+  size_t false_positives = 0;
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "other_%zu", i);
+    false_positives += BloomFilter_strExists(filter, buf);
+  }
+  double measured = (double)false_positives / n;
+  printf("Estimated FPR: %.4f%%, measured FPR: %.4f%%\n", 100 * BloomFilter_fpr(filter), 100 * measured);
+  int within_target = measured < 2 * target;
+  printf("Measured FPR within 2x of the target: ");
+  ASSERT(within_target, 1, within_target);
+  free_BloomFilter(filter);
+}
+
+void test_scalable_bloom_filter(void) {
+  const size_t n = 50000;
+  const double target = 0.01;
+  ScalableBloomFilter *filter = ScalableBloomFilter_new(1000, target);
+
+  char buf[32];
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%zu", i);
+    ScalableBloomFilter_putStr(filter, buf);
+  }
+  printf("Inserted %zu items into %zu sub-filters (%zu bytes)\n", filter->num_items, filter->num_filters,
+         ScalableBloomFilter_memory_usage(filter));
+
+  int missing = 0;
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%zu", i);
+    missing += !ScalableBloomFilter_strExists(filter, buf);
+  }
+  printf("Missing inserted elements: ");
+  ASSERT(missing == 0, 0, missing);
+
+  size_t false_positives = 0;
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(buf, sizeof(buf), "other_%zu", i);
+    false_positives += ScalableBloomFilter_strExists(filter, buf);
+  }
+  double measured = (double)false_positives / n;
+  printf("Estimated FPR: %.4f%%, measured FPR: %.4f%%\n", 100 * ScalableBloomFilter_fpr(filter), 100 * measured);
+  int within_target = measured < 2 * target;
+  printf("Measured FPR within 2x of the target: ");
+  ASSERT(within_target, 1, within_target);
+  free_ScalableBloomFilter(filter);
+}
+
+void test_bloom_filter_persistence(void) {
+  BloomFilter *filters[5] = {BloomFilter_default(64 * 1024), BloomFilter_blocked(64 * 1024),
+                             BloomFilter_with_fpr(1000, 0.01), BloomFilter_new_double(64 * 1024, 5, wyhash64a),
+                             BloomFilter_new(64 * 1024, 3, murmur64a, murmur64b, hash_64)};
+  const char *names[5] = {"Default", "Blocked", "Double hashing", "wyhash double hashing", "Standard"};
+  char path[] = "/tmp/pds_bloom_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("Failed to create temporary file");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  char buf[32];
+  for (int f = 0; f < 5; ++f) {
+    for (int i = 0; i < 1000; ++i) {
+      snprintf(buf, sizeof(buf), "elem_%d", i);
+      BloomFilter_putStr(filters[f], buf);
+    }
+    int saved = BloomFilter_save(filters[f], path);
+    printf("%s filter saved: ", names[f]);
+    ASSERT(saved, 1, saved);
+
+    BloomFilter *loaded[2] = {BloomFilter_load(path), BloomFilter_mmap(path)};
+    for (int l = 0; l < 2; ++l) {
+      int opened = loaded[l] != NULL;
+      printf("%s filter %s: ", names[f], l ? "mapped" : "loaded");
+      ASSERT(opened, 1, opened);
+      int same = loaded[l]->num_items == filters[f]->num_items && loaded[l]->k == filters[f]->k &&
+                 loaded[l]->mode == filters[f]->mode && loaded[l]->bits->size == filters[f]->bits->size;
+      printf("Parameters match: ");
+      ASSERT(same, 1, same);
+      int mismatches = 0;
+      for (int i = 0; i < 2000; ++i) {
+        snprintf(buf, sizeof(buf), "elem_%d", i);
+        mismatches += BloomFilter_strExists(loaded[l], buf) != BloomFilter_strExists(filters[f], buf);
+      }
+      printf("Lookups match the original filter: ");
+      ASSERT(mismatches == 0, 0, mismatches);
+      free_BloomFilter(loaded[l]);
+    }
+    free_BloomFilter(filters[f]);
+  }
+
+  // Flip one payload byte: the full load must notice it
+  FILE *file = fopen(path, "r+b");
+  fseek(file, BLOOM_FILE_HEADER_SIZE, SEEK_SET);
+  int c = fgetc(file);
+  fseek(file, BLOOM_FILE_HEADER_SIZE, SEEK_SET);
+  fputc(c ^ 0xff, file);
+  fclose(file);
+  printf("Corrupt payload rejected on load: ");
+  BloomFilter *corrupt = BloomFilter_load(path);
+  ASSERT(corrupt == NULL, 1, corrupt == NULL);
+
+  // Headers with a valid checksum but impossible parameters
+  BloomFilter *blocked = BloomFilter_blocked(64 * 1024);
+  BloomFilter *standard = BloomFilter_new(64 * 1024, 3, murmur64a, murmur64b, hash_64);
+  BloomFilter *doubled = BloomFilter_default(64 * 1024);
+  const BloomFilter *sources[7] = {blocked, blocked, blocked, standard, standard, doubled, standard};
+  const char *tampered[7] = {"Blocked k above the salt count", "Blocked k of 0", "Blocks past the payload",
+                             "Standard k above the hash function count", "Standard k below the hash function count",
+                             "Double hashing k of 0", "Bit count whose payload size wraps"};
+  const uint64_t ks[7] = {BLOOM_BLOCK_MAX_K + 1, 0, BLOOM_BLOCK_DEFAULT_K, 4, 2, 0, 3};
+  const uint64_t extra_blocks[7] = {0, 0, 1, 0, 0, 0, 0};
+  // 0 keeps the saved bit count
+  const uint64_t num_bits[7] = {0, 0, 0, 0, 0, 0, UINT64_MAX - 10};
+  for (int t = 0; t < 7; ++t) {
+    BloomFilter_save(sources[t], path);
+    BloomFileHeader header;
+    file = fopen(path, "r+b");
+    int read = fread(&header, sizeof(header), 1, file) == 1;
+    header.k = ks[t];
+    header.num_blocks += extra_blocks[t];
+    if (num_bits[t] != 0) {
+      header.num_bits = num_bits[t];
+    }
+    header.header_checksum = murmur64(&header, offsetof(BloomFileHeader, header_checksum), BLOOM_FILE_CHECKSUM_SEED);
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    BloomFilter *opened[2] = {BloomFilter_load(path), BloomFilter_mmap(path)};
+    int rejected = read && opened[0] == NULL && opened[1] == NULL;
+    printf("%s rejected: ", tampered[t]);
+    ASSERT(rejected, 1, rejected);
+  }
+  free_BloomFilter(blocked);
+  free_BloomFilter(standard);
+  free_BloomFilter(doubled);
+  unlink(path);
+}
+
+void test_bloom_filter_set_algebra(void) {
+  // A = [0, 6000), B = [4000, 10000): |A u B| = 10000, |A n B| = 2000
+  BloomFilter *a = BloomFilter_with_fpr(20000, 0.01);
+  BloomFilter *b = BloomFilter_with_fpr(20000, 0.01);
+  char buf[32];
+  for (int i = 0; i < 10000; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%d", i);
+    if (i < 6000) {
+      BloomFilter_putStr(a, buf);
+    }
+    if (i >= 4000) {
+      BloomFilter_putStr(b, buf);
+    }
+  }
+
+  size_t slow_count = 0;
+  for (size_t i = 0; i < a->bits->size; ++i) {
+    slow_count += BIT_GET(a->bits->data, i);
+  }
+  size_t fast_count = countBitsSet(a->bits);
+  printf("Vectorized popcount matches bit-by-bit count: ");
+  ASSERT(fast_count == slow_count, (int)slow_count, (int)fast_count);
+
+  double card = BloomFilter_estimate_cardinality(a);
+  double union_size = BloomFilter_estimate_union(a, b);
+  double intersection = BloomFilter_estimate_intersection(a, b);
+  double jaccard = BloomFilter_jaccard(a, b);
+  printf("|A| ~= %.1f, |A u B| ~= %.1f, |A n B| ~= %.1f, Jaccard ~= %.4f\n", card, union_size, intersection, jaccard);
+  int accurate = fabs(card - 6000) < 120 && fabs(union_size - 10000) < 200 && fabs(intersection - 2000) < 200;
+  printf("Estimates within 2%% of |A| and |A u B|, 10%% of |A n B|: ");
+  ASSERT(accurate, 1, accurate);
+
+  BloomFilter *merged = BloomFilter_with_fpr(20000, 0.01);
+  BloomFilter_union(merged, a);
+  BloomFilter_union(merged, b);
+  size_t merged_bits = countBitsSet(merged->bits);
+  size_t union_bits = BitArray_popcount_or(a->bits, b->bits);
+  printf("Union filter has the bits of A | B: ");
+  ASSERT(merged_bits == union_bits, (int)union_bits, (int)merged_bits);
+  int found = BloomFilter_strExists(merged, "elem_0") && BloomFilter_strExists(merged, "elem_9999");
+  printf("Union filter contains keys of both filters: ");
+  ASSERT(found, 1, found);
+
+  BloomFilter_intersect(a, b);
+  found = BloomFilter_strExists(a, "elem_5000");
+  printf("Intersection filter contains a common key: ");
+  ASSERT(found, 1, found);
+
+  BloomFilter *blocked = BloomFilter_blocked(a->bits->size);
+  int compatible = BloomFilter_compatible(a, blocked);
+  printf("Filters with different modes are incompatible: ");
+  ASSERT(!compatible, 0, compatible);
+  free_BloomFilter(blocked);
+  free_BloomFilter(merged);
+  free_BloomFilter(a);
+  free_BloomFilter(b);
+}
+
+PDS_DEFINE_BLOOM(bloom1m, 1 << 20, 8, murmur64a)
+
+void test_bloom_filter_specialized(void) {
+  BloomFilter *generic = BloomFilter_new_blocked(1 << 20, 8, murmur64a);
+  BloomFilter *specialized = bloom1m_new();
+  char buf[32];
+  for (int i = 0; i < 50000; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%d", i);
+    BloomFilter_putStr(generic, buf);
+    bloom1m_putStr(specialized, buf);
+  }
+  size_t words = (generic->bits->size + BITS_PER_UNIT - 1) / BITS_PER_UNIT;
+  int same = memcmp(generic->bits->data, specialized->bits->data, words * sizeof(unit_t)) == 0;
+  printf("Specialized filter sets the same bits as BloomFilter_put: ");
+  ASSERT(same, 1, same);
+
+  int mismatches = 0;
+  for (int i = 0; i < 100000; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%d", i);
+    mismatches += bloom1m_exists(specialized, buf, strlen(buf)) != BloomFilter_strExists(generic, buf);
+  }
+  printf("Specialized lookups match BloomFilter_exists: ");
+  ASSERT(mismatches == 0, 0, mismatches);
+  free_BloomFilter(generic);
+  free_BloomFilter(specialized);
+}
+
+void test_bloom_filter_alloc_policy(void) {
+  char path[] = "/tmp/pds_bloom_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("Failed to create temporary file");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  const AllocPolicy policies[3] = {ALLOC_POLICY(ALLOC_ALIGNED), ALLOC_POLICY(ALLOC_HUGE_PAGES), ALLOC_POLICY_FILE(path)};
+  const char *names[3] = {"Aligned", "Huge pages", "File-backed"};
+  char buf[32];
+  BloomFilter *reference = BloomFilter_new_double(1 << 20, 7, murmur64a);
+  for (int i = 0; i < 10000; ++i) {
+    snprintf(buf, sizeof(buf), "elem_%d", i);
+    BloomFilter_putStr(reference, buf);
+  }
+  for (int c = 0; c < 3; ++c) {
+    for (int f = 0; f < 2; ++f) {
+      BloomFilter *filter = f ? BloomFilter_new_blocked_with(1 << 20, BLOOM_BLOCK_DEFAULT_K, murmur64a, policies[c])
+                              : BloomFilter_new_double_with(1 << 20, 7, murmur64a, policies[c]);
+      for (int i = 0; i < 10000; ++i) {
+        snprintf(buf, sizeof(buf), "elem_%d", i);
+        BloomFilter_putStr(filter, buf);
+      }
+      int found = 1;
+      for (int i = 0; i < 10000; ++i) {
+        snprintf(buf, sizeof(buf), "elem_%d", i);
+        found &= BloomFilter_strExists(filter, buf);
+      }
+      printf("%s %s filter finds every key: ", names[c], f ? "blocked" : "double hashing");
+      ASSERT(found, 1, found);
+      if (f == 0) {
+        int same = memcmp(filter->bits->data, reference->bits->data, (1 << 20) / 8) == 0;
+        printf("%s filter sets the same bits as a heap filter: ", names[c]);
+        ASSERT(same, 1, same);
+      }
+      free_BloomFilter(filter);
+      unlink(path);
+    }
+  }
+  free_BloomFilter(reference);
+
+  // A file holding a filter of the same size is mapped with its bits
+  BloomFilter *shared = BloomFilter_new_double_with(1 << 20, 7, murmur64a, ALLOC_POLICY_FILE(path));
+  BloomFilter_putStr(shared, "persistent");
+  free_BloomFilter(shared);
+  shared = BloomFilter_new_double_with(1 << 20, 7, murmur64a, ALLOC_POLICY_FILE(path));
+  int found = BloomFilter_strExists(shared, "persistent");
+  printf("File-backed filter keeps its keys when mapped again: ");
+  ASSERT(found, 1, found);
+
+  // A second mapping sees keys put concurrently through the first
+  BloomFilter *second = BloomFilter_new_double_with(1 << 20, 7, murmur64a, ALLOC_POLICY_FILE(path));
+  found = BloomFilter_strExists(second, "concurrent");
+  BloomFilter_put_concurrent(shared, "concurrent", strlen("concurrent"));
+  found = !found && BloomFilter_strExists(second, "concurrent");
+  printf("Second mapping sees a key put after it was opened: ");
+  ASSERT(found, 1, found);
+  free_BloomFilter(second);
+  BloomFilter *other = BloomFilter_new_double_with(1 << 20, 5, murmur64a, ALLOC_POLICY_FILE(path));
+  printf("Filter with another k refuses the file: ");
+  ASSERT(other == NULL, 1, other == NULL);
+  free_BloomFilter(shared);
+
+  // Files written by BloomFilter_save are refused, not cleared
+  BloomFilter *original = BloomFilter_default(1 << 16);
+  BloomFilter_putStr(original, "saved");
+  BloomFilter_save(original, path);
+  other = BloomFilter_new_double_with(1 << 16, 2, murmur64a, ALLOC_POLICY_FILE(path));
+  BloomFilter *loaded = BloomFilter_load(path);
+  int intact = other == NULL && loaded != NULL && BloomFilter_strExists(loaded, "saved");
+  printf("Saved filter file is refused and still loads: ");
+  ASSERT(intact, 1, intact);
+  free_BloomFilter(loaded);
+  free_BloomFilter(original);
+  unlink(path);
+}
+
 int main(void) {
   RUN_TEST(test_BitArray_display);
   RUN_TEST(test_BitArray_values);
   RUN_TEST(test_bloom_filter);
+  RUN_TEST(test_blocked_bloom_filter);
+  RUN_TEST(test_bloom_filter_batch);
+  RUN_TEST(test_bloom_filter_specialized);
+  RUN_TEST(test_bloom_filter_concurrent);
+  RUN_TEST(test_counting_bloom_filter);
+  RUN_TEST(test_bloom_filter_fpr);
+  RUN_TEST(test_scalable_bloom_filter);
+  RUN_TEST(test_bloom_filter_persistence);
+  RUN_TEST(test_bloom_filter_set_algebra);
+  RUN_TEST(test_bloom_filter_alloc_policy);
   return 0;
 }
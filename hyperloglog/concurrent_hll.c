@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+#include "concurrent_hll.h"
+#include <string.h>
+
+// Two ways for many ingest threads to feed one counter:
+// - CONCURRENT_HLL_ATOMIC shares a single dense register array and updates it
+//   with HLL_add_concurrent. Memory stays at m bytes, but threads hitting the
+//   same cache lines pay for the coherence traffic.
+// - CONCURRENT_HLL_SHARDED gives every writer its own HLL, the shard numbered
+//   by its thread_id, and takes the register maximum over them when counting.
+//   Adds touch only thread-local memory, at the cost of num_shards * m bytes
+//   and an O(shards * m) count. A shard has a single writer, so an add is a
+//   plain compare and a relaxed atomic byte store, with no lock. Counting reads
+//   the shards with relaxed atomic loads, which see each register either
+//   before or after an update.
+// Both give exactly the registers a single-threaded HLL would hold.
+
+static HLL *ConcurrentHLL_create(size_t p, hash64_func hash_function) {
+  return hash_function ? HLL_new(p, hash_function) : HLL_default(p);
+}
+
+static ConcurrentHLL *ConcurrentHLL_alloc(size_t p, ConcurrentHLLStrategy strategy, size_t num_shards,
+                                          hash64_func hash_function) {
+  if (strategy == CONCURRENT_HLL_SHARDED && num_shards == 0) {
+    fprintf(stderr, "Invalid parameter num_shards=%zu > 0\n", num_shards);
+    exit(EXIT_FAILURE);
+  }
+
+  ConcurrentHLL *chll = (ConcurrentHLL *)malloc(sizeof(*chll));
+  if (NULL == chll) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  chll->strategy = strategy;
+  chll->p = p;
+  chll->merged = ConcurrentHLL_create(p, hash_function);
+  chll->hash_function = chll->merged->hash_function;
+  chll->shared = NULL;
+  chll->shards = NULL;
+  chll->num_shards = 0;
+  pthread_mutex_init(&chll->count_lock, NULL);
+
+  if (strategy == CONCURRENT_HLL_ATOMIC) {
+    chll->shared = HLL_new(p, chll->hash_function);
+    return chll;
+  }
+
+  chll->shards = (HLL **)malloc(num_shards * sizeof(HLL *));
+  if (NULL == chll->shards) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  chll->num_shards = num_shards;
+  for (size_t i = 0; i < num_shards; i++) {
+    chll->shards[i] = HLL_new(p, chll->hash_function);
+  }
+  return chll;
+}
+
+// `num_shards` is ignored by CONCURRENT_HLL_ATOMIC. For CONCURRENT_HLL_SHARDED
+// it must be at least the number of writer threads, each of which passes its
+// own thread_id in [0, num_shards) to every add.
+ConcurrentHLL *ConcurrentHLL_new(size_t p, ConcurrentHLLStrategy strategy, size_t num_shards, ...) {
+  va_list argp;
+  va_start(argp, num_shards);
+  hash64_func hash_function = va_arg(argp, hash64_func);
+  va_end(argp);
+
+  if (!hash_function) {
+    fprintf(stderr, "No hash function provided.\n");
+    exit(EXIT_FAILURE);
+  }
+  return ConcurrentHLL_alloc(p, strategy, num_shards, hash_function);
+}
+
+ConcurrentHLL *ConcurrentHLL_default(size_t p, ConcurrentHLLStrategy strategy, size_t num_shards) {
+  return ConcurrentHLL_alloc(p, strategy, num_shards, NULL);
+}
+
+// Writer-owned shard for thread_id, or NULL when no shard has that number
+static HLL *ConcurrentHLL_shard(ConcurrentHLL *chll, size_t thread_id) {
+  if (thread_id >= chll->num_shards) {
+    fprintf(stderr, "Error: thread_id %zu has no shard, num_shards is %zu.\n", thread_id, chll->num_shards);
+    return NULL;
+  }
+  return chll->shards[thread_id];
+}
+
+// M[j] = max(M[j], rank) by the shard's only writer. The store is atomic only
+// so that counts may read the register meanwhile; it compiles to a plain store.
+static inline void ConcurrentHLL_shard_update(HLL *shard, uint64_t j, uint8_t rank) {
+  if (rank > shard->registers[j]) {
+    __atomic_store_n(&shard->registers[j], rank, __ATOMIC_RELAXED);
+  }
+}
+
+void ConcurrentHLL_add(ConcurrentHLL *chll, size_t thread_id, const void *data, size_t size) {
+  if (chll->strategy == CONCURRENT_HLL_ATOMIC) {
+    HLL_add_concurrent(chll->shared, data, size);
+    return;
+  }
+  HLL *shard = ConcurrentHLL_shard(chll, thread_id);
+  if (!shard) {
+    return;
+  }
+  if (!data) {
+    fprintf(stderr, "No data provided.\n");
+    return;
+  }
+  uint64_t j;
+  uint8_t rank = HLL_rank(shard->p, shard->hash_function(data, size), &j);
+  ConcurrentHLL_shard_update(shard, j, rank);
+}
+
+// Sharded batches hash a window of keys together and prefetch their
+// registers, as HLL_add_batch does
+void ConcurrentHLL_add_batch(ConcurrentHLL *chll, size_t thread_id, const void *const *keys, const size_t *lens,
+                             size_t n) {
+  if (chll->strategy == CONCURRENT_HLL_ATOMIC) {
+    for (size_t i = 0; i < n; i++) {
+      HLL_add_concurrent(chll->shared, keys[i], lens[i]);
+    }
+    return;
+  }
+  HLL *shard = ConcurrentHLL_shard(chll, thread_id);
+  if (!shard) {
+    return;
+  }
+  uint64_t slots[HLL_BATCH_WINDOW];
+  for (size_t start = 0; start < n; start += HLL_BATCH_WINDOW) {
+    size_t count = n - start < HLL_BATCH_WINDOW ? n - start : HLL_BATCH_WINDOW;
+    hash64_batch(shard->hash_function, keys + start, lens + start, count, slots);
+    for (size_t i = 0; i < count; i++) {
+      uint64_t j;
+      uint8_t rank = HLL_rank(shard->p, slots[i], &j);
+      slots[i] = j << 8 | rank;
+      __builtin_prefetch(shard->registers + j, 1);
+    }
+    for (size_t i = 0; i < count; i++) {
+      ConcurrentHLL_shard_update(shard, slots[i] >> 8, (uint8_t)slots[i]);
+    }
+  }
+}
+
+// Fills `dest` with the current registers. Writers may keep adding meanwhile;
+// the result then includes some of their concurrent adds.
+static void ConcurrentHLL_collect(ConcurrentHLL *chll, HLL *dest) {
+  dest->count_valid = false;
+  if (chll->strategy == CONCURRENT_HLL_ATOMIC) {
+    const uint8_t *registers = chll->shared->registers;
+    for (size_t j = 0; j < dest->m; j++) {
+      dest->registers[j] = __atomic_load_n(&registers[j], __ATOMIC_RELAXED);
+    }
+    return;
+  }
+  // Writers may be storing to the shards, so they are copied out a chunk at a
+  // time with atomic loads and the maximum is taken from the copy
+  uint8_t scratch[HLL_CHUNK];
+  memset(dest->registers, 0, dest->m);
+  for (size_t i = 0; i < chll->num_shards; i++) {
+    const uint8_t *registers = chll->shards[i]->registers;
+    for (size_t start = 0; start < dest->m; start += HLL_CHUNK) {
+      size_t n = dest->m - start < HLL_CHUNK ? dest->m - start : HLL_CHUNK;
+      for (size_t j = 0; j < n; j++) {
+        scratch[j] = __atomic_load_n(&registers[start + j], __ATOMIC_RELAXED);
+      }
+      uint8_t *d = dest->registers + start;
+      for (size_t j = 0; j < n; j++) {
+        d[j] = scratch[j] > d[j] ? scratch[j] : d[j];
+      }
+    }
+  }
+}
+
+double ConcurrentHLL_count(ConcurrentHLL *chll) {
+  if (!chll) {
+    return 0.0;
+  }
+  pthread_mutex_lock(&chll->count_lock);
+  ConcurrentHLL_collect(chll, chll->merged);
+  double count = HLL_count(chll->merged);
+  pthread_mutex_unlock(&chll->count_lock);
+  return count;
+}
+
+// Returns a new dense HLL holding the combined registers, freed by the caller
+HLL *ConcurrentHLL_snapshot(ConcurrentHLL *chll) {
+  HLL *snapshot = HLL_new(chll->p, chll->hash_function);
+  ConcurrentHLL_collect(chll, snapshot);
+  return snapshot;
+}
+
+size_t ConcurrentHLL_memory_usage(const ConcurrentHLL *chll) {
+  size_t total = sizeof(*chll) + HLL_memory_usage(chll->merged);
+  if (chll->strategy == CONCURRENT_HLL_ATOMIC) {
+    return total + HLL_memory_usage(chll->shared);
+  }
+  total += chll->num_shards * sizeof(HLL *);
+  for (size_t i = 0; i < chll->num_shards; i++) {
+    total += HLL_memory_usage(chll->shards[i]);
+  }
+  return total;
+}
+
+void free_ConcurrentHLL(ConcurrentHLL *chll) {
+  if (chll->shared) {
+    freeHLL(chll->shared);
+  }
+  for (size_t i = 0; i < chll->num_shards; i++) {
+    freeHLL(chll->shards[i]);
+  }
+  free(chll->shards);
+  pthread_mutex_destroy(&chll->count_lock);
+  freeHLL(chll->merged);
+  free(chll);
+}
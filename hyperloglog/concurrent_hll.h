@@ -0,0 +1,37 @@
+#ifndef CONCURRENT_HLL_H
+#define CONCURRENT_HLL_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hll.h"
+
+typedef enum {
+	CONCURRENT_HLL_ATOMIC,   // One shared register array updated with CAS-max
+	CONCURRENT_HLL_SHARDED,  // One HLL per writer, combined when counting
+} ConcurrentHLLStrategy;
+
+typedef struct {
+	ConcurrentHLLStrategy strategy;
+	size_t p;
+	hash64_func hash_function;
+	HLL *shared;                // CONCURRENT_HLL_ATOMIC only
+	HLL **shards;               // CONCURRENT_HLL_SHARDED only, shard i written by thread_id i alone
+	size_t num_shards;
+	HLL *merged;                // Snapshot reused by every count
+	pthread_mutex_t count_lock;
+} ConcurrentHLL;
+
+ConcurrentHLL *ConcurrentHLL_new(size_t p, ConcurrentHLLStrategy strategy, size_t num_shards, ...);
+ConcurrentHLL *ConcurrentHLL_default(size_t p, ConcurrentHLLStrategy strategy, size_t num_shards);
+void ConcurrentHLL_add(ConcurrentHLL *chll, size_t thread_id, const void *data, size_t size);
+void ConcurrentHLL_add_batch(ConcurrentHLL *chll, size_t thread_id, const void *const *keys, const size_t *lens,
+                             size_t n);
+double ConcurrentHLL_count(ConcurrentHLL *chll);
+HLL *ConcurrentHLL_snapshot(ConcurrentHLL *chll);
+size_t ConcurrentHLL_memory_usage(const ConcurrentHLL *chll);
+void free_ConcurrentHLL(ConcurrentHLL *chll);
+
+#endif
@@ -1,20 +1,23 @@
+#define _POSIX_C_SOURCE 200809L
 #include "hll.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "hash.h"
+#if defined(__AVX2__) || defined(__AVX512BW__)
+#include <immintrin.h>
+#endif
 
-static uint64_t murmur64_default(const void *key, size_t len) {
-  return murmur64(key, len, DEFAULT_MURMUR64_KEY);
-}
-
-HLL *HLL_new(size_t p, ...) {
-  va_list argp;
+#define HLL_SPARSE_ENTRY(j, rank) ((uint32_t)(j) << NUM_BITS_PER_REGISTER | (uint32_t)(rank))
+#define HLL_SPARSE_INDEX(entry) ((entry) >> NUM_BITS_PER_REGISTER)
+#define HLL_SPARSE_RANK(entry) ((uint8_t)((entry) & ((1U << NUM_BITS_PER_REGISTER) - 1)))
 
+static HLL *HLL_alloc(size_t p, hash64_func hash_function, HLLMode mode) {
   const size_t size = 8 * sizeof(uint64_t);
-  if (p < 4 || p > size) {
-    fprintf(stderr, "Invalid parameter 4 < %zu < p=%zu", p, size);
-    exit(EXIT_FAILURE);
-  }
-
   HLL *hll = (HLL *)malloc(sizeof(*hll));
   if (NULL == hll) {
     fprintf(stderr, "Out of memory.\n");
@@ -24,25 +27,162 @@ HLL *HLL_new(size_t p, ...) {
   hll->p = p;
   hll->q = size - p;
   hll->num_bits_per_register = NUM_BITS_PER_REGISTER;  // 6 bits covers up to 64 (more than enough)
+  hll->hash_function = hash_function;
+  hll->mode = mode;
+  hll->registers = NULL;
+  hll->sparse = NULL;
+  hll->sparse_size = 0;
+  hll->sparse_capacity = 0;
+  hll->sparse_count = 0;
+  hll->sparse_buffer = NULL;
+  hll->sparse_buffer_len = 0;
+  hll->sparse_buffer_capacity = 0;
+  hll->packed = NULL;
+  hll->packed_words = 0;
+  hll->count_valid = false;
+  hll->cached_count = 0.0;
+  hll->mapping = NULL;
+  hll->mapping_size = 0;
+  hll->shared = false;
 
-  hll->registers = (uint8_t *)calloc(hll->m, sizeof(uint8_t));
-  if (!hll->registers) {
-    fprintf(stderr, "Out of memory.\n");
+  if (mode == HLL_PACKED) {
+    // Reads run past the last register: HLL_packed_get and HLL_packed_set
+    // access 8 bytes from a register's first byte, up to 7 bytes beyond the
+    // data, and the AVX2 unpack loads the last 24-byte group as two 16-byte
+    // halves, the second ending 4 bytes beyond it. One word would cover both,
+    // but serialized packed sketches and packed ALLOC_FILE arrays are laid out
+    // with HLL_PACKED_SLACK_WORDS, so the allocation keeps that size.
+    hll->packed_words = (hll->m * NUM_BITS_PER_REGISTER + 63) / 64 + HLL_PACKED_SLACK_WORDS;
+    hll->packed = (uint64_t *)calloc(hll->packed_words, sizeof(uint64_t));
+    if (!hll->packed) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (mode == HLL_DENSE) {
+    hll->registers = (uint8_t *)calloc(hll->m, sizeof(uint8_t));
+    if (!hll->registers) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    hll->sparse_buffer_capacity = HLL_SPARSE_MIN_BUFFER;
+    hll->sparse_buffer = (uint32_t *)malloc(hll->sparse_buffer_capacity * sizeof(uint32_t));
+    if (!hll->sparse_buffer) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return hll;
+}
+
+static void HLL_check_precision(size_t p) {
+  const size_t size = 8 * sizeof(uint64_t);
+  if (p < 4 || p > size) {
+    fprintf(stderr, "Invalid parameter 4 < %zu < p=%zu", p, size);
     exit(EXIT_FAILURE);
   }
+}
+
+HLL *HLL_new(size_t p, ...) {
+  va_list argp;
+  HLL_check_precision(p);
+
   va_start(argp, p);
-  hll->hash_function = va_arg(argp, hash64_func);
+  hash64_func hash_function = va_arg(argp, hash64_func);
   va_end(argp);
 
-  return hll;
+  return HLL_alloc(p, hash_function, HLL_DENSE);
 }
 
 HLL *HLL_default(size_t p) {
-  return HLL_new(p, murmur64_default);
+  return HLL_new(p, murmur64a);
+}
+
+// Starts in sparse mode and switches to dense registers on its own once the
+// sparse list would use more than m / HLL_SPARSE_DENSITY bytes. Precisions
+// above HLL_SPARSE_MAX_P, or too small to benefit, start dense.
+HLL *HLL_new_sparse(size_t p, ...) {
+  va_list argp;
+  HLL_check_precision(p);
+
+  va_start(argp, p);
+  hash64_func hash_function = va_arg(argp, hash64_func);
+  va_end(argp);
+
+  // Tiny sketches are smaller dense than the sparse buffer alone
+  size_t m = 1UL << p;
+  bool sparse = p <= HLL_SPARSE_MAX_P && m / HLL_SPARSE_DENSITY > HLL_SPARSE_MIN_BUFFER * sizeof(uint32_t);
+  return HLL_alloc(p, hash_function, sparse ? HLL_SPARSE : HLL_DENSE);
+}
+
+HLL *HLL_default_sparse(size_t p) {
+  return HLL_new_sparse(p, murmur64a);
+}
+
+// Same as HLL_new, but registers take 6 bits instead of a byte (25% less
+// memory) at the cost of unpacking them when counting or merging.
+HLL *HLL_new_packed(size_t p, ...) {
+  va_list argp;
+  HLL_check_precision(p);
+
+  va_start(argp, p);
+  hash64_func hash_function = va_arg(argp, hash64_func);
+  va_end(argp);
+
+  return HLL_alloc(p, hash_function, HLL_PACKED);
+}
+
+HLL *HLL_default_packed(size_t p) {
+  return HLL_new_packed(p, murmur64a);
+}
+
+// Dense or packed registers placed by `policy`: aligned, on huge pages or in
+// a shared file (see AllocKind). A file that already holds registers of the
+// same mode, p and hash function is reused. Processes sharing one dense
+// sketch must all add with HLL_add_concurrent, as HLL_add can lose another
+// writer's update; a packed file has a single writer. Counts of a shared
+// sketch are not cached, so every HLL_count sees the other writers' adds.
+// HLL_SPARSE keeps its lists on the heap and `policy` is ignored. Returns
+// NULL if the memory cannot be obtained.
+HLL *HLL_new_with(size_t p, hash64_func hash_function, HLLMode mode, AllocPolicy policy) {
+  HLL_check_precision(p);
+  HLL *hll = HLL_alloc(p, hash_function, mode);
+  if (mode == HLL_SPARSE || policy.kind == ALLOC_HEAP) {
+    return hll;
+  }
+  size_t size = mode == HLL_PACKED ? hll->packed_words * sizeof(uint64_t) : hll->m;
+  policy.layout = mode == HLL_PACKED ? ALLOC_LAYOUT_HLL_PACKED : ALLOC_LAYOUT_HLL_DENSE;
+  policy.layout_param = (uint64_t)p | (uint64_t)hash64_id(hash_function) << 8;
+  Allocation allocation;
+  if (!Alloc_zeroed(&allocation, size, policy)) {
+    freeHLL(hll);
+    return NULL;
+  }
+  if (mode == HLL_PACKED) {
+    free(hll->packed);
+    hll->packed = (uint64_t *)allocation.data;
+  } else {
+    free(hll->registers);
+    hll->registers = (uint8_t *)allocation.data;
+  }
+  // freeHLL unmaps `mapping`; aligned heap memory goes through free as usual
+  if (Alloc_is_mapping(&allocation)) {
+    hll->mapping = allocation.mapping;
+    hll->mapping_size = allocation.mapped;
+  }
+  hll->shared = allocation.kind == ALLOC_FILE;
+  return hll;
 }
 
 void freeHLL(HLL *hll) {
-  free(hll->registers);
+  if (hll->mapping) {
+    munmap(hll->mapping, hll->mapping_size);
+  } else {
+    free(hll->registers);
+    free(hll->packed);
+  }
+  free(hll->sparse);
+  free(hll->sparse_buffer);
   free(hll);
 }
 
@@ -52,11 +192,306 @@ size_t HLL_memory_usage(const HLL *hll) {
     exit(EXIT_FAILURE);
   }
 
-  size_t static_size = sizeof(HLL);                  // struct itself
+  size_t static_size = sizeof(HLL);  // struct itself
+  if (hll->mode == HLL_SPARSE) {
+    return static_size + hll->sparse_capacity + hll->sparse_buffer_capacity * sizeof(uint32_t);
+  }
+  if (hll->mode == HLL_PACKED) {
+    return static_size + hll->packed_words * sizeof(uint64_t);
+  }
   size_t registers_size = hll->m * sizeof(uint8_t);  // register array
   return static_size + registers_size;
 }
 
+static inline uint64_t load_le64(const uint8_t *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+static inline void store_le64(uint8_t *p, uint64_t w) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  memcpy(p, &w, sizeof(w));
+}
+
+static inline uint8_t HLL_packed_get(const uint64_t *packed, size_t j) {
+  size_t bit = j * NUM_BITS_PER_REGISTER;
+  uint64_t w = load_le64((const uint8_t *)packed + bit / 8);
+  return (uint8_t)((w >> (bit % 8)) & ((1U << NUM_BITS_PER_REGISTER) - 1));
+}
+
+static inline void HLL_packed_set(uint64_t *packed, size_t j, uint8_t value) {
+  size_t bit = j * NUM_BITS_PER_REGISTER;
+  uint8_t *p = (uint8_t *)packed + bit / 8;
+  uint64_t w = load_le64(p);
+  w &= ~((uint64_t)((1U << NUM_BITS_PER_REGISTER) - 1) << (bit % 8));
+  w |= (uint64_t)value << (bit % 8);
+  store_le64(p, w);
+}
+
+// Unpacks registers [start, start + count) into one byte each. Every 3 bytes
+// hold 4 registers, so aligned groups of 32 registers are expanded from 24
+// bytes at a time: each 128-bit lane spreads 12 bytes into four 24-bit dwords
+// and shifts the four 6-bit fields of each dword into their own byte.
+static void HLL_unpack(const uint64_t *packed, size_t start, size_t count, uint8_t *out) {
+  size_t i = 0;
+#ifdef __AVX2__
+  if (start % HLL_PACKED_GROUP == 0) {
+    const uint8_t *bytes = (const uint8_t *)packed + start * NUM_BITS_PER_REGISTER / 8;
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    for (; i + HLL_PACKED_GROUP <= count; i += HLL_PACKED_GROUP, bytes += HLL_PACKED_GROUP * 6 / 8) {
+      __m128i lo = _mm_loadu_si128((const __m128i *)bytes);
+      __m128i hi = _mm_loadu_si128((const __m128i *)(bytes + 12));
+      __m256i v = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), spread);
+      __m256i r0 = _mm256_and_si256(v, _mm256_set1_epi32(0x3f));
+      __m256i r1 = _mm256_and_si256(_mm256_slli_epi32(v, 2), _mm256_set1_epi32(0x3f00));
+      __m256i r2 = _mm256_and_si256(_mm256_slli_epi32(v, 4), _mm256_set1_epi32(0x3f0000));
+      __m256i r3 = _mm256_and_si256(_mm256_slli_epi32(v, 6), _mm256_set1_epi32(0x3f000000));
+      __m256i r = _mm256_or_si256(_mm256_or_si256(r0, r1), _mm256_or_si256(r2, r3));
+      _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = HLL_packed_get(packed, start + i);
+  }
+}
+
+static void HLL_pack(uint64_t *packed, size_t start, size_t count, const uint8_t *in) {
+  size_t i = 0;
+  if (start % 4 == 0) {
+    uint8_t *bytes = (uint8_t *)packed + start * NUM_BITS_PER_REGISTER / 8;
+    for (; i + 4 <= count; i += 4, bytes += 3) {
+      uint32_t v = (uint32_t)in[i] | (uint32_t)in[i + 1] << 6 | (uint32_t)in[i + 2] << 12 | (uint32_t)in[i + 3] << 18;
+      bytes[0] = (uint8_t)v;
+      bytes[1] = (uint8_t)(v >> 8);
+      bytes[2] = (uint8_t)(v >> 16);
+    }
+  }
+  for (; i < count; ++i) {
+    HLL_packed_set(packed, start + i, in[i]);
+  }
+}
+
+// Byte registers [start, start + count) of a dense or packed HLL, unpacked
+// into `scratch` when needed.
+static const uint8_t *HLL_registers_chunk(const HLL *hll, size_t start, size_t count, uint8_t *scratch) {
+  if (hll->mode == HLL_PACKED) {
+    HLL_unpack(hll->packed, start, count, scratch);
+    return scratch;
+  }
+  return hll->registers + start;
+}
+
+static size_t varint_encode(uint32_t value, uint8_t *out) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+static size_t varint_decode(const uint8_t *in, uint32_t *value) {
+  uint32_t result = 0;
+  size_t n = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    uint8_t byte = in[n++];
+    result |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  *value = result;
+  return n;
+}
+
+// Decodes the sorted list into a new array with room for `extra` more entries
+static uint32_t *HLL_sparse_decode(const HLL *hll, size_t extra) {
+  uint32_t *entries = (uint32_t *)malloc((hll->sparse_count + extra + 1) * sizeof(uint32_t));
+  if (!entries) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  uint32_t entry = 0;
+  size_t pos = 0;
+  for (size_t i = 0; i < hll->sparse_count; ++i) {
+    uint32_t delta;
+    pos += varint_decode(hll->sparse + pos, &delta);
+    entry += delta;
+    entries[i] = entry;
+  }
+  return entries;
+}
+
+// Converts a sparse HLL to byte registers; other modes are left as they are
+void HLL_to_dense(HLL *hll) {
+  if (hll->mode != HLL_SPARSE) {
+    return;
+  }
+  uint8_t *registers = (uint8_t *)calloc(hll->m, sizeof(uint8_t));
+  if (!registers) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  uint32_t *entries = HLL_sparse_decode(hll, 0);
+  for (size_t i = 0; i < hll->sparse_count; ++i) {
+    registers[HLL_SPARSE_INDEX(entries[i])] = HLL_SPARSE_RANK(entries[i]);
+  }
+  for (size_t i = 0; i < hll->sparse_buffer_len; ++i) {
+    uint32_t j = HLL_SPARSE_INDEX(hll->sparse_buffer[i]);
+    uint8_t rank = HLL_SPARSE_RANK(hll->sparse_buffer[i]);
+    if (rank > registers[j]) {
+      registers[j] = rank;
+    }
+  }
+  free(entries);
+  free(hll->sparse);
+  free(hll->sparse_buffer);
+  hll->sparse = NULL;
+  hll->sparse_buffer = NULL;
+  hll->sparse_size = hll->sparse_capacity = hll->sparse_count = 0;
+  hll->sparse_buffer_len = hll->sparse_buffer_capacity = 0;
+  hll->registers = registers;
+  hll->mode = HLL_DENSE;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Sorts the buffer into the list, keeping the highest rank per index, then
+// converts to dense if the list has grown past its budget. The buffer grows
+// with the list so the cost of re-encoding stays amortized.
+static void HLL_sparse_flush(HLL *hll) {
+  if (hll->sparse_buffer_len == 0) {
+    return;
+  }
+  uint32_t *buffer = hll->sparse_buffer;
+  size_t buffer_len = hll->sparse_buffer_len;
+  qsort(buffer, buffer_len, sizeof(uint32_t), compare_entries);
+
+  uint32_t *list = HLL_sparse_decode(hll, 0);
+  uint32_t *merged = (uint32_t *)malloc((hll->sparse_count + buffer_len) * sizeof(uint32_t));
+  if (!merged) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t i = 0, b = 0, n = 0;
+  while (i < hll->sparse_count || b < buffer_len) {
+    uint32_t entry;
+    if (b == buffer_len || (i < hll->sparse_count && list[i] <= buffer[b])) {
+      entry = list[i++];
+    } else {
+      entry = buffer[b++];
+    }
+    // Equal indexes are adjacent and sorted by rank, so the last one wins
+    if (n > 0 && HLL_SPARSE_INDEX(merged[n - 1]) == HLL_SPARSE_INDEX(entry)) {
+      merged[n - 1] = entry;
+    } else {
+      merged[n++] = entry;
+    }
+  }
+  free(list);
+
+  size_t size = 0;
+  uint8_t scratch[5];
+  uint32_t previous = 0;
+  for (size_t k = 0; k < n; ++k) {
+    size += varint_encode(merged[k] - previous, scratch);
+    previous = merged[k];
+  }
+  if (size > hll->sparse_capacity) {
+    uint8_t *sparse = (uint8_t *)realloc(hll->sparse, size);
+    if (!sparse) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    hll->sparse = sparse;
+    hll->sparse_capacity = size;
+  }
+  size_t pos = 0;
+  previous = 0;
+  for (size_t k = 0; k < n; ++k) {
+    pos += varint_encode(merged[k] - previous, hll->sparse + pos);
+    previous = merged[k];
+  }
+  free(merged);
+  hll->sparse_size = size;
+  hll->sparse_count = n;
+  hll->sparse_buffer_len = 0;
+
+  size_t buffer_capacity = n / 4 > HLL_SPARSE_MIN_BUFFER ? n / 4 : HLL_SPARSE_MIN_BUFFER;
+  if (hll->sparse_capacity + buffer_capacity * sizeof(uint32_t) > hll->m / HLL_SPARSE_DENSITY) {
+    HLL_to_dense(hll);
+    return;
+  }
+  if (buffer_capacity != hll->sparse_buffer_capacity) {
+    uint32_t *resized = (uint32_t *)realloc(hll->sparse_buffer, buffer_capacity * sizeof(uint32_t));
+    if (!resized) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    hll->sparse_buffer = resized;
+    hll->sparse_buffer_capacity = buffer_capacity;
+  }
+}
+
+// M[j] = max(M[j], rank) in whichever representation the HLL is using
+static inline void HLL_update(HLL *hll, uint64_t j, uint8_t rank) {
+  if (hll->mode == HLL_SPARSE) {
+    hll->count_valid = false;
+    hll->sparse_buffer[hll->sparse_buffer_len++] = HLL_SPARSE_ENTRY(j, rank);
+    if (hll->sparse_buffer_len == hll->sparse_buffer_capacity) {
+      HLL_sparse_flush(hll);
+    }
+    return;
+  }
+  if (hll->mode == HLL_PACKED) {
+    if (rank > HLL_packed_get(hll->packed, j)) {
+      HLL_packed_set(hll->packed, j, rank);
+      hll->count_valid = false;
+    }
+    return;
+  }
+  if (rank > hll->registers[j]) {
+    hll->registers[j] = rank;
+    hll->count_valid = false;
+  }
+}
+
+// Splits a hash into its register index j (top p bits) and the rank of the
+// remaining q bits, capped to what a register can hold
+uint8_t HLL_rank(size_t p, uint64_t hash_val, uint64_t *j) {
+  const size_t hash_size = 8 * sizeof(uint64_t);
+
+  // j = 1 + <x_1 x_2 ... x_b>_2
+  // Extract the first p bits and add 1
+  *j = hash_val >> (hash_size - p);  // Now j ∈ [0, m-1]
+
+  // w = x_{b+1} x_{b+2} ...
+  // Extract the remaining q bits
+  uint64_t w = hash_val << p;
+
+  // M[j] = max(M[j], p(w))
+  size_t p_w = msb_position(w, hash_size - p);
+
+  // Ensure p_w fits in our register size
+  if (p_w > (1ULL << NUM_BITS_PER_REGISTER) - 1) {
+    p_w = (1ULL << NUM_BITS_PER_REGISTER) - 1;
+  }
+  return (uint8_t)p_w;
+}
+
 void HLL_add(HLL *hll, const void *data, size_t size) {
   if (!hll) {
     fprintf(stderr, "Hyperloglog not intialized.\n");
@@ -66,86 +501,294 @@ void HLL_add(HLL *hll, const void *data, size_t size) {
     fprintf(stderr, "No data provided.\n");
     return;
   }
-  const size_t hash_size = 8 * sizeof(uint64_t);
-
-  uint64_t hash_val = hll->hash_function(data, size);
 
-  // j = 1 + <x_1 x_2 ... x_b>_2
-  // Extract the first p bits and add 1
-  uint64_t j = hash_val >> (hash_size - hll->p);  // Now j ∈ [0, m-1]
+  uint64_t j;
+  uint8_t rank = HLL_rank(hll->p, hll->hash_function(data, size), &j);
+#ifndef NDEBUG
   if (j >= hll->m) {
     fprintf(stderr, "BUG: j out of range: %llu\n", (unsigned long long)j);
     exit(1);
   }
+#endif
 
-  // w = x_{b+1} x_{b+2} ...
-  // Extract the remaining q bits
-  uint64_t w = hash_val << hll->p;
+  // Update register with maximum
+  HLL_update(hll, j, rank);
+}
 
-  // M[j] = max(M[j], p(w))
-  size_t p_w = msb_position(w, hll->q);
+// Lock-free M[j] = max(M[j], rank) for many writers sharing one dense HLL.
+// Registers only ever grow, so a CAS loop that gives up as soon as it sees a
+// value at least as large is enough, and most adds finish after one load.
+void HLL_add_concurrent(HLL *hll, const void *data, size_t size) {
+  if (!hll) {
+    fprintf(stderr, "Hyperloglog not intialized.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (hll->mode != HLL_DENSE) {
+    fprintf(stderr, "Error: concurrent adds need dense registers.\n");
+    return;
+  }
+  if (!data) {
+    fprintf(stderr, "No data provided.\n");
+    return;
+  }
 
-  // Ensure p_w fits in our register size
-  if (p_w > (1ULL << hll->num_bits_per_register) - 1) {
-    p_w = (1ULL << hll->num_bits_per_register) - 1;
+  uint64_t j;
+  uint8_t rank = HLL_rank(hll->p, hll->hash_function(data, size), &j);
+  uint8_t current = __atomic_load_n(&hll->registers[j], __ATOMIC_RELAXED);
+  while (rank > current) {
+    if (__atomic_compare_exchange_n(&hll->registers[j], &current, rank, true, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      __atomic_store_n(&hll->count_valid, false, __ATOMIC_RELAXED);
+      return;
+    }
   }
+}
 
-  // Update register with maximum
-  if (p_w > hll->registers[j]) {
-    hll->registers[j] = (uint8_t)p_w;
-  }
-}
-
-// Helper function to compute the bias correction constant a_m
-static double get_alpha_m(size_t m) {
-  switch (m) {
-    case 16:
-      return 0.673;
-    case 32:
-      return 0.697;
-    case 64:
-      return 0.709;
-    default:
-      if (m >= 128) {
-        return 0.7213 / (1.0 + 1.079 / (double)m);
-      } else {
-        // For m < 16, use the formula (though not recommended)
-        return 0.7213 / (1.0 + 1.079 / (double)m);
-      }
+// Address of the byte holding register j, for prefetching
+static inline const void *HLL_register_address(const HLL *hll, uint64_t j) {
+  if (hll->mode == HLL_PACKED) {
+    return (const uint8_t *)hll->packed + j * NUM_BITS_PER_REGISTER / 8;
   }
+  return hll->registers + j;
 }
 
-double HLL_count(HLL *hll) {
+// Adds keys[0..n) in windows of HLL_BATCH_WINDOW: hash the whole window
+// (several keys per SIMD instruction with murmur64) and prefetch every target
+// register first, so the cache misses overlap instead
+// of stalling one add at a time. All keys must be non-NULL.
+void HLL_add_batch(HLL *hll, const void *const *keys, const size_t *lens, size_t n) {
   if (!hll) {
-    return 0.0;
+    fprintf(stderr, "Hyperloglog not intialized.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (n == 0) {
+    return;
+  }
+  if (!keys || !lens) {
+    fprintf(stderr, "No data provided.\n");
+    return;
   }
 
-  double alpha_m = get_alpha_m(hll->m);
-  double sum = 0.0;
-  size_t zero_count = 0;
+  const hash64_func hash = hll->hash_function;
+  // Hashes, then (index << 8 | rank) once they are split
+  uint64_t slots[HLL_BATCH_WINDOW];
+  for (size_t start = 0; start < n; start += HLL_BATCH_WINDOW) {
+    size_t count = n - start < HLL_BATCH_WINDOW ? n - start : HLL_BATCH_WINDOW;
+    // Sparse adds only append to a buffer, there is nothing to prefetch. A
+    // sparse sketch can turn dense in the middle of a batch, so check again
+    // for every window.
+    const bool prefetch = hll->mode != HLL_SPARSE;
+    hash64_batch(hash, keys + start, lens + start, count, slots);
+    for (size_t i = 0; i < count; i++) {
+      uint64_t j;
+      uint8_t rank = HLL_rank(hll->p, slots[i], &j);
+      slots[i] = j << 8 | rank;
+      if (prefetch) {
+        __builtin_prefetch(HLL_register_address(hll, j), 1);
+      }
+    }
+    for (size_t i = 0; i < count; i++) {
+      HLL_update(hll, slots[i] >> 8, (uint8_t)slots[i]);
+    }
+  }
+}
+
+// Register value histogram. Values cluster in a narrow band around
+// log2(n / m), so the SIMD kernel counts a window of HLL_HISTOGRAM_WINDOW
+// values with one compare + popcount per value and vector, and only falls
+// back to scalar code for the rare lanes outside the window. The window is
+// placed using a small scalar sample of the registers.
+#define HLL_HISTOGRAM_WINDOW 8
+#define HLL_HISTOGRAM_SAMPLE 1024
 
-  for (size_t i = 0; i < hll->m; ++i) {
-    uint8_t reg = hll->registers[i];
-    sum += 1.0 / (1ULL << reg);  // 2^(-register value)
-    if (reg == 0) {
-      zero_count++;
+static void histogram_scalar(const uint8_t *registers, size_t n, size_t *histogram) {
+  // Four interleaved tables so consecutive equal values do not serialize
+  size_t partial[4][HLL_HISTOGRAM_SIZE] = {{0}};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    partial[0][registers[i]]++;
+    partial[1][registers[i + 1]]++;
+    partial[2][registers[i + 2]]++;
+    partial[3][registers[i + 3]]++;
+  }
+  for (; i < n; ++i) {
+    partial[0][registers[i]]++;
+  }
+  for (size_t v = 0; v < HLL_HISTOGRAM_SIZE; ++v) {
+    histogram[v] += partial[0][v] + partial[1][v] + partial[2][v] + partial[3][v];
+  }
+}
+
+#if defined(__AVX512BW__) || defined(__AVX2__)
+// Picks the WINDOW-wide value range holding most registers of a sample
+static uint8_t histogram_window(const uint8_t *registers, size_t n) {
+  size_t sample[HLL_HISTOGRAM_SIZE] = {0};
+  histogram_scalar(registers, n < HLL_HISTOGRAM_SAMPLE ? n : HLL_HISTOGRAM_SAMPLE, sample);
+  size_t best = 0;
+  size_t best_count = 0;
+  for (size_t lo = 0; lo + HLL_HISTOGRAM_WINDOW <= HLL_HISTOGRAM_SIZE; ++lo) {
+    size_t count = 0;
+    for (size_t v = lo; v < lo + HLL_HISTOGRAM_WINDOW; ++v) {
+      count += sample[v];
+    }
+    if (count > best_count) {
+      best = lo;
+      best_count = count;
     }
   }
+  return (uint8_t)best;
+}
+#endif
+
+static void histogram_registers(const uint8_t *registers, size_t n, size_t *histogram) {
+  size_t i = 0;
+#if defined(__AVX512BW__) || defined(__AVX2__)
+  const uint8_t lo = histogram_window(registers, n);
+#endif
+#if defined(__AVX512BW__)
+  const __m512i base = _mm512_set1_epi8((char)lo);
+  const __m512i top = _mm512_set1_epi8(HLL_HISTOGRAM_WINDOW - 1);
+  for (; i + 64 <= n; i += 64) {
+    __m512i v = _mm512_sub_epi8(_mm512_loadu_si512((const void *)(registers + i)), base);
+    for (int k = 0; k < HLL_HISTOGRAM_WINDOW; ++k) {
+      histogram[lo + k] += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)k)));
+    }
+    uint64_t outside = _mm512_cmpgt_epu8_mask(v, top);
+    while (outside) {
+      histogram[registers[i + __builtin_ctzll(outside)]]++;
+      outside &= outside - 1;
+    }
+  }
+#elif defined(__AVX2__)
+  const __m256i base = _mm256_set1_epi8((char)lo);
+  const __m256i top = _mm256_set1_epi8(HLL_HISTOGRAM_WINDOW - 1);
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(registers + i)), base);
+    for (int k = 0; k < HLL_HISTOGRAM_WINDOW; ++k) {
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)k)));
+      histogram[lo + k] += (size_t)__builtin_popcount(mask);
+    }
+    // Lanes where (value - lo) > WINDOW - 1, compared unsigned
+    uint32_t inside = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, top), top));
+    uint32_t outside = ~inside;
+    while (outside) {
+      histogram[registers[i + __builtin_ctz(outside)]]++;
+      outside &= outside - 1;
+    }
+  }
+#endif
+  histogram_scalar(registers + i, n - i, histogram);
+}
+
+void HLL_histogram(HLL *hll, size_t *histogram) {
+  memset(histogram, 0, HLL_HISTOGRAM_SIZE * sizeof(size_t));
+  if (hll->mode == HLL_SPARSE) {
+    HLL_sparse_flush(hll);
+  }
+  if (hll->mode == HLL_SPARSE) {
+    // Registers missing from the list are zero
+    uint32_t *entries = HLL_sparse_decode(hll, 0);
+    histogram[0] = hll->m - hll->sparse_count;
+    for (size_t i = 0; i < hll->sparse_count; ++i) {
+      histogram[HLL_SPARSE_RANK(entries[i])]++;
+    }
+    free(entries);
+    return;
+  }
+  if (hll->mode == HLL_DENSE) {
+    histogram_registers(hll->registers, hll->m, histogram);
+    return;
+  }
+  uint8_t scratch[HLL_CHUNK];
+  for (size_t start = 0; start < hll->m; start += HLL_CHUNK) {
+    size_t n = hll->m - start < HLL_CHUNK ? hll->m - start : HLL_CHUNK;
+    histogram_registers(HLL_registers_chunk(hll, start, n, scratch), n, histogram);
+  }
+}
 
-  double raw_estimate = alpha_m * hll->m * hll->m / sum;
+static double HLL_sigma(double x) {
+  double y = 1.0;
+  double z = x;
+  double z_prev;
+  do {
+    x *= x;
+    z_prev = z;
+    z += x * y;
+    y += y;
+  } while (z != z_prev);
+  return z;
+}
 
-  // Small range correction: linear counting
-  if (raw_estimate <= (5.0 / 2.0) * hll->m && zero_count > 0) {
-    return hll->m * log((double)hll->m / zero_count);
+static double HLL_tau(double x) {
+  if (x == 0.0 || x == 1.0) {
+    return 0.0;
   }
+  double y = 1.0;
+  double z = 1.0 - x;
+  double z_prev;
+  do {
+    x = sqrt(x);
+    z_prev = z;
+    y *= 0.5;
+    z -= (1.0 - x) * (1.0 - x) * y;
+  } while (z != z_prev);
+  return z / 3.0;
+}
 
-  // Large range correction (optional but common in full implementations)
-  const double two_to_64 = 18446744073709551616.0;  // 2^64
-  if (raw_estimate > (1.0 / 30.0) * two_to_64) {
-    return -two_to_64 * log(1.0 - (raw_estimate / two_to_64));
+// Ertl's improved estimator ("New cardinality estimation algorithms for
+// HyperLogLog sketches", 2017). It only needs the register histogram, is
+// accurate over the whole range without bias tables or range corrections,
+// and costs O(q) instead of O(m).
+double HLL_estimate_from_histogram(const size_t *histogram, size_t m, size_t q) {
+  if (histogram[0] == m) {
+    return 0.0;
+  }
+  const double md = (double)m;
+  size_t top = q + 1 < HLL_HISTOGRAM_SIZE ? q + 1 : HLL_HISTOGRAM_SIZE - 1;
+  double z = md * HLL_tau(1.0 - (double)histogram[top] / md);
+  for (size_t k = top; k-- > 1;) {
+    z = 0.5 * (z + (double)histogram[k]);
+  }
+  z += md * HLL_sigma((double)histogram[0] / md);
+  const double alpha_inf = 0.5 / log(2.0);
+  return alpha_inf * md * md / z;
+}
+
+// The estimate is cached until the next add or merge changes a register, so
+// repeated polling of an idle sketch is O(1). Registers shared with other
+// processes can change at any time and are always counted.
+double HLL_count(HLL *hll) {
+  if (!hll) {
+    return 0.0;
+  }
+  if (hll->count_valid && !hll->shared) {
+    return hll->cached_count;
   }
 
-  return raw_estimate;
+  size_t histogram[HLL_HISTOGRAM_SIZE];
+  HLL_histogram(hll, histogram);
+  hll->cached_count = HLL_estimate_from_histogram(histogram, hll->m, hll->q);
+  hll->count_valid = true;
+  return hll->cached_count;
+}
+
+// d[i] = max(d[i], s[i])
+static void HLL_max_bytes(uint8_t *d, const uint8_t *s, size_t n) {
+  size_t i = 0;
+#if defined(__AVX512BW__)
+  for (; i + 64 <= n; i += 64) {
+    __m512i v = _mm512_max_epu8(_mm512_loadu_si512((const void *)(d + i)), _mm512_loadu_si512((const void *)(s + i)));
+    _mm512_storeu_si512((void *)(d + i), v);
+  }
+#elif defined(__AVX2__)
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_max_epu8(_mm256_loadu_si256((const __m256i *)(d + i)), _mm256_loadu_si256((const __m256i *)(s + i)));
+    _mm256_storeu_si256((__m256i *)(d + i), v);
+  }
+#endif
+  for (; i < n; ++i) {
+    d[i] = s[i] > d[i] ? s[i] : d[i];
+  }
 }
 
 void HLL_merge(HLL *dest, const HLL *src) {
@@ -158,10 +801,144 @@ void HLL_merge(HLL *dest, const HLL *src) {
     fprintf(stderr, "Error: HLLs have incompatible precision or size.\n");
     return;
   }
+  dest->count_valid = false;
+
+  if (src->mode == HLL_SPARSE) {
+    // Only the non-zero registers of src need visiting
+    uint32_t *entries = HLL_sparse_decode(src, src->sparse_buffer_len);
+    memcpy(entries + src->sparse_count, src->sparse_buffer, src->sparse_buffer_len * sizeof(uint32_t));
+    size_t n = src->sparse_count + src->sparse_buffer_len;
+    for (size_t i = 0; i < n; ++i) {
+      HLL_update(dest, HLL_SPARSE_INDEX(entries[i]), HLL_SPARSE_RANK(entries[i]));
+    }
+    free(entries);
+    return;
+  }
+
+  HLL_to_dense(dest);
+  if (dest->mode == HLL_DENSE && src->mode == HLL_DENSE) {
+    HLL_max_bytes(dest->registers, src->registers, dest->m);
+    return;
+  }
 
-  for (size_t i = 0; i < dest->m; ++i) {
-    if (src->registers[i] > dest->registers[i]) {
-      dest->registers[i] = src->registers[i];
+  // At least one side is packed: work through unpacked chunks
+  uint8_t dest_scratch[HLL_CHUNK];
+  uint8_t src_scratch[HLL_CHUNK];
+  for (size_t start = 0; start < dest->m; start += HLL_CHUNK) {
+    size_t n = dest->m - start < HLL_CHUNK ? dest->m - start : HLL_CHUNK;
+    const uint8_t *s = HLL_registers_chunk(src, start, n, src_scratch);
+    uint8_t *d = (uint8_t *)HLL_registers_chunk(dest, start, n, dest_scratch);
+    HLL_max_bytes(d, s, n);
+    if (dest->mode == HLL_PACKED) {
+      HLL_pack(dest->packed, start, n, d);
+    }
+  }
+}
+
+typedef struct {
+  HLL *dest;
+  const HLL *const *srcs;  // Dense or packed sources only
+  size_t num_srcs;
+  size_t start;            // Register range [start, end) of this worker
+  size_t end;
+} HLLMergeTask;
+
+// Merges every source into dest one HLL_CHUNK tile at a time: the tile of dest
+// stays in L1 while the sources stream past it, so dest is read and written
+// once however many sources there are.
+static void *HLL_merge_range(void *arg) {
+  HLLMergeTask *task = (HLLMergeTask *)arg;
+  HLL *dest = task->dest;
+  uint8_t dest_scratch[HLL_CHUNK];
+  uint8_t src_scratch[HLL_CHUNK];
+  for (size_t start = task->start; start < task->end; start += HLL_CHUNK) {
+    size_t n = task->end - start < HLL_CHUNK ? task->end - start : HLL_CHUNK;
+    uint8_t *d = (uint8_t *)HLL_registers_chunk(dest, start, n, dest_scratch);
+    for (size_t k = 0; k < task->num_srcs; ++k) {
+      if (k + 1 < task->num_srcs && task->srcs[k + 1]->mode == HLL_DENSE) {
+        __builtin_prefetch(task->srcs[k + 1]->registers + start);
+      }
+      HLL_max_bytes(d, HLL_registers_chunk(task->srcs[k], start, n, src_scratch), n);
+    }
+    if (dest->mode == HLL_PACKED) {
+      HLL_pack(dest->packed, start, n, d);
+    }
+  }
+  return NULL;
+}
+
+static size_t HLL_merge_threads(const HLL *dest, size_t num_srcs) {
+  // Packed tiles are unpacked with reads that run a few bytes into the next
+  // tile, so only dense destinations are split between threads
+  if (dest->mode != HLL_DENSE) {
+    return 1;
+  }
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads = cpus > 0 ? (size_t)cpus : 1;
+  size_t by_work = dest->m * num_srcs / HLL_MERGE_MIN_WORK;
+  size_t by_tiles = (dest->m + HLL_CHUNK - 1) / HLL_CHUNK;
+  threads = threads < HLL_MERGE_MAX_THREADS ? threads : HLL_MERGE_MAX_THREADS;
+  threads = threads < by_work ? threads : by_work;
+  threads = threads < by_tiles ? threads : by_tiles;
+  return threads ? threads : 1;
+}
+
+// dest = max(dest, srcs[0], ..., srcs[n - 1]) in a single pass over dest. The
+// register range is split between up to HLL_MERGE_MAX_THREADS workers once
+// there is enough work. Sparse sources only hold a few registers each, and
+// are applied one by one afterwards.
+void HLL_merge_many(HLL *dest, const HLL *const *srcs, size_t n) {
+  if (!dest || (!srcs && n > 0)) {
+    fprintf(stderr, "Error: One or both HLL inputs are NULL.\n");
+    return;
+  }
+  const HLL **dense = (const HLL **)malloc((n ? n : 1) * sizeof(HLL *));
+  if (!dense) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t num_dense = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!srcs[i] || srcs[i]->p != dest->p) {
+      fprintf(stderr, "Error: HLLs have incompatible precision or size.\n");
+      free(dense);
+      return;
+    }
+    if (srcs[i]->mode != HLL_SPARSE) {
+      dense[num_dense++] = srcs[i];
+    }
+  }
+
+  if (num_dense > 0) {
+    HLL_to_dense(dest);
+    dest->count_valid = false;
+    size_t threads = HLL_merge_threads(dest, num_dense);
+    HLLMergeTask tasks[HLL_MERGE_MAX_THREADS];
+    pthread_t workers[HLL_MERGE_MAX_THREADS];
+    bool started[HLL_MERGE_MAX_THREADS] = {false};
+    // Tile-aligned ranges, so no two workers touch the same chunk
+    size_t tiles = (dest->m + HLL_CHUNK - 1) / HLL_CHUNK;
+    for (size_t t = 0; t < threads; ++t) {
+      size_t start = tiles * t / threads * HLL_CHUNK;
+      size_t end = tiles * (t + 1) / threads * HLL_CHUNK;
+      tasks[t] = (HLLMergeTask){dest, dense, num_dense, start, end < dest->m ? end : dest->m};
+      started[t] = t + 1 < threads && pthread_create(&workers[t], NULL, HLL_merge_range, &tasks[t]) == 0;
+      if (!started[t]) {
+        // Last range, or no thread available: merge it on this thread
+        HLL_merge_range(&tasks[t]);
+      }
+    }
+    for (size_t t = 0; t < threads; ++t) {
+      if (started[t]) {
+        pthread_join(workers[t], NULL);
+      }
+    }
+  }
+  free(dense);
+
+  for (size_t i = 0; i < n; ++i) {
+    if (srcs[i]->mode == HLL_SPARSE) {
+      HLL_merge(dest, srcs[i]);
     }
   }
 }
@@ -181,17 +958,528 @@ HLL *HLL_merge_copy(const HLL *a, const HLL *b) {
     fprintf(stderr, "Warning: HLLs use different hash functions. Proceeding anyway.\n");
   }
 
-  // Create a new HLL instance with the same parameters
-  HLL *merged = HLL_new(a->p, a->hash_function);
+  // Create a new HLL instance with the same parameters, keeping the inputs'
+  // representation when they agree (a sparse input adopts the other's)
+  HLLMode mode = HLL_DENSE;
+  if (a->mode == b->mode || b->mode == HLL_SPARSE) {
+    mode = a->mode;
+  } else if (a->mode == HLL_SPARSE) {
+    mode = b->mode;
+  }
+  HLL *merged = HLL_alloc(a->p, a->hash_function, mode);
   if (!merged) {
     fprintf(stderr, "Error: Failed to allocate merged HLL.\n");
     return NULL;
   }
 
-  // Take the element-wise maximum of the registers
-  for (size_t i = 0; i < merged->m; ++i) {
-    merged->registers[i] = (a->registers[i] > b->registers[i]) ? a->registers[i] : b->registers[i];
+  if (mode == HLL_DENSE && a->mode == HLL_DENSE && b->mode == HLL_DENSE) {
+    // Take the element-wise maximum of the registers
+    for (size_t i = 0; i < merged->m; ++i) {
+      merged->registers[i] = (a->registers[i] > b->registers[i]) ? a->registers[i] : b->registers[i];
+    }
+    return merged;
   }
-
+  HLL_merge(merged, a);
+  HLL_merge(merged, b);
   return merged;
 }
+
+typedef char HLLFileHeader_size_check[sizeof(HLLFileHeader) == HLL_FILE_HEADER_SIZE ? 1 : -1];
+
+#define HLL_VARINT_MAX 5  // Bytes of a varint-encoded uint32_t
+
+static uint64_t HLLFileHeader_checksum(const HLLFileHeader *header) {
+  return murmur64(header, offsetof(HLLFileHeader, header_checksum), HLL_FILE_CHECKSUM_SEED);
+}
+
+static size_t HLL_packed_size(size_t m) {
+  return ((m * NUM_BITS_PER_REGISTER + 63) / 64 + HLL_PACKED_SLACK_WORDS) * sizeof(uint64_t);
+}
+
+// Every register as a byte, whatever the mode; the caller frees the array
+static uint8_t *HLL_registers_copy(HLL *hll) {
+  uint8_t *registers = (uint8_t *)malloc(hll->m);
+  if (!registers) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (hll->mode == HLL_SPARSE) {
+    HLL_sparse_flush(hll);
+  }
+  if (hll->mode == HLL_SPARSE) {
+    memset(registers, 0, hll->m);
+    uint32_t *entries = HLL_sparse_decode(hll, 0);
+    for (size_t i = 0; i < hll->sparse_count; ++i) {
+      registers[HLL_SPARSE_INDEX(entries[i])] = HLL_SPARSE_RANK(entries[i]);
+    }
+    free(entries);
+  } else if (hll->mode == HLL_PACKED) {
+    HLL_unpack(hll->packed, 0, hll->m, registers);
+  } else {
+    memcpy(registers, hll->registers, hll->m);
+  }
+  return registers;
+}
+
+static size_t HLL_encode_sparse(const uint8_t *registers, size_t m, uint8_t *out) {
+  size_t pos = 0;
+  uint32_t previous = 0;
+  for (size_t j = 0; j < m; ++j) {
+    if (registers[j]) {
+      uint32_t entry = HLL_SPARSE_ENTRY(j, registers[j]);
+      pos += varint_encode(entry - previous, out + pos);
+      previous = entry;
+    }
+  }
+  return pos;
+}
+
+// Registers cluster in a narrow band of values, so most of them fit in a few
+// bits as an offset from a base value. The width and base are chosen from the
+// histogram to minimise the size; registers outside [base, base + 2^w - 2]
+// are stored as the escape code 2^w - 1 and listed separately.
+// Layout: base, width, varint exception count, the m w-bit codes packed
+// little-endian, then (varint index delta, value) per exception.
+static void HLL_compressed_params(const size_t *histogram, size_t m, uint8_t *base, uint8_t *width,
+                                  size_t *exceptions) {
+  size_t best_size = SIZE_MAX;
+  for (uint8_t w = 1; w <= NUM_BITS_PER_REGISTER; ++w) {
+    size_t span = ((size_t)1 << w) - 1;
+    for (size_t b = 0; b + span <= HLL_HISTOGRAM_SIZE; ++b) {
+      size_t inside = 0;
+      for (size_t v = b; v < b + span; ++v) {
+        inside += histogram[v];
+      }
+      // Exceptions cost about 3 bytes: a short index delta and the value
+      size_t size = (m * w + 7) / 8 + (m - inside) * 3;
+      if (size < best_size) {
+        best_size = size;
+        *base = (uint8_t)b;
+        *width = w;
+        *exceptions = m - inside;
+      }
+    }
+  }
+}
+
+static size_t HLL_compressed_bound(size_t m, uint8_t width, size_t exceptions) {
+  return 2 + HLL_VARINT_MAX + (m * width + 7) / 8 + exceptions * (HLL_VARINT_MAX + 1);
+}
+
+static size_t HLL_encode_compressed(const uint8_t *registers, size_t m, uint8_t base, uint8_t width,
+                                    size_t exceptions, uint8_t *out) {
+  const uint8_t escape = (uint8_t)((1U << width) - 1);
+  size_t pos = 0;
+  out[pos++] = base;
+  out[pos++] = width;
+  pos += varint_encode((uint32_t)exceptions, out + pos);
+
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  for (size_t j = 0; j < m; ++j) {
+    uint8_t offset = (uint8_t)(registers[j] - base);
+    uint8_t code = registers[j] >= base && offset < escape ? offset : escape;
+    acc |= (uint64_t)code << bits;
+    bits += width;
+    while (bits >= 8) {
+      out[pos++] = (uint8_t)acc;
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+  if (bits) {
+    out[pos++] = (uint8_t)acc;
+  }
+
+  size_t previous = 0;
+  for (size_t j = 0; j < m; ++j) {
+    uint8_t offset = (uint8_t)(registers[j] - base);
+    if (registers[j] < base || offset >= escape) {
+      pos += varint_encode((uint32_t)(j - previous), out + pos);
+      out[pos++] = registers[j];
+      previous = j;
+    }
+  }
+  return pos;
+}
+
+// Returns a malloc'd buffer with the header and the registers in `encoding`.
+// Sparse sketches are flushed first, which may switch them to dense.
+uint8_t *HLL_serialize(HLL *hll, HLLEncoding encoding, size_t *size) {
+  if (!hll || !size) {
+    fprintf(stderr, "Hyperloglog not intialized.\n");
+    return NULL;
+  }
+  if (encoding > HLL_ENCODING_AUTO) {
+    fprintf(stderr, "Error: Unknown HLL encoding %d.\n", (int)encoding);
+    return NULL;
+  }
+  uint32_t hash_id = hash64_id(hll->hash_function);
+  if (hash_id == HASH_ID_UNKNOWN) {
+    fprintf(stderr, "Error: Hash function has no registered identifier.\n");
+    return NULL;
+  }
+  if (hll->p > HLL_SPARSE_MAX_P && (encoding == HLL_ENCODING_SPARSE || encoding == HLL_ENCODING_AUTO)) {
+    encoding = encoding == HLL_ENCODING_AUTO ? HLL_ENCODING_COMPRESSED : encoding;
+    if (encoding == HLL_ENCODING_SPARSE) {
+      fprintf(stderr, "Error: Sparse encoding needs p <= %d.\n", HLL_SPARSE_MAX_P);
+      return NULL;
+    }
+  }
+
+  const size_t m = hll->m;
+  uint8_t *registers = HLL_registers_copy(hll);
+  size_t histogram[HLL_HISTOGRAM_SIZE] = {0};
+  histogram_registers(registers, m, histogram);
+
+  uint8_t base = 0, width = NUM_BITS_PER_REGISTER;
+  size_t exceptions = 0;
+  size_t bound = m;
+  if (encoding == HLL_ENCODING_PACKED) {
+    bound = HLL_packed_size(m);
+  } else if (encoding == HLL_ENCODING_SPARSE || encoding == HLL_ENCODING_AUTO) {
+    bound = (m - histogram[0]) * HLL_VARINT_MAX;
+  }
+  if (encoding == HLL_ENCODING_COMPRESSED || encoding == HLL_ENCODING_AUTO) {
+    HLL_compressed_params(histogram, m, &base, &width, &exceptions);
+    size_t compressed = HLL_compressed_bound(m, width, exceptions);
+    bound = bound > compressed ? bound : compressed;
+  }
+
+  uint8_t *buffer = (uint8_t *)calloc(1, HLL_FILE_HEADER_SIZE + bound);
+  if (!buffer) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  uint8_t *payload = buffer + HLL_FILE_HEADER_SIZE;
+  size_t payload_size = 0;
+  if (encoding == HLL_ENCODING_DENSE) {
+    memcpy(payload, registers, m);
+    payload_size = m;
+  } else if (encoding == HLL_ENCODING_PACKED) {
+    HLL_pack((uint64_t *)payload, 0, m, registers);
+    payload_size = bound;
+  } else if (encoding == HLL_ENCODING_SPARSE) {
+    payload_size = HLL_encode_sparse(registers, m, payload);
+  } else if (encoding == HLL_ENCODING_COMPRESSED) {
+    payload_size = HLL_encode_compressed(registers, m, base, width, exceptions, payload);
+  } else {
+    // Sparse wins for nearly empty sketches, compressed everywhere else
+    payload_size = HLL_encode_sparse(registers, m, payload);
+    encoding = HLL_ENCODING_SPARSE;
+    if (payload_size > HLL_compressed_bound(m, width, exceptions)) {
+      payload_size = HLL_encode_compressed(registers, m, base, width, exceptions, payload);
+      encoding = HLL_ENCODING_COMPRESSED;
+    }
+  }
+  free(registers);
+
+  HLLFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HLL_FILE_MAGIC, sizeof(header.magic));
+  header.version = HLL_FILE_VERSION;
+  header.encoding = (uint32_t)encoding;
+  header.p = (uint32_t)hll->p;
+  header.hash_id = hash_id;
+  header.payload_size = payload_size;
+  header.payload_checksum = murmur64(payload, payload_size, HLL_FILE_CHECKSUM_SEED);
+  header.header_checksum = HLLFileHeader_checksum(&header);
+  memcpy(buffer, &header, sizeof(header));
+  *size = HLL_FILE_HEADER_SIZE + payload_size;
+  return buffer;
+}
+
+// Validates the header against the available bytes and builds an empty HLL
+// in the mode the encoding decodes to.
+static HLL *HLL_from_header(const HLLFileHeader *header, size_t size) {
+  if (size < HLL_FILE_HEADER_SIZE || memcmp(header->magic, HLL_FILE_MAGIC, sizeof(header->magic)) != 0) {
+    fprintf(stderr, "Error: Not a HyperLogLog file.\n");
+    return NULL;
+  }
+  if (header->version != HLL_FILE_VERSION) {
+    fprintf(stderr, "Error: Unsupported HyperLogLog file version %u.\n", header->version);
+    return NULL;
+  }
+  if (header->header_checksum != HLLFileHeader_checksum(header)) {
+    fprintf(stderr, "Error: HyperLogLog header checksum mismatch.\n");
+    return NULL;
+  }
+  size_t m = (size_t)1 << (header->p < 64 ? header->p : 0);
+  bool valid_size = header->encoding == HLL_ENCODING_DENSE    ? header->payload_size == m
+                    : header->encoding == HLL_ENCODING_PACKED ? header->payload_size == HLL_packed_size(m)
+                                                              : true;
+  if (header->p < 4 || header->p > 32 || header->encoding >= HLL_ENCODING_AUTO || !valid_size ||
+      (header->encoding == HLL_ENCODING_SPARSE && header->p > HLL_SPARSE_MAX_P) ||
+      size - HLL_FILE_HEADER_SIZE < header->payload_size) {
+    fprintf(stderr, "Error: Corrupt HyperLogLog header.\n");
+    return NULL;
+  }
+  hash64_func hash_function = hash64_from_id(header->hash_id);
+  if (NULL == hash_function) {
+    fprintf(stderr, "Error: Unknown hash function identifier %u.\n", header->hash_id);
+    return NULL;
+  }
+  HLLMode mode = header->encoding == HLL_ENCODING_PACKED   ? HLL_PACKED
+                 : header->encoding == HLL_ENCODING_SPARSE ? HLL_SPARSE
+                                                           : HLL_DENSE;
+  return HLL_alloc(header->p, hash_function, mode);
+}
+
+// Registers index the histograms in HLL_count, so untrusted bytes must stay
+// below HLL_HISTOGRAM_SIZE. OR-ing them keeps the scan branch-free.
+static bool HLL_registers_in_range(const uint8_t *registers, size_t m) {
+  uint8_t bits = 0;
+  for (size_t j = 0; j < m; ++j) {
+    bits |= registers[j];
+  }
+  return bits < HLL_HISTOGRAM_SIZE;
+}
+
+// Bounds-checked varint_decode for untrusted input; returns 0 on overrun
+static size_t varint_decode_checked(const uint8_t *in, const uint8_t *end, uint32_t *value) {
+  uint32_t result = 0;
+  for (size_t n = 0; n < HLL_VARINT_MAX && in + n < end; ++n) {
+    result |= (uint32_t)(in[n] & 0x7f) << (7 * n);
+    if (!(in[n] & 0x80)) {
+      *value = result;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+static bool HLL_decode_sparse(HLL *hll, const uint8_t *payload, size_t size) {
+  const uint8_t *end = payload + size;
+  size_t count = 0;
+  uint64_t entry = 0;
+  uint64_t previous = 0;
+  for (const uint8_t *in = payload; in < end;) {
+    uint32_t delta;
+    size_t n = varint_decode_checked(in, end, &delta);
+    // Entries are strictly increasing by index and have a non-zero rank
+    entry += delta;
+    if (n == 0 || entry > UINT32_MAX || HLL_SPARSE_INDEX(entry) >= hll->m || HLL_SPARSE_RANK(entry) == 0 ||
+        (count > 0 && HLL_SPARSE_INDEX(entry) <= HLL_SPARSE_INDEX(previous))) {
+      return false;
+    }
+    previous = entry;
+    in += n;
+    count++;
+  }
+  if (size) {
+    hll->sparse = (uint8_t *)malloc(size);
+    if (!hll->sparse) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(hll->sparse, payload, size);
+  }
+  hll->sparse_size = hll->sparse_capacity = size;
+  hll->sparse_count = count;
+  return true;
+}
+
+static bool HLL_decode_compressed(HLL *hll, const uint8_t *payload, size_t size) {
+  const uint8_t *end = payload + size;
+  if (size < 3 || payload[1] == 0 || payload[1] > NUM_BITS_PER_REGISTER) {
+    return false;
+  }
+  const uint8_t base = payload[0];
+  const uint8_t width = payload[1];
+  const uint8_t escape = (uint8_t)((1U << width) - 1);
+  // Codes decode to at most base + escape - 1
+  if ((size_t)base + escape - 1 >= HLL_HISTOGRAM_SIZE) {
+    return false;
+  }
+  uint32_t exceptions;
+  size_t n = varint_decode_checked(payload + 2, end, &exceptions);
+  const uint8_t *in = payload + 2 + n;
+  if (n == 0 || (size_t)(end - in) < (hll->m * width + 7) / 8) {
+    return false;
+  }
+
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  size_t escaped = 0;
+  for (size_t j = 0; j < hll->m; ++j) {
+    while (bits < width) {
+      acc |= (uint64_t)*in++ << bits;
+      bits += 8;
+    }
+    uint8_t code = (uint8_t)(acc & escape);
+    acc >>= width;
+    bits -= width;
+    escaped += code == escape;
+    hll->registers[j] = code == escape ? 0 : (uint8_t)(base + code);
+  }
+
+  size_t j = 0;
+  for (uint32_t i = 0; i < exceptions; ++i) {
+    uint32_t delta;
+    n = varint_decode_checked(in, end, &delta);
+    if (n == 0 || in + n >= end) {
+      return false;
+    }
+    in += n;
+    j += delta;
+    if (j >= hll->m || *in >= HLL_HISTOGRAM_SIZE) {
+      return false;
+    }
+    hll->registers[j] = *in++;
+  }
+  return exceptions == escaped && in == end;
+}
+
+HLL *HLL_deserialize(const void *data, size_t size) {
+  if (!data) {
+    fprintf(stderr, "No data provided.\n");
+    return NULL;
+  }
+  HLLFileHeader header;
+  if (size < sizeof(header)) {
+    fprintf(stderr, "Error: Not a HyperLogLog file.\n");
+    return NULL;
+  }
+  memcpy(&header, data, sizeof(header));
+  HLL *hll = HLL_from_header(&header, size);
+  if (!hll) {
+    return NULL;
+  }
+
+  const uint8_t *payload = (const uint8_t *)data + HLL_FILE_HEADER_SIZE;
+  bool ok = murmur64(payload, header.payload_size, HLL_FILE_CHECKSUM_SEED) == header.payload_checksum;
+  if (ok) {
+    switch ((HLLEncoding)header.encoding) {
+      case HLL_ENCODING_DENSE:
+        ok = HLL_registers_in_range(payload, hll->m);
+        if (ok) {
+          memcpy(hll->registers, payload, hll->m);
+        }
+        break;
+      case HLL_ENCODING_PACKED:
+        memcpy(hll->packed, payload, header.payload_size);
+        break;
+      case HLL_ENCODING_SPARSE:
+        ok = HLL_decode_sparse(hll, payload, header.payload_size);
+        break;
+      default:
+        ok = HLL_decode_compressed(hll, payload, header.payload_size);
+        break;
+    }
+  }
+  if (!ok) {
+    fprintf(stderr, "Error: HyperLogLog payload is truncated or corrupt.\n");
+    freeHLL(hll);
+    return NULL;
+  }
+  return hll;
+}
+
+bool HLL_save(HLL *hll, const char *path, HLLEncoding encoding) {
+  size_t size;
+  uint8_t *buffer = HLL_serialize(hll, encoding, &size);
+  if (!buffer) {
+    return false;
+  }
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    perror("Failed to open file");
+    free(buffer);
+    return false;
+  }
+  bool ok = fwrite(buffer, 1, size, file) == size;
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error: Failed to write HyperLogLog to %s.\n", path);
+  }
+  free(buffer);
+  return ok;
+}
+
+HLL *HLL_load(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror("Failed to open file");
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fileno(file), &st) != 0) {
+    perror("Failed to stat file");
+    fclose(file);
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  uint8_t *buffer = (uint8_t *)malloc(size ? size : 1);
+  if (!buffer) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  bool ok = fread(buffer, 1, size, file) == size;
+  fclose(file);
+  HLL *hll = NULL;
+  if (ok) {
+    hll = HLL_deserialize(buffer, size);
+  } else {
+    fprintf(stderr, "Error: Failed to read HyperLogLog from %s.\n", path);
+  }
+  free(buffer);
+  return hll;
+}
+
+// Maps a dense or packed file read-only and counts or merges straight from
+// the page cache, so opening is O(1) and several processes can share one
+// sketch. The header and the range of dense registers are verified, the
+// payload checksum is not; the returned HLL must not be added to or used as a
+// merge destination.
+HLL *HLL_mmap(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("Failed to open file");
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < HLL_FILE_HEADER_SIZE) {
+    fprintf(stderr, "Error: %s is too small to be a HyperLogLog file.\n", path);
+    close(fd);
+    return NULL;
+  }
+  size_t mapping_size = (size_t)st.st_size;
+  void *mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    perror("Failed to map file");
+    return NULL;
+  }
+
+  const HLLFileHeader *header = (const HLLFileHeader *)mapping;
+  if (header->encoding != HLL_ENCODING_DENSE && header->encoding != HLL_ENCODING_PACKED) {
+    fprintf(stderr, "Error: Only dense and packed HyperLogLog files can be mapped.\n");
+    munmap(mapping, mapping_size);
+    return NULL;
+  }
+  HLL *hll = HLL_from_header(header, mapping_size);
+  if (!hll) {
+    munmap(mapping, mapping_size);
+    return NULL;
+  }
+  void *payload = (uint8_t *)mapping + HLL_FILE_HEADER_SIZE;
+  // Packed fields cannot exceed 6 bits, dense bytes can
+  if (hll->mode == HLL_DENSE && !HLL_registers_in_range((const uint8_t *)payload, hll->m)) {
+    fprintf(stderr, "Error: HyperLogLog payload is truncated or corrupt.\n");
+    freeHLL(hll);
+    munmap(mapping, mapping_size);
+    return NULL;
+  }
+  if (hll->mode == HLL_PACKED) {
+    free(hll->packed);
+    hll->packed = (uint64_t *)payload;
+  } else {
+    free(hll->registers);
+    hll->registers = (uint8_t *)payload;
+  }
+  hll->mapping = mapping;
+  hll->mapping_size = mapping_size;
+  return hll;
+}
@@ -9,9 +9,34 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "../lib/hash.h"
+#include "../lib/alloc.h"
 #include "../lib/bitarray.h"
 
 #define NUM_BITS_PER_REGISTER 6
+#define HLL_SPARSE_MAX_P 26          // Index and 6-bit rank must fit one uint32_t entry
+#define HLL_SPARSE_MIN_BUFFER 64     // Unsorted entries collected before merging into the list
+#define HLL_SPARSE_DENSITY 4         // Switch to dense once sparse storage exceeds m / 4 bytes
+#define HLL_PACKED_GROUP 32          // Registers per 24-byte unpack step
+#define HLL_PACKED_SLACK_WORDS 4     // Zero words after the last packed register, see HLL_alloc
+#define HLL_CHUNK 4096               // Registers unpacked at a time when counting or merging
+#define HLL_MERGE_MAX_THREADS 16     // Workers used by HLL_merge_many
+#define HLL_MERGE_MIN_WORK (1 << 24) // Source registers per HLL_merge_many worker
+#define HLL_BATCH_WINDOW 16          // Keys hashed and prefetched together by HLL_add_batch
+#define HLL_HISTOGRAM_SIZE (1 << NUM_BITS_PER_REGISTER)
+
+typedef enum {
+  HLL_DENSE,   // One byte per register
+  HLL_SPARSE,  // Sorted list of (index, rank) entries for the non-zero registers
+  HLL_PACKED,  // 6-bit registers packed back to back into 64-bit words
+} HLLMode;
+
+typedef enum {
+  HLL_ENCODING_DENSE,       // One byte per register; can be mapped with HLL_mmap
+  HLL_ENCODING_PACKED,      // 6-bit packed words; can be mapped with HLL_mmap
+  HLL_ENCODING_SPARSE,      // Varint delta-encoded (index, rank) list of the non-zero registers
+  HLL_ENCODING_COMPRESSED,  // Narrow offsets from a base value plus a list of exceptions
+  HLL_ENCODING_AUTO,        // Whichever of sparse and compressed is smaller
+} HLLEncoding;
 
 typedef struct {
   uint8_t *registers;
@@ -20,15 +45,111 @@ typedef struct {
   size_t p;  // Precision parameter that controls relative estimation error
   size_t q;  // Using a (p+q)-bit hash value
   size_t m;  // Number of registers
+  HLLMode mode;
+  // HLL_SPARSE only: entries are (index << 6 | rank), kept sorted by index and
+  // stored as varint-encoded deltas, plus an unsorted buffer of recent adds.
+  uint8_t *sparse;
+  size_t sparse_size;      // Bytes used in `sparse`
+  size_t sparse_capacity;
+  size_t sparse_count;     // Entries encoded in `sparse`
+  uint32_t *sparse_buffer;
+  size_t sparse_buffer_len;
+  size_t sparse_buffer_capacity;
+  // HLL_PACKED only: register j occupies bits [6j, 6j + 6) of the array,
+  // read and written as little-endian 64-bit loads at byte offset 6j / 8
+  uint64_t *packed;
+  size_t packed_words;
+  // Result of the last HLL_count, valid until a register changes
+  bool count_valid;
+  double cached_count;
+  void *mapping;  // Mapping backing the registers (HLL_mmap, or HLL_new_with on mapped memory)
+  size_t mapping_size;
+  bool shared;    // Registers in a file other processes may write (HLL_new_with with ALLOC_FILE)
 } HLL;
 
+// Serialized format: a fixed header followed by the encoded registers, which
+// start HLL_FILE_HEADER_SIZE bytes in so they stay 64-byte aligned when the
+// file is mapped. The hash function is stored by its HashId.
+#define HLL_FILE_MAGIC "PDSHLLOG"
+#define HLL_FILE_VERSION 1
+#define HLL_FILE_HEADER_SIZE 64
+#define HLL_FILE_CHECKSUM_SEED 0x5eed
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t encoding;
+  uint32_t p;
+  uint32_t hash_id;
+  uint64_t payload_size;
+  uint64_t payload_checksum;  // murmur64 of the payload
+  uint32_t reserved[4];
+  uint64_t header_checksum;   // murmur64 of every preceding header byte
+} HLLFileHeader;
+
 HLL *HLL_new(size_t p, ...);
 HLL *HLL_default(size_t p);
+HLL *HLL_new_sparse(size_t p, ...);
+HLL *HLL_default_sparse(size_t p);
+HLL *HLL_new_packed(size_t p, ...);
+HLL *HLL_default_packed(size_t p);
+HLL *HLL_new_with(size_t p, hash64_func hash_function, HLLMode mode, AllocPolicy policy);
+void HLL_to_dense(HLL *hll);
 void freeHLL(HLL *hll);
+uint8_t HLL_rank(size_t p, uint64_t hash_val, uint64_t *j);
 void HLL_add(HLL *hll, const void *data, size_t size);
+void HLL_add_batch(HLL *hll, const void *const *keys, const size_t *lens, size_t n);
+void HLL_add_concurrent(HLL *hll, const void *data, size_t size);
 double HLL_count(HLL *hll);
+void HLL_histogram(HLL *hll, size_t *histogram);
+double HLL_estimate_from_histogram(const size_t *histogram, size_t m, size_t q);
 void HLL_merge(HLL *dest, const HLL *src);
 HLL *HLL_merge_copy(const HLL *a, const HLL *b);
+void HLL_merge_many(HLL *dest, const HLL *const *srcs, size_t n);
 size_t HLL_memory_usage(const HLL *hll);
+uint8_t *HLL_serialize(HLL *hll, HLLEncoding encoding, size_t *size);
+HLL *HLL_deserialize(const void *data, size_t size);
+bool HLL_save(HLL *hll, const char *path, HLLEncoding encoding);
+HLL *HLL_load(const char *path);
+HLL *HLL_mmap(const char *path);
+
+// Declares name_new, name_add, name_add_batch and name_count for dense HLLs
+// with a fixed precision P and hash function `hashfn`. The hash is a direct
+// call the compiler can inline, and the index and rank shifts use constants.
+// The sketches are ordinary dense HLLs: generic functions accept them, and
+// HLL_add puts a key in the same register as name_add.
+#define PDS_DEFINE_HLL(name, P, hashfn)                                                                  \
+  typedef char name##_precision_check[(P) >= 4 && (P) <= 32 ? 1 : -1];                                   \
+  PDS_SPECIALIZED HLL *name##_new(void) {                                                                 \
+    return HLL_new((P), hashfn);                                                                         \
+  }                                                                                                      \
+  PDS_SPECIALIZED void name##_update(HLL *hll, uint64_t hash_val) {                                       \
+    uint64_t j = hash_val >> (64 - (P));                                                                 \
+    uint64_t w = hash_val << (P);                                                                        \
+    uint8_t rank = (uint8_t)(w ? __builtin_clzll(w) + 1 : 64 - (P) + 1);                                 \
+    if (rank > hll->registers[j]) {                                                                      \
+      hll->registers[j] = rank;                                                                          \
+      hll->count_valid = false;                                                                          \
+    }                                                                                                    \
+  }                                                                                                      \
+  PDS_SPECIALIZED void name##_add(HLL *hll, const void *data, size_t size) {                              \
+    name##_update(hll, hashfn(data, size));                                                              \
+  }                                                                                                      \
+  PDS_SPECIALIZED void name##_add_batch(HLL *hll, const void *const *keys, const size_t *lens, size_t n) { \
+    uint64_t hashes[HLL_BATCH_WINDOW];                                                                   \
+    for (size_t start = 0; start < n; start += HLL_BATCH_WINDOW) {                                        \
+      size_t count = n - start < HLL_BATCH_WINDOW ? n - start : HLL_BATCH_WINDOW;                         \
+      for (size_t i = 0; i < count; i++) {                                                               \
+        hashes[i] = hashfn(keys[start + i], lens[start + i]);                                            \
+        __builtin_prefetch(hll->registers + (hashes[i] >> (64 - (P))), 1);                               \
+      }                                                                                                  \
+      for (size_t i = 0; i < count; i++) {                                                               \
+        name##_update(hll, hashes[i]);                                                                   \
+      }                                                                                                  \
+    }                                                                                                    \
+  }                                                                                                      \
+  PDS_SPECIALIZED double name##_count(HLL *hll) {                                                         \
+    return HLL_count(hll);                                                                               \
+  }
 
 #endif
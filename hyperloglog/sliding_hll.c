@@ -0,0 +1,277 @@
+#include "sliding_hll.h"
+#include <string.h>
+
+// Sliding-window HyperLogLog with "List of Future Possible Maxima" registers
+// (Chabchoub & Hebrail, 2010). Instead of its current maximum, every register
+// keeps the (timestamp, rank) pairs that could still be the maximum of some
+// window ending in the future: a new pair evicts every older pair with a rank
+// that is not larger, so each list is sorted by time with strictly decreasing
+// ranks, and its first pair inside a window is that window's register value.
+// Lists hold about log(items per register) pairs; when one is full its oldest
+// pair is evicted early, which can only lower estimates for the longest windows.
+//
+// All lists share one pool of 32-bit entries. A list that runs out of room
+// moves to the end of the pool with twice the room, and the pool is compacted
+// once more than half of it was left behind, so memory follows the lists'
+// actual lengths rather than max_entries. Entries keep only the low 26 bits of
+// their timestamp, read back as an age below 2^26 relative to `latest`: every
+// SLIDING_HLL_MAX_WINDOW timestamps all lists drop the pairs that left the
+// window, so no pair ever gets old enough to be mistaken for a newer one.
+
+#define SLIDING_HLL_TIMESTAMP_MASK ((UINT32_C(1) << SLIDING_HLL_TIMESTAMP_BITS) - 1)
+#define SLIDING_HLL_ENTRY(timestamp, rank) ((uint32_t)(timestamp) << NUM_BITS_PER_REGISTER | (uint32_t)(rank))
+#define SLIDING_HLL_RANK(entry) ((uint8_t)((entry) & ((1U << NUM_BITS_PER_REGISTER) - 1)))
+
+static inline uint64_t SlidingHLL_timestamp(const SlidingHLL *shll, uint32_t entry) {
+  return shll->latest - (((uint32_t)shll->latest - (entry >> NUM_BITS_PER_REGISTER)) & SLIDING_HLL_TIMESTAMP_MASK);
+}
+
+static SlidingHLL *SlidingHLL_alloc(size_t p, uint64_t window, size_t max_entries, hash64_func hash_function) {
+  const size_t size = 8 * sizeof(uint64_t);
+  if (p < 4 || p > 28) {
+    fprintf(stderr, "Invalid parameter 4 < p=%zu < 28\n", p);
+    exit(EXIT_FAILURE);
+  }
+  if (window == 0 || window > SLIDING_HLL_MAX_WINDOW || max_entries == 0 || max_entries > UINT8_MAX) {
+    fprintf(stderr, "Invalid parameters 0 < window=%llu <= %llu, 0 < max_entries=%zu <= %d\n",
+            (unsigned long long)window, (unsigned long long)SLIDING_HLL_MAX_WINDOW, max_entries, UINT8_MAX);
+    exit(EXIT_FAILURE);
+  }
+
+  SlidingHLL *shll = (SlidingHLL *)malloc(sizeof(*shll));
+  if (NULL == shll) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  shll->p = p;
+  shll->q = size - p;
+  shll->m = (size_t)1 << p;
+  shll->hash_function = hash_function;
+  shll->window = window;
+  shll->max_entries = max_entries;
+  shll->latest = 0;
+  shll->swept = 0;
+  shll->dropped = 0;
+  shll->pool = NULL;
+  shll->pool_size = 0;
+  shll->pool_capacity = 0;
+  shll->abandoned = 0;
+  shll->offsets = (uint32_t *)calloc(shll->m, sizeof(uint32_t));
+  shll->lengths = (uint8_t *)calloc(shll->m, sizeof(uint8_t));
+  shll->capacities = (uint8_t *)calloc(shll->m, sizeof(uint8_t));
+  if (!shll->offsets || !shll->lengths || !shll->capacities) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  return shll;
+}
+
+// Room for `extra` more entries at the end of the pool
+static void SlidingHLL_reserve(SlidingHLL *shll, size_t extra) {
+  size_t needed = shll->pool_size + extra;
+  if (needed <= shll->pool_capacity) {
+    return;
+  }
+  if (needed > UINT32_MAX) {
+    fprintf(stderr, "Error: Sliding HyperLogLog lists need more than 2^32 entries.\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t capacity = shll->pool_capacity * 2;
+  capacity = capacity < needed ? needed : capacity;
+  capacity = capacity < shll->m ? shll->m : capacity;
+  capacity = capacity > UINT32_MAX ? UINT32_MAX : capacity;
+  uint32_t *pool = (uint32_t *)realloc(shll->pool, capacity * sizeof(uint32_t));
+  if (NULL == pool) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  shll->pool = pool;
+  shll->pool_capacity = capacity;
+}
+
+// Drops the pairs that have left the longest window ending at `now` and
+// copies the lists back to back into a new pool, each with exactly the room
+// it uses
+static void SlidingHLL_compact(SlidingHLL *shll, uint64_t now) {
+  size_t used = 0;
+  for (size_t j = 0; j < shll->m; ++j) {
+    const uint32_t *list = shll->pool + shll->offsets[j];
+    size_t expired = 0;
+    while (expired < shll->lengths[j] && SlidingHLL_timestamp(shll, list[expired]) + shll->window <= now) {
+      expired++;
+    }
+    shll->offsets[j] += (uint32_t)expired;
+    shll->lengths[j] -= (uint8_t)expired;
+    used += shll->lengths[j];
+  }
+  size_t capacity = used + used / 2;
+  capacity = capacity < shll->m ? shll->m : capacity;
+  uint32_t *pool = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  if (NULL == pool) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t offset = 0;
+  for (size_t j = 0; j < shll->m; ++j) {
+    if (shll->lengths[j] > 0) {
+      memcpy(pool + offset, shll->pool + shll->offsets[j], shll->lengths[j] * sizeof(uint32_t));
+    }
+    shll->offsets[j] = (uint32_t)offset;
+    shll->capacities[j] = shll->lengths[j];
+    offset += shll->lengths[j];
+  }
+  free(shll->pool);
+  shll->pool = pool;
+  shll->pool_size = used;
+  shll->pool_capacity = capacity;
+  shll->abandoned = 0;
+}
+
+// Gives full list j room for one more entry
+static void SlidingHLL_grow(SlidingHLL *shll, uint64_t j) {
+  if (shll->abandoned > shll->pool_size / 2) {
+    SlidingHLL_compact(shll, shll->latest);
+  }
+  size_t capacity = shll->capacities[j];
+  size_t grown = capacity == 0 ? 1 : capacity * 2;
+  grown = grown > shll->max_entries ? shll->max_entries : grown;
+  if (shll->offsets[j] + capacity == shll->pool_size) {
+    // Last list in the pool, it grows in place
+    SlidingHLL_reserve(shll, grown - capacity);
+    shll->pool_size += grown - capacity;
+  } else {
+    SlidingHLL_reserve(shll, grown);
+    memcpy(shll->pool + shll->pool_size, shll->pool + shll->offsets[j], shll->lengths[j] * sizeof(uint32_t));
+    shll->offsets[j] = (uint32_t)shll->pool_size;
+    shll->pool_size += grown;
+    shll->abandoned += capacity;
+  }
+  shll->capacities[j] = (uint8_t)grown;
+}
+
+// `window` is the longest window SlidingHLL_count can be asked about, in the
+// same units as the timestamps passed to SlidingHLL_add.
+SlidingHLL *SlidingHLL_new(size_t p, uint64_t window, size_t max_entries, ...) {
+  va_list argp;
+  va_start(argp, max_entries);
+  hash64_func hash_function = va_arg(argp, hash64_func);
+  va_end(argp);
+
+  return SlidingHLL_alloc(p, window, max_entries, hash_function);
+}
+
+SlidingHLL *SlidingHLL_default(size_t p, uint64_t window) {
+  return SlidingHLL_new(p, window, SLIDING_HLL_DEFAULT_ENTRIES, murmur64a);
+}
+
+// Timestamps are expected in non-decreasing order; an older one is treated as
+// the newest timestamp seen so far.
+void SlidingHLL_add(SlidingHLL *shll, const void *data, size_t size, uint64_t timestamp) {
+  if (!shll) {
+    fprintf(stderr, "Sliding HyperLogLog not intialized.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!data) {
+    fprintf(stderr, "No data provided.\n");
+    return;
+  }
+  if (timestamp < shll->latest) {
+    timestamp = shll->latest;
+  }
+  if (timestamp - shll->swept >= SLIDING_HLL_MAX_WINDOW) {
+    SlidingHLL_compact(shll, timestamp);
+    shll->swept = timestamp;
+  }
+  shll->latest = timestamp;
+
+  uint64_t j;
+  uint8_t rank = HLL_rank(shll->p, shll->hash_function(data, size), &j);
+  uint32_t *list = shll->pool + shll->offsets[j];
+  size_t length = shll->lengths[j];
+
+  // Newer pairs with a rank at least as large make these unreachable
+  while (length > 0 && SLIDING_HLL_RANK(list[length - 1]) <= rank) {
+    length--;
+  }
+  // Drop pairs that have left the longest window, then make room if needed
+  size_t expired = 0;
+  while (expired < length && SlidingHLL_timestamp(shll, list[expired]) + shll->window <= timestamp) {
+    expired++;
+  }
+  if (expired == 0 && length == shll->max_entries) {
+    expired = 1;
+    shll->dropped++;
+  }
+  if (expired > 0) {
+    memmove(list, list + expired, (length - expired) * sizeof(uint32_t));
+    length -= expired;
+  }
+  shll->lengths[j] = (uint8_t)length;
+  if (length == shll->capacities[j]) {
+    SlidingHLL_grow(shll, j);
+    list = shll->pool + shll->offsets[j];
+    length = shll->lengths[j];
+  }
+  list[length++] = SLIDING_HLL_ENTRY(timestamp, rank);
+  shll->lengths[j] = (uint8_t)length;
+}
+
+// Register values of the window (now - window, now]: the first pair of each
+// list inside the window has the largest rank of the window.
+static void SlidingHLL_registers(const SlidingHLL *shll, uint64_t now, uint64_t window, uint8_t *registers,
+                                 size_t *histogram) {
+  if (window > shll->window) {
+    fprintf(stderr, "Warning: Window %llu is longer than the %llu the sketch keeps.\n", (unsigned long long)window,
+            (unsigned long long)shll->window);
+    window = shll->window;
+  }
+  for (size_t j = 0; j < shll->m; ++j) {
+    const uint32_t *list = shll->pool + shll->offsets[j];
+    uint8_t value = 0;
+    for (size_t i = 0; i < shll->lengths[j]; ++i) {
+      uint64_t timestamp = SlidingHLL_timestamp(shll, list[i]);
+      if (timestamp <= now && timestamp + window > now) {
+        value = SLIDING_HLL_RANK(list[i]);
+        break;
+      }
+    }
+    if (registers) {
+      registers[j] = value;
+    }
+    if (histogram) {
+      histogram[value]++;
+    }
+  }
+}
+
+// Distinct items added with timestamps in (now - window, now], for any
+// window up to the one the sketch was created with. `now` is normally the
+// newest timestamp; windows ending earlier may miss evicted candidates.
+double SlidingHLL_count(const SlidingHLL *shll, uint64_t now, uint64_t window) {
+  if (!shll) {
+    return 0.0;
+  }
+  size_t histogram[HLL_HISTOGRAM_SIZE] = {0};
+  SlidingHLL_registers(shll, now, window, NULL, histogram);
+  return HLL_estimate_from_histogram(histogram, shll->m, shll->q);
+}
+
+// A dense HLL of the window, to merge or serialize like any other sketch
+HLL *SlidingHLL_snapshot(const SlidingHLL *shll, uint64_t now, uint64_t window) {
+  HLL *hll = HLL_new(shll->p, shll->hash_function);
+  SlidingHLL_registers(shll, now, window, hll->registers, NULL);
+  return hll;
+}
+
+size_t SlidingHLL_memory_usage(const SlidingHLL *shll) {
+  return sizeof(*shll) + shll->pool_capacity * sizeof(uint32_t) +
+         shll->m * (sizeof(uint32_t) + 2 * sizeof(uint8_t));
+}
+
+void free_SlidingHLL(SlidingHLL *shll) {
+  free(shll->pool);
+  free(shll->offsets);
+  free(shll->lengths);
+  free(shll->capacities);
+  free(shll);
+}
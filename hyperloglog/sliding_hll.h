@@ -0,0 +1,45 @@
+#ifndef SLIDING_HLL_H
+#define SLIDING_HLL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hll.h"
+
+#define SLIDING_HLL_DEFAULT_ENTRIES 8  // Candidates kept per register by SlidingHLL_default
+// Entries keep the low 26 bits of their timestamp next to the 6-bit rank
+#define SLIDING_HLL_TIMESTAMP_BITS (32 - NUM_BITS_PER_REGISTER)
+#define SLIDING_HLL_MAX_WINDOW (UINT64_C(1) << (SLIDING_HLL_TIMESTAMP_BITS - 1))
+
+typedef struct {
+	size_t p;
+	size_t q;
+	size_t m;
+	hash64_func hash_function;
+	uint64_t window;       // Longest window that can be queried, in timestamp units
+	size_t max_entries;    // Candidates kept per register
+	// Register j owns pool[offsets[j], offsets[j] + lengths[j]), each entry
+	// (timestamp << 6 | rank) truncated to 32 bits, oldest first with strictly
+	// decreasing ranks. Lists get room as they grow, up to max_entries.
+	uint32_t *pool;
+	size_t pool_size;      // Entries handed out to lists, including abandoned ones
+	size_t pool_capacity;
+	size_t abandoned;      // Entries left behind by lists that moved, reclaimed by compaction
+	uint32_t *offsets;
+	uint8_t *lengths;
+	uint8_t *capacities;
+	uint64_t latest;       // Newest timestamp seen
+	uint64_t swept;        // `latest` when expired entries were last dropped from every list
+	size_t dropped;        // Candidates evicted early because a register was full
+} SlidingHLL;
+
+SlidingHLL *SlidingHLL_new(size_t p, uint64_t window, size_t max_entries, ...);
+SlidingHLL *SlidingHLL_default(size_t p, uint64_t window);
+void SlidingHLL_add(SlidingHLL *shll, const void *data, size_t size, uint64_t timestamp);
+double SlidingHLL_count(const SlidingHLL *shll, uint64_t now, uint64_t window);
+HLL *SlidingHLL_snapshot(const SlidingHLL *shll, uint64_t now, uint64_t window);
+size_t SlidingHLL_memory_usage(const SlidingHLL *shll);
+void free_SlidingHLL(SlidingHLL *shll);
+
+#endif
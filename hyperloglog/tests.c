@@ -2,10 +2,14 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <time.h>
+#include <unistd.h>
 #include "../bloom_filter/bloom.h"
 #include "../lib/utilities.h"
+#include "concurrent_hll.h"
 #include "hll.h"
+#include "sliding_hll.h"
 
 void test_time_insertion(int p, char *filename) {
   HLL *hll = HLL_default(p);
@@ -41,32 +45,31 @@ void test_batch_phrases(int p, const char *filename) {
   BloomFilter *filter = BloomFilter_default(size);
   HLL *hll = HLL_default(p);
 
-  long count;
-  char **sentences = load_sentences(filename, &count);
-  if (!sentences) {
+  LineReader *reader = LineReader_open(filename);
+  if (!reader) {
     fprintf(stderr, "Failed to load sentences from file\n");
     exit(EXIT_FAILURE);
   }
-  printf("Loaded %ld sentences\n", count);
 
+  // Lines are hashed straight out of the mapped file
+  long count = 0;
   size_t unique = 0;
-  for (int i = 0; i < count; ++i) {
-    char *s = sentences[i];
-    if (!s) {
-      fprintf(stderr, "NULL sentence at index %d\n", i);
+  const char *s;
+  size_t len;
+  while (LineReader_next(reader, &s, &len)) {
+    if (len == 0) {
       continue;
     }
-
-    size_t len = strlen(s);
+    count++;
     HLL_add(hll, s, len);
 
-    if (!BloomFilter_strExists(filter, s)) {
+    if (!BloomFilter_exists(filter, s, len)) {
       unique++;
     }
-    BloomFilter_putStr(filter, s);
-
-    free(s);  // Only if strdup/malloc used
+    BloomFilter_put(filter, s, len);
   }
+  LineReader_close(reader);
+  printf("Loaded %ld sentences\n", count);
 
   if (!filter) {
     fprintf(stderr, "Error: filter is NULL\n");
@@ -91,7 +94,6 @@ void test_batch_phrases(int p, const char *filename) {
   double num_elements = HLL_count(hll);
   printf("Number of elements ~= %f\n", num_elements);
   freeHLL(hll);
-  free(sentences);
   free_BloomFilter(filter);
 }
 
@@ -175,6 +177,599 @@ void test_hll_duplicates(int p) {
   freeHLL(hll);
 }
 
+void test_hll_sparse(int p) {
+  HLL *sparse = HLL_default_sparse(p);
+  HLL *dense = HLL_default(p);
+  char buffer[64];
+  int mismatches = 0;
+  int i = 0;
+  for (int checkpoint = 10; sparse->mode == HLL_SPARSE; checkpoint *= 10) {
+    for (; i < checkpoint; ++i) {
+      snprintf(buffer, sizeof(buffer), "item_%d", i);
+      HLL_add(sparse, buffer, strlen(buffer));
+      HLL_add(dense, buffer, strlen(buffer));
+    }
+    double sparse_estimate = HLL_count(sparse);
+    double dense_estimate = HLL_count(dense);
+    mismatches += fabs(sparse_estimate - dense_estimate) > 1e-9 * dense_estimate;
+    printf("%d items: %s estimate %.2f (dense %.2f), %zu bytes (dense %zu bytes)\n", i,
+           sparse->mode == HLL_SPARSE ? "sparse" : "converted", sparse_estimate, dense_estimate,
+           HLL_memory_usage(sparse), HLL_memory_usage(dense));
+  }
+  printf("Sparse estimates match dense estimates: ");
+  ASSERT(mismatches == 0, 0, mismatches);
+  int converted = sparse->mode == HLL_DENSE;
+  printf("Sparse HLL switched to dense registers: ");
+  ASSERT(converted, 1, converted);
+
+  // Merging in every combination of modes gives the same registers
+  HLL *small_a = HLL_default_sparse(p);
+  HLL *small_b = HLL_default_sparse(p);
+  for (int k = 0; k < 500; ++k) {
+    snprintf(buffer, sizeof(buffer), "merge_%d", k);
+    HLL_add(k % 2 ? small_a : small_b, buffer, strlen(buffer));
+  }
+  HLL *both_sparse = HLL_merge_copy(small_a, small_b);
+  HLL *into_dense = HLL_merge_copy(dense, small_a);
+  HLL *into_sparse = HLL_default_sparse(p);
+  HLL_merge(into_sparse, small_a);
+  HLL_merge(into_sparse, dense);
+  double expected = HLL_count(into_dense);
+  int same = both_sparse->mode == small_a->mode && fabs(HLL_count(into_sparse) - expected) <= 1e-9 * expected;
+  printf("Sparse + sparse keeps its mode, sparse/dense merges agree: ");
+  ASSERT(same, 1, same);
+  printf("Merged sparse count: ~%.2f\n", HLL_count(both_sparse));
+
+  freeHLL(small_a);
+  freeHLL(small_b);
+  freeHLL(both_sparse);
+  freeHLL(into_dense);
+  freeHLL(into_sparse);
+  freeHLL(sparse);
+  freeHLL(dense);
+}
+
+void test_hll_packed(int p) {
+  HLL *packed = HLL_default_packed(p);
+  HLL *dense = HLL_default(p);
+  char buffer[64];
+  for (int i = 0; i < 100000; ++i) {
+    snprintf(buffer, sizeof(buffer), "item_%d", i);
+    HLL_add(packed, buffer, strlen(buffer));
+    HLL_add(dense, buffer, strlen(buffer));
+  }
+  double packed_estimate = HLL_count(packed);
+  double dense_estimate = HLL_count(dense);
+  printf("Packed estimate %.2f in %zu bytes, dense estimate %.2f in %zu bytes\n", packed_estimate,
+         HLL_memory_usage(packed), dense_estimate, HLL_memory_usage(dense));
+  int same = fabs(packed_estimate - dense_estimate) <= 1e-9 * dense_estimate;
+  printf("Packed estimate matches dense estimate: ");
+  ASSERT(same, 1, same);
+
+  // Unpacking through a merge into an empty dense HLL restores every register
+  HLL *unpacked = HLL_default(p);
+  HLL_merge(unpacked, packed);
+  int identical = memcmp(unpacked->registers, dense->registers, dense->m) == 0;
+  printf("Unpacked registers match dense registers: ");
+  ASSERT(identical, 1, identical);
+
+  // And packing through a merge into an empty packed HLL keeps them too
+  HLL *repacked = HLL_default_packed(p);
+  HLL_merge(repacked, dense);
+  HLL_merge(repacked, packed);
+  HLL *check = HLL_default(p);
+  HLL_merge(check, repacked);
+  identical = memcmp(check->registers, dense->registers, dense->m) == 0;
+  printf("Dense and packed merged into packed round-trip: ");
+  ASSERT(identical, 1, identical);
+
+  freeHLL(check);
+  freeHLL(repacked);
+  freeHLL(unpacked);
+  freeHLL(packed);
+  freeHLL(dense);
+}
+
+void test_hll_histogram_count(int p) {
+  HLL *hll = HLL_default(p);
+  char buffer[64];
+  for (int i = 0; i < 200000; ++i) {
+    snprintf(buffer, sizeof(buffer), "item_%d", i);
+    HLL_add(hll, buffer, strlen(buffer));
+  }
+
+  size_t histogram[HLL_HISTOGRAM_SIZE];
+  size_t expected[HLL_HISTOGRAM_SIZE] = {0};
+  HLL_histogram(hll, histogram);
+  for (size_t i = 0; i < hll->m; ++i) {
+    expected[hll->registers[i]]++;
+  }
+  int mismatches = 0;
+  for (int v = 0; v < HLL_HISTOGRAM_SIZE; ++v) {
+    mismatches += histogram[v] != expected[v];
+  }
+  printf("Vectorized histogram matches register-by-register count: ");
+  ASSERT(mismatches == 0, 0, mismatches);
+
+  double first = HLL_count(hll);
+  int cached = hll->count_valid && HLL_count(hll) == first;
+  printf("Estimate %.2f is cached between adds: ", first);
+  ASSERT(cached, 1, cached);
+
+  // Keep adding until some register changes
+  for (int i = 0; hll->count_valid && i < 1000000; ++i) {
+    snprintf(buffer, sizeof(buffer), "new_item_%d", i);
+    HLL_add(hll, buffer, strlen(buffer));
+  }
+  int invalidated = !hll->count_valid && HLL_count(hll) != first;
+  printf("Adds invalidate the cached estimate: ");
+  ASSERT(invalidated, 1, invalidated);
+  freeHLL(hll);
+}
+
+void test_hll_add_batch(int p) {
+  enum { N = 200000 };
+  static char storage[N][24];
+  static const void *keys[N];
+  static size_t lens[N];
+  for (int i = 0; i < N; ++i) {
+    snprintf(storage[i], sizeof(storage[i]), "batch_%d", i);
+    keys[i] = storage[i];
+    lens[i] = strlen(storage[i]);
+  }
+
+  const char *names[] = {"Dense", "Sparse", "Packed"};
+  for (int mode = 0; mode < 3; ++mode) {
+    HLL *single = mode == 0 ? HLL_default(p) : mode == 1 ? HLL_default_sparse(p) : HLL_default_packed(p);
+    HLL *batch = mode == 0 ? HLL_default(p) : mode == 1 ? HLL_default_sparse(p) : HLL_default_packed(p);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < N; ++i) {
+      HLL_add(single, keys[i], lens[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double single_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    HLL_add_batch(batch, keys, lens, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double batch_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    double a = HLL_count(single);
+    double b = HLL_count(batch);
+    printf("%s: HLL_add %.4f s, HLL_add_batch %.4f s, estimates %.2f / %.2f: ", names[mode], single_sec,
+           batch_sec, a, b);
+    ASSERT(a == b, 1, a == b);
+    freeHLL(single);
+    freeHLL(batch);
+  }
+}
+
+#define CONCURRENT_HLL_KEYS (1 << 20)
+#define CONCURRENT_HLL_MAX_THREADS 64
+
+static char concurrent_storage[CONCURRENT_HLL_KEYS][24];
+static const void *concurrent_keys[CONCURRENT_HLL_KEYS];
+static size_t concurrent_lens[CONCURRENT_HLL_KEYS];
+
+typedef struct {
+  ConcurrentHLL *chll;
+  size_t thread_id;
+  size_t start;
+  size_t end;
+} ConcurrentHLLArgs;
+
+static void *concurrent_hll_worker(void *arg) {
+  ConcurrentHLLArgs *args = (ConcurrentHLLArgs *)arg;
+  for (size_t i = args->start; i < args->end; ++i) {
+    ConcurrentHLL_add(args->chll, args->thread_id, concurrent_keys[i], concurrent_lens[i]);
+  }
+  return NULL;
+}
+
+// Benchmarks both strategies from 1 to 64 writer threads. Register max is
+// order independent, so every run must match a single-threaded HLL exactly.
+void test_hll_concurrent(int p) {
+  for (size_t i = 0; i < CONCURRENT_HLL_KEYS; ++i) {
+    snprintf(concurrent_storage[i], sizeof(concurrent_storage[i]), "concurrent_%zu", i);
+    concurrent_keys[i] = concurrent_storage[i];
+    concurrent_lens[i] = strlen(concurrent_storage[i]);
+  }
+  HLL *reference = HLL_default(p);
+  HLL_add_batch(reference, concurrent_keys, concurrent_lens, CONCURRENT_HLL_KEYS);
+  double expected = HLL_count(reference);
+  freeHLL(reference);
+
+  const ConcurrentHLLStrategy strategies[] = {CONCURRENT_HLL_ATOMIC, CONCURRENT_HLL_SHARDED};
+  const char *names[] = {"Atomic", "Sharded"};
+  int mismatches = 0;
+  for (int s = 0; s < 2; ++s) {
+    for (size_t threads = 1; threads <= CONCURRENT_HLL_MAX_THREADS; threads *= 2) {
+      // Keep the sharded runs under 256 MB of registers at large precisions
+      if (strategies[s] == CONCURRENT_HLL_SHARDED && threads > 1 && (threads << p) > (1UL << 28)) {
+        break;
+      }
+      ConcurrentHLL *chll = ConcurrentHLL_default(p, strategies[s], threads);
+      pthread_t handles[CONCURRENT_HLL_MAX_THREADS];
+      ConcurrentHLLArgs args[CONCURRENT_HLL_MAX_THREADS];
+
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (size_t t = 0; t < threads; ++t) {
+        args[t] = (ConcurrentHLLArgs){chll, t, t * CONCURRENT_HLL_KEYS / threads,
+                                      (t + 1) * CONCURRENT_HLL_KEYS / threads};
+        pthread_create(&handles[t], NULL, concurrent_hll_worker, &args[t]);
+      }
+      for (size_t t = 0; t < threads; ++t) {
+        pthread_join(handles[t], NULL);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double add_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      double estimate = ConcurrentHLL_count(chll);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double count_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+      printf("%s, %2zu threads: %.1f Madds/s, count %.3f ms, %.2f MB, estimate %.2f\n", names[s], threads,
+             CONCURRENT_HLL_KEYS / add_sec / 1e6, count_sec * 1e3, ConcurrentHLL_memory_usage(chll) / 1024.0 / 1024.0,
+             estimate);
+      mismatches += estimate != expected;
+      free_ConcurrentHLL(chll);
+    }
+  }
+  printf("Concurrent estimates match the single-threaded estimate: ");
+  ASSERT(mismatches == 0, 0, mismatches);
+
+  // A shard has exactly one writer: a thread_id without a shard is refused
+  // rather than folded onto another writer's shard
+  ConcurrentHLL *chll = ConcurrentHLL_default(p, CONCURRENT_HLL_SHARDED, 2);
+  ConcurrentHLL_add(chll, 2, concurrent_keys[0], concurrent_lens[0]);
+  ConcurrentHLL_add_batch(chll, 3, concurrent_keys, concurrent_lens, 16);
+  printf("Adds from an unknown thread_id are refused: ");
+  ASSERT(ConcurrentHLL_count(chll) == 0.0, 1, ConcurrentHLL_count(chll) == 0.0);
+  free_ConcurrentHLL(chll);
+}
+
+// Byte registers of any HLL, via a dense round trip through HLL_merge
+static uint8_t *hll_registers(const HLL *hll) {
+  HLL *dense = HLL_new(hll->p, hll->hash_function);
+  HLL_merge(dense, hll);
+  uint8_t *registers = dense->registers;
+  dense->registers = NULL;
+  freeHLL(dense);
+  return registers;
+}
+
+// Recomputes both checksums after a test rewrote a serialized payload
+static void hll_reseal(uint8_t *data) {
+  HLLFileHeader *header = (HLLFileHeader *)data;
+  header->payload_checksum = murmur64(data + HLL_FILE_HEADER_SIZE, header->payload_size, HLL_FILE_CHECKSUM_SEED);
+  header->header_checksum = murmur64(header, offsetof(HLLFileHeader, header_checksum), HLL_FILE_CHECKSUM_SEED);
+}
+
+void test_hll_serialization(int p) {
+  const char *encodings[] = {"dense", "packed", "sparse", "compressed", "auto"};
+  const int sizes[] = {100, 100000};
+  char buffer[64];
+  for (int s = 0; s < 2; ++s) {
+    HLL *hll = HLL_default_sparse(p);
+    for (int i = 0; i < sizes[s]; ++i) {
+      snprintf(buffer, sizeof(buffer), "serialize_%d", i);
+      HLL_add(hll, buffer, strlen(buffer));
+    }
+    uint8_t *expected = hll_registers(hll);
+    for (int e = HLL_ENCODING_DENSE; e <= HLL_ENCODING_AUTO; ++e) {
+      size_t size = 0;
+      uint8_t *data = HLL_serialize(hll, (HLLEncoding)e, &size);
+      HLL *copy = data ? HLL_deserialize(data, size) : NULL;
+      int same = copy != NULL && HLL_count(copy) == HLL_count(hll);
+      if (copy) {
+        uint8_t *registers = hll_registers(copy);
+        same = same && memcmp(registers, expected, hll->m) == 0;
+        free(registers);
+        freeHLL(copy);
+      }
+      printf("%d items, %s encoding: %zu bytes (%zu registers), round trip: ", sizes[s], encodings[e], size,
+             hll->m);
+      ASSERT(same, 1, same);
+      free(data);
+    }
+    free(expected);
+    freeHLL(hll);
+  }
+
+  char path[] = "/tmp/pds_hll_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("Failed to create temporary file");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  HLL *hlls[2] = {HLL_default(p), HLL_default_packed(p)};
+  const HLLEncoding native[2] = {HLL_ENCODING_DENSE, HLL_ENCODING_PACKED};
+  for (int h = 0; h < 2; ++h) {
+    for (int i = 0; i < 50000; ++i) {
+      snprintf(buffer, sizeof(buffer), "mapped_%d", i);
+      HLL_add(hlls[h], buffer, strlen(buffer));
+    }
+    int saved = HLL_save(hlls[h], path, native[h]);
+    printf("%s HLL saved: ", encodings[native[h]]);
+    ASSERT(saved, 1, saved);
+    HLL *opened[2] = {HLL_load(path), HLL_mmap(path)};
+    for (int o = 0; o < 2; ++o) {
+      int same = opened[o] != NULL && opened[o]->mode == hlls[h]->mode && HLL_count(opened[o]) == HLL_count(hlls[h]);
+      printf("%s HLL %s with the same estimate: ", encodings[native[h]], o ? "mapped" : "loaded");
+      ASSERT(same, 1, same);
+      if (opened[o]) {
+        freeHLL(opened[o]);
+      }
+    }
+  }
+  HLL_save(hlls[0], path, HLL_ENCODING_COMPRESSED);
+  HLL *mapped = HLL_mmap(path);
+  printf("Compressed files are not mapped: ");
+  ASSERT(mapped == NULL, 1, mapped == NULL);
+
+  // Flip one payload byte: loading must notice it
+  FILE *file = fopen(path, "r+b");
+  fseek(file, HLL_FILE_HEADER_SIZE + 4, SEEK_SET);
+  int c = fgetc(file);
+  fseek(file, HLL_FILE_HEADER_SIZE + 4, SEEK_SET);
+  fputc(c ^ 0xff, file);
+  fclose(file);
+  HLL *corrupt = HLL_load(path);
+  printf("Corrupt payload rejected on load: ");
+  ASSERT(corrupt == NULL, 1, corrupt == NULL);
+
+  // Payloads with valid checksums but registers past the histogram
+  size_t size;
+  uint8_t *dense = HLL_serialize(hlls[0], HLL_ENCODING_DENSE, &size);
+  dense[HLL_FILE_HEADER_SIZE + 4] = HLL_HISTOGRAM_SIZE + 100;
+  hll_reseal(dense);
+  file = fopen(path, "wb");
+  fwrite(dense, 1, size, file);
+  fclose(file);
+  HLL *opened[3] = {HLL_deserialize(dense, size), HLL_load(path), HLL_mmap(path)};
+  int rejected = opened[0] == NULL && opened[1] == NULL && opened[2] == NULL;
+  printf("Dense register above the histogram rejected: ");
+  ASSERT(rejected, 1, rejected);
+  free(dense);
+
+  uint8_t *compressed = HLL_serialize(hlls[0], HLL_ENCODING_COMPRESSED, &size);
+  // The smallest base whose codes reach HLL_HISTOGRAM_SIZE at the stored width
+  uint8_t width = compressed[HLL_FILE_HEADER_SIZE + 1];
+  compressed[HLL_FILE_HEADER_SIZE] = (uint8_t)(HLL_HISTOGRAM_SIZE + 2 - (1 << width));
+  hll_reseal(compressed);
+  corrupt = HLL_deserialize(compressed, size);
+  printf("Compressed base past the histogram rejected: ");
+  ASSERT(corrupt == NULL, 1, corrupt == NULL);
+  free(compressed);
+  unlink(path);
+  freeHLL(hlls[0]);
+  freeHLL(hlls[1]);
+}
+
+void test_hll_merge_many(int p) {
+  enum { SOURCES = 64, ITEMS = 2000 };
+  HLL *srcs[SOURCES];
+  char buffer[64];
+  for (int k = 0; k < SOURCES; ++k) {
+    // Mostly dense sources, with some packed and sparse ones mixed in
+    srcs[k] = k % 8 == 1 ? HLL_default_packed(p) : k % 8 == 2 ? HLL_default_sparse(p) : HLL_default(p);
+    for (int i = 0; i < ITEMS; ++i) {
+      snprintf(buffer, sizeof(buffer), "bucket_%d_%d", k, i);
+      HLL_add(srcs[k], buffer, strlen(buffer));
+    }
+  }
+
+  HLL *pairwise = HLL_default(p);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int k = 0; k < SOURCES; ++k) {
+    HLL_merge(pairwise, srcs[k]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double pairwise_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  HLL *dests[2] = {HLL_default(p), HLL_default_packed(p)};
+  const char *names[2] = {"Dense", "Packed"};
+  uint8_t *expected = hll_registers(pairwise);
+  for (int d = 0; d < 2; ++d) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    HLL_merge_many(dests[d], (const HLL *const *)srcs, SOURCES);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double many_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    uint8_t *registers = hll_registers(dests[d]);
+    int same = memcmp(registers, expected, pairwise->m) == 0;
+    free(registers);
+    printf("%s destination, %d sources: pairwise %.4f s, HLL_merge_many %.4f s, estimate %.2f: ", names[d],
+           SOURCES, pairwise_sec, many_sec, HLL_count(dests[d]));
+    ASSERT(same, 1, same);
+    freeHLL(dests[d]);
+  }
+  free(expected);
+  freeHLL(pairwise);
+  for (int k = 0; k < SOURCES; ++k) {
+    freeHLL(srcs[k]);
+  }
+}
+
+void test_sliding_hll(int p) {
+  enum { ITEMS = 50000, PER_TICK = 1000, WINDOW = 10 };
+  SlidingHLL *shll = SlidingHLL_default(p, WINDOW);
+  char buffer[64];
+  for (int i = 0; i < ITEMS; ++i) {
+    // Every item is seen twice, in the same tick
+    snprintf(buffer, sizeof(buffer), "event_%d", i / 2);
+    SlidingHLL_add(shll, buffer, strlen(buffer), i / PER_TICK);
+  }
+  const uint64_t now = (ITEMS - 1) / PER_TICK;
+
+  const uint64_t windows[] = {1, 3, WINDOW};
+  for (int w = 0; w < 3; ++w) {
+    // A plain HLL of exactly the items inside the window
+    HLL *expected = HLL_default(p);
+    for (int i = 0; i < ITEMS; ++i) {
+      if ((uint64_t)(i / PER_TICK) + windows[w] > now) {
+        snprintf(buffer, sizeof(buffer), "event_%d", i / 2);
+        HLL_add(expected, buffer, strlen(buffer));
+      }
+    }
+    double estimate = SlidingHLL_count(shll, now, windows[w]);
+    HLL *snapshot = SlidingHLL_snapshot(shll, now, windows[w]);
+    // Exact unless a full register list had to evict a candidate early
+    int same = memcmp(snapshot->registers, expected->registers, expected->m) == 0 || shll->dropped > 0;
+    printf("Window of %llu ticks: %d distinct, estimate %.2f, %zu early evictions\n", (unsigned long long)windows[w],
+           (int)(windows[w] * PER_TICK / 2), estimate, shll->dropped);
+    printf("Window registers match an HLL of the window's items: ");
+    ASSERT(same, 1, same);
+    freeHLL(snapshot);
+    freeHLL(expected);
+  }
+  printf("Sliding HLL memory: %.2f MB\n", SlidingHLL_memory_usage(shll) / 1024.0 / 1024.0);
+
+  // Entries keep 26 timestamp bits: 2^26 ticks later, the old candidates
+  // must read as expired rather than as brand new
+  const uint64_t later = now + (UINT64_C(1) << SLIDING_HLL_TIMESTAMP_BITS);
+  SlidingHLL_add(shll, "late", 4, later);
+  HLL *late = SlidingHLL_snapshot(shll, later, WINDOW);
+  size_t nonzero = 0;
+  for (size_t j = 0; j < late->m; ++j) {
+    nonzero += late->registers[j] != 0;
+  }
+  printf("Only the late item is left in the window: ");
+  ASSERT(nonzero == 1, 1, (int)nonzero);
+  freeHLL(late);
+  free_SlidingHLL(shll);
+}
+
+PDS_DEFINE_HLL(hll14, 14, murmur64a)
+
+void test_hll_specialized(void) {
+  enum { N = 1000000 };
+  HLL *generic = HLL_default(14);
+  HLL *specialized = hll14_new();
+  char buffer[64];
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < N; ++i) {
+    int len = snprintf(buffer, sizeof(buffer), "specialized_%d", i);
+    HLL_add(generic, buffer, (size_t)len);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double generic_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < N; ++i) {
+    int len = snprintf(buffer, sizeof(buffer), "specialized_%d", i);
+    hll14_add(specialized, buffer, (size_t)len);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double specialized_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  int same = memcmp(generic->registers, specialized->registers, generic->m) == 0;
+  printf("HLL_add %.4f s, hll14_add %.4f s, estimate %.2f\n", generic_sec, specialized_sec,
+         hll14_count(specialized));
+  printf("Specialized registers match HLL_add: ");
+  ASSERT(same, 1, same);
+
+  const char *keys[] = {"a", "bb", "ccc", "specialized_7"};
+  const size_t lens[] = {1, 2, 3, 13};
+  HLL *batch = hll14_new();
+  hll14_add_batch(batch, (const void *const *)keys, lens, 4);
+  for (int i = 0; i < 4; ++i) {
+    HLL_add(generic, keys[i], lens[i]);
+  }
+  HLL_merge(specialized, batch);
+  same = memcmp(generic->registers, specialized->registers, generic->m) == 0;
+  printf("Specialized batch matches HLL_add: ");
+  ASSERT(same, 1, same);
+  freeHLL(batch);
+  freeHLL(generic);
+  freeHLL(specialized);
+}
+
+void test_hll_alloc_policy(int p) {
+  char path[] = "/tmp/pds_hll_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("Failed to create temporary file");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  const AllocPolicy policies[3] = {ALLOC_POLICY(ALLOC_ALIGNED), ALLOC_POLICY(ALLOC_HUGE_PAGES), ALLOC_POLICY_FILE(path)};
+  const char *names[3] = {"Aligned", "Huge pages", "File-backed"};
+  const HLLMode modes[2] = {HLL_DENSE, HLL_PACKED};
+  char buffer[64];
+  HLL *reference = HLL_default(p);
+  for (int i = 0; i < 50000; ++i) {
+    snprintf(buffer, sizeof(buffer), "item_%d", i);
+    HLL_add(reference, buffer, strlen(buffer));
+  }
+  double expected = HLL_count(reference);
+  for (int c = 0; c < 3; ++c) {
+    for (int m = 0; m < 2; ++m) {
+      HLL *hll = HLL_new_with(p, murmur64a, modes[m], policies[c]);
+      for (int i = 0; i < 50000; ++i) {
+        snprintf(buffer, sizeof(buffer), "item_%d", i);
+        HLL_add(hll, buffer, strlen(buffer));
+      }
+      double estimate = HLL_count(hll);
+      int same = estimate == expected;
+      printf("%s %s HLL estimate %.2f matches the heap HLL: ", names[c], m ? "packed" : "dense", estimate);
+      ASSERT(same, 1, same);
+      freeHLL(hll);
+      unlink(path);
+    }
+  }
+
+  // Two sketches mapping one file share their registers, and a count taken
+  // before the other writer's adds does not hide them afterwards
+  HLL *a = HLL_new_with(p, murmur64a, HLL_DENSE, ALLOC_POLICY_FILE(path));
+  HLL *b = HLL_new_with(p, murmur64a, HLL_DENSE, ALLOC_POLICY_FILE(path));
+  double before = HLL_count(b);
+  printf("Second mapping counts an empty sketch first: ");
+  ASSERT(before == 0.0, 1, before == 0.0);
+  for (int i = 0; i < 50000; ++i) {
+    snprintf(buffer, sizeof(buffer), "item_%d", i);
+    HLL_add_concurrent(a, buffer, strlen(buffer));
+  }
+  double shared = HLL_count(b);
+  printf("Second mapping sees the other writer's registers: ");
+  ASSERT(shared == expected, 1, shared == expected);
+  freeHLL(a);
+  freeHLL(b);
+
+  // Files of another sketch or format are refused and left as they are
+  HLL *other = HLL_new_with(p, murmur64a, HLL_PACKED, ALLOC_POLICY_FILE(path));
+  printf("Packed sketch refuses the dense sketch's file: ");
+  ASSERT(other == NULL, 1, other == NULL);
+  other = HLL_new_with(p, wyhash64a, HLL_DENSE, ALLOC_POLICY_FILE(path));
+  printf("Sketch with another hash function refuses it too: ");
+  ASSERT(other == NULL, 1, other == NULL);
+  unlink(path);
+  BloomFilter *filter = BloomFilter_new_double_with((size_t)1 << p << 3, 7, murmur64a, ALLOC_POLICY_FILE(path));
+  other = HLL_new_with(p, murmur64a, HLL_DENSE, ALLOC_POLICY_FILE(path));
+  printf("Bloom filter file of the same byte size is refused: ");
+  ASSERT(other == NULL, 1, other == NULL);
+  free_BloomFilter(filter);
+  unlink(path);
+  HLL_save(reference, path, HLL_ENCODING_DENSE);
+  other = HLL_new_with(p, murmur64a, HLL_DENSE, ALLOC_POLICY_FILE(path));
+  HLL *saved = HLL_load(path);
+  int intact = other == NULL && saved != NULL && HLL_count(saved) == expected;
+  printf("Saved HLL file is refused and still loads: ");
+  ASSERT(intact, 1, intact);
+  freeHLL(saved);
+  freeHLL(reference);
+  unlink(path);
+}
+
 int main(int argc, char *argv[]) {
   // Check if we have enough arguments
   if (argc < 4) {
@@ -210,6 +805,19 @@ int main(int argc, char *argv[]) {
   RUN_TEST(test_merge_two, p);
   RUN_TEST(test_hll_accuracy, p);
   RUN_TEST(test_hll_duplicates, p);
+  RUN_TEST(test_hll_sparse, p);
+  RUN_TEST(test_hll_packed, p);
+  RUN_TEST(test_hll_histogram_count, p);
+  RUN_TEST(test_hll_add_batch, p);
+  // Registers that no longer fit in cache, where prefetching pays off
+  RUN_TEST(test_hll_add_batch, 24);
+  // Register arrays the size production counters use, whatever p was passed
+  RUN_TEST(test_hll_concurrent, 16);
+  RUN_TEST(test_hll_serialization, p);
+  RUN_TEST(test_hll_merge_many, p);
+  RUN_TEST(test_hll_alloc_policy, p);
+  RUN_TEST(test_sliding_hll, p);
+  RUN_TEST(test_hll_specialized);
   RUN_TEST(test_batch_phrases, p, filename);
 
   char f[64];
@@ -0,0 +1,163 @@
+#define _DEFAULT_SOURCE  // MAP_ANONYMOUS, MAP_HUGETLB and MADV_HUGEPAGE
+#include "alloc.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define ALLOC_ROUND_UP(size, to) (((size) + (to) - 1) / (to) * (to))
+
+// Over-maps by one huge page and trims both ends, so the array starts on a
+// huge page boundary and the kernel can back it with huge pages from the
+// first byte. Anonymous pages are zero.
+static void *Alloc_huge_pages(size_t size) {
+  size_t padded = size + ALLOC_HUGE_PAGE;
+  uint8_t *raw = (uint8_t *)mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  uint8_t *start = (uint8_t *)ALLOC_ROUND_UP((uintptr_t)raw, ALLOC_HUGE_PAGE);
+  if (start > raw) {
+    munmap(raw, (size_t)(start - raw));
+  }
+  size_t tail = (size_t)(raw + padded - (start + size));
+  if (tail > 0) {
+    munmap(start + size, tail);
+  }
+#if defined(MADV_HUGEPAGE)
+  madvise(start, size, MADV_HUGEPAGE);  // Advisory: THP may be disabled system-wide
+#endif
+  return start;
+}
+
+// The pool is empty unless the administrator reserved pages
+// (vm.nr_hugepages), in which case this mapping fails and the caller falls back
+static void *Alloc_hugetlb(size_t size) {
+#if defined(MAP_HUGETLB)
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  return data == MAP_FAILED ? NULL : data;
+#else
+  (void)size;
+  return NULL;
+#endif
+}
+
+// A new or empty file gets a header and `size` zero bytes. An existing
+// file is only mapped when its header describes the same array, in which
+// case its contents are kept; anything else is refused and left untouched.
+static void *Alloc_file(const char *path, size_t size, AllocPolicy policy) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    perror("Failed to open file");
+    return NULL;
+  }
+  const size_t length = ALLOC_FILE_HEADER_SIZE + size;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror("Failed to stat file");
+    close(fd);
+    return NULL;
+  }
+  bool fresh = st.st_size == 0;
+  if ((!fresh && (size_t)st.st_size != length) || (fresh && ftruncate(fd, (off_t)length) != 0)) {
+    fprintf(stderr, "Error: %s does not hold a %zu-byte array; it was left as it is.\n", path, size);
+    close(fd);
+    return NULL;
+  }
+  void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    perror("Failed to map file");
+    return NULL;
+  }
+  AllocFileHeader *header = (AllocFileHeader *)mapping;
+  if (fresh) {
+    memcpy(header->magic, ALLOC_FILE_MAGIC, sizeof(header->magic));
+    header->version = ALLOC_FILE_VERSION;
+    header->layout = (uint32_t)policy.layout;
+    header->size = size;
+    header->layout_param = policy.layout_param;
+  } else if (memcmp(header->magic, ALLOC_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+             header->version != ALLOC_FILE_VERSION || header->layout != (uint32_t)policy.layout ||
+             header->size != size || header->layout_param != policy.layout_param) {
+    fprintf(stderr, "Error: %s holds a different array; it was left as it is.\n", path);
+    munmap(mapping, length);
+    return NULL;
+  }
+  posix_madvise(mapping, length, POSIX_MADV_RANDOM);  // Probes are random, read-ahead only wastes I/O
+  return mapping;
+}
+
+// Zero-filled `size` bytes placed according to `policy`. Returns false, with
+// a message for file errors, when the memory cannot be obtained.
+bool Alloc_zeroed(Allocation *allocation, size_t size, AllocPolicy policy) {
+  allocation->data = NULL;
+  allocation->mapping = NULL;
+  allocation->mapped = 0;
+  allocation->kind = policy.kind;
+  switch (policy.kind) {
+  case ALLOC_HEAP:
+    allocation->data = calloc(size ? size : 1, 1);
+    break;
+  case ALLOC_ALIGNED: {
+    size_t rounded = ALLOC_ROUND_UP(size ? size : 1, ALLOC_ALIGNMENT);
+    if (posix_memalign(&allocation->data, ALLOC_ALIGNMENT, rounded) != 0) {
+      allocation->data = NULL;
+    } else {
+      memset(allocation->data, 0, rounded);
+    }
+    break;
+  }
+  case ALLOC_HUGETLB:
+    allocation->mapped = ALLOC_ROUND_UP(size ? size : 1, ALLOC_HUGE_PAGE);
+    allocation->data = allocation->mapping = Alloc_hugetlb(allocation->mapped);
+    if (allocation->data) {
+      break;
+    }
+    allocation->kind = ALLOC_HUGE_PAGES;
+    // fall through
+  case ALLOC_HUGE_PAGES:
+    allocation->mapped = ALLOC_ROUND_UP(size ? size : 1, ALLOC_HUGE_PAGE);
+    allocation->data = allocation->mapping = Alloc_huge_pages(allocation->mapped);
+    break;
+  case ALLOC_FILE:
+    if (NULL == policy.path) {
+      fprintf(stderr, "Error: ALLOC_FILE needs a path.\n");
+      return false;
+    }
+    allocation->mapped = ALLOC_FILE_HEADER_SIZE + size;
+    allocation->mapping = Alloc_file(policy.path, size, policy);
+    allocation->data = allocation->mapping ? (uint8_t *)allocation->mapping + ALLOC_FILE_HEADER_SIZE : NULL;
+    break;
+  }
+  if (NULL == allocation->data) {
+    allocation->mapping = NULL;
+    allocation->mapped = 0;
+    return false;
+  }
+  return true;
+}
+
+void Alloc_release(Allocation *allocation) {
+  if (Alloc_is_mapping(allocation)) {
+    munmap(allocation->mapping, allocation->mapped);
+  } else {
+    free(allocation->data);
+  }
+  allocation->data = NULL;
+  allocation->mapping = NULL;
+  allocation->mapped = 0;
+}
+
+// Mapped memory is released with munmap, not free
+bool Alloc_is_mapping(const Allocation *allocation) {
+  return allocation->mapping != NULL;
+}
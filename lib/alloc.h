@@ -0,0 +1,68 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ALLOC_ALIGNMENT 64                 // Cache line, and the widest SIMD load
+#define ALLOC_HUGE_PAGE ((size_t)1 << 21)  // 2 MB, the x86-64 and arm64 huge page size
+
+// Where large zeroed arrays (BitArray words, HLL registers) come from. Random
+// probes of a multi-megabyte array on 4 KB pages miss the TLB on nearly every
+// access; a 2 MB page covers 512 times as much.
+typedef enum {
+	ALLOC_HEAP,        // calloc, no alignment beyond malloc's
+	ALLOC_ALIGNED,     // Heap, ALLOC_ALIGNMENT-byte aligned
+	ALLOC_HUGE_PAGES,  // Anonymous mapping aligned to a huge page, transparent huge pages requested with madvise
+	ALLOC_HUGETLB,     // Explicit huge pages (MAP_HUGETLB) from the reserved pool, ALLOC_HUGE_PAGES when none are free
+	ALLOC_FILE,        // Shared read-write mapping of `path`, behind an AllocFileHeader
+} AllocKind;
+
+// What a file-backed array holds. A file is only mapped again by a structure
+// with the same layout, parameters and size.
+typedef enum {
+	ALLOC_LAYOUT_RAW,         // Plain array, e.g. from createBitArrayWith
+	ALLOC_LAYOUT_BLOOM,       // Bloom filter bits
+	ALLOC_LAYOUT_HLL_DENSE,   // Byte registers
+	ALLOC_LAYOUT_HLL_PACKED,  // 6-bit packed registers
+} AllocLayout;
+
+typedef struct {
+	AllocKind kind;
+	const char *path;  // ALLOC_FILE only
+	// Set by the structure being allocated, recorded in and checked against the file header
+	AllocLayout layout;
+	uint64_t layout_param;
+} AllocPolicy;
+
+#define ALLOC_POLICY(kind) ((AllocPolicy){(kind), NULL, ALLOC_LAYOUT_RAW, 0})
+#define ALLOC_POLICY_FILE(path) ((AllocPolicy){ALLOC_FILE, (path), ALLOC_LAYOUT_RAW, 0})
+
+// File-backed arrays start ALLOC_FILE_HEADER_SIZE bytes into the file, so
+// they stay 64-byte aligned. Files with another header are never truncated.
+#define ALLOC_FILE_MAGIC "PDSARRAY"
+#define ALLOC_FILE_VERSION 1
+#define ALLOC_FILE_HEADER_SIZE 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout;        // AllocLayout
+	uint64_t size;          // Array bytes after the header
+	uint64_t layout_param;  // e.g. k and hash function for a Bloom filter, p for an HLL
+	uint64_t reserved[4];
+} AllocFileHeader;
+
+typedef struct {
+	void *data;
+	void *mapping;     // Start of the mapping, which for files is the header; NULL for heap kinds
+	size_t mapped;     // Length of the mapping
+	AllocKind kind;    // Kind actually used, after any fallback
+} Allocation;
+
+bool Alloc_zeroed(Allocation *allocation, size_t size, AllocPolicy policy);
+void Alloc_release(Allocation *allocation);
+bool Alloc_is_mapping(const Allocation *allocation);
+
+#endif
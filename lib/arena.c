@@ -0,0 +1,62 @@
+#include "arena.h"
+#include <stdio.h>
+
+// Block headers are padded so that the first allocation of a block is aligned
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define ARENA_BLOCK_DATA(block) ((uint8_t *)(block) + ARENA_HEADER_SIZE)
+
+Arena *Arena_create(size_t block_size) {
+  Arena *arena = (Arena *)malloc(sizeof(Arena));
+  if (NULL == arena) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  arena->head = NULL;
+  arena->block_size = block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+  arena->allocated = 0;
+  arena->reserved = sizeof(Arena);
+  return arena;
+}
+
+// Returns `size` bytes aligned to ARENA_ALIGNMENT, or NULL when a new block
+// cannot be allocated. Requests larger than the block size get a block of
+// their own, which is linked behind the current one so it keeps filling.
+void *Arena_alloc(Arena *arena, size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  ArenaBlock *head = arena->head;
+  if (NULL == head || head->size - head->used < size) {
+    size_t capacity = size > arena->block_size ? size : arena->block_size;
+    ArenaBlock *block = (ArenaBlock *)malloc(ARENA_HEADER_SIZE + capacity);
+    if (NULL == block) {
+      return NULL;
+    }
+    block->size = capacity;
+    block->used = 0;
+    arena->reserved += ARENA_HEADER_SIZE + capacity;
+    if (head != NULL && capacity > arena->block_size) {
+      block->next = head->next;
+      head->next = block;
+    } else {
+      block->next = head;
+      arena->head = block;
+    }
+    head = block;
+  }
+  void *data = ARENA_BLOCK_DATA(head) + head->used;
+  head->used += size;
+  arena->allocated += size;
+  return data;
+}
+
+// One free per block, however many allocations were made
+void Arena_free(Arena *arena) {
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
+
+size_t Arena_memory_usage(const Arena *arena) { return arena->reserved; }
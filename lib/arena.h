@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE ((size_t)1 << 20)
+#define ARENA_ALIGNMENT 8  // Every allocation starts on a multiple of this
+
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock {
+	ArenaBlock *next;   // Previously filled block
+	size_t size;        // Usable bytes after the header
+	size_t used;
+};
+
+// Bump allocator: allocations are carved out of large blocks and can only be
+// released all at once by Arena_free
+typedef struct {
+	ArenaBlock *head;   // Block currently being filled
+	size_t block_size;
+	size_t allocated;   // Bytes handed out
+	size_t reserved;    // Bytes obtained from malloc, headers included
+} Arena;
+
+Arena *Arena_create(size_t block_size);
+void *Arena_alloc(Arena *arena, size_t size);
+void Arena_free(Arena *arena);
+size_t Arena_memory_usage(const Arena *arena);
+
+#endif
@@ -1,4 +1,9 @@
+#define _POSIX_C_SOURCE 200112L
+#include <string.h>
 #include "bitarray.h"
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 BitArray *createBitArray(size_t num_bits) {
 	BitArray *bits = (BitArray*)malloc(sizeof(BitArray));
@@ -15,11 +20,59 @@ BitArray *createBitArray(size_t num_bits) {
         exit(EXIT_FAILURE);
     }
     bits->size = num_bits;
+    bits->storage = (Allocation){bits->data, NULL, 0, ALLOC_HEAP};
     return bits;
 }
 
+// Same as createBitArray, but the data starts on an `alignment`-byte boundary
+// (e.g. 64 so that a block never straddles two cache lines).
+BitArray *createAlignedBitArray(size_t num_bits, size_t alignment) {
+	BitArray *bits = (BitArray*)malloc(sizeof(BitArray));
+	if (bits == NULL) {
+		perror("Failed to allocate BitArray struct");
+		return NULL;
+	}
+
+	size_t num_units = (num_bits + BITS_PER_UNIT - 1) / BITS_PER_UNIT;
+	size_t num_bytes = num_units * sizeof(unit_t);
+	num_bytes = (num_bytes + alignment - 1) / alignment * alignment;
+	void *data = NULL;
+	if (posix_memalign(&data, alignment, num_bytes) != 0) {
+		fprintf(stderr, "Failed to allocate aligned BitArray data.\n");
+		free(bits);
+		exit(EXIT_FAILURE);
+	}
+	memset(data, 0, num_bytes);
+	bits->data = (unit_t*)data;
+	bits->size = num_bits;
+	bits->storage = (Allocation){data, NULL, 0, ALLOC_ALIGNED};
+	return bits;
+}
+
+// Data placed by `policy`: aligned, on huge pages or in a shared file
+// mapping (see AllocKind). Returns NULL if the memory cannot be obtained.
+// Whole cache lines are allocated, so the vector kernels never split one.
+BitArray *createBitArrayWith(size_t num_bits, AllocPolicy policy) {
+	BitArray *bits = (BitArray*)malloc(sizeof(BitArray));
+	if (bits == NULL) {
+		perror("Failed to allocate BitArray struct");
+		return NULL;
+	}
+
+	size_t num_units = (num_bits + BITS_PER_UNIT - 1) / BITS_PER_UNIT;
+	size_t num_bytes = (num_units * sizeof(unit_t) + ALLOC_ALIGNMENT - 1) / ALLOC_ALIGNMENT * ALLOC_ALIGNMENT;
+	if (!Alloc_zeroed(&bits->storage, num_bytes, policy)) {
+		fprintf(stderr, "Failed to allocate BitArray data.\n");
+		free(bits);
+		return NULL;
+	}
+	bits->data = (unit_t*)bits->storage.data;
+	bits->size = num_bits;
+	return bits;
+}
+
 void freeBitArray(BitArray *bits) {
-    free(bits->data);
+	Alloc_release(&bits->storage);
     free(bits);
 }
 
@@ -68,3 +121,312 @@ size_t msb_position(unit_t w, size_t max) {
 	if (w == 0) return max + 1;
     return __builtin_clzll(w) + 1; // count leading zeros
 }
+
+#define BIT_UNITS(bits) (((bits)->size + BITS_PER_UNIT - 1) / BITS_PER_UNIT)
+
+typedef enum { BITOP_NONE, BITOP_OR, BITOP_AND, BITOP_XOR, BITOP_ANDNOT } BitOp;
+
+static inline unit_t combine_unit(unit_t a, unit_t b, BitOp op) {
+	switch (op) {
+	case BITOP_OR:
+		return a | b;
+	case BITOP_AND:
+		return a & b;
+	case BITOP_XOR:
+		return a ^ b;
+	case BITOP_ANDNOT:
+		return a & ~b;
+	default:
+		return a;
+	}
+}
+
+#if defined(__AVX512F__)
+static inline __m512i combine512(__m512i a, const unit_t *b, BitOp op) {
+	switch (op) {
+	case BITOP_OR:
+		return _mm512_or_si512(a, _mm512_loadu_si512((const void *)b));
+	case BITOP_AND:
+		return _mm512_and_si512(a, _mm512_loadu_si512((const void *)b));
+	case BITOP_XOR:
+		return _mm512_xor_si512(a, _mm512_loadu_si512((const void *)b));
+	case BITOP_ANDNOT:
+		return _mm512_andnot_si512(_mm512_loadu_si512((const void *)b), a);
+	default:
+		return a;
+	}
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i combine256(__m256i a, const unit_t *b, BitOp op) {
+	switch (op) {
+	case BITOP_OR:
+		return _mm256_or_si256(a, _mm256_loadu_si256((const __m256i *)b));
+	case BITOP_AND:
+		return _mm256_and_si256(a, _mm256_loadu_si256((const __m256i *)b));
+	case BITOP_XOR:
+		return _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)b));
+	case BITOP_ANDNOT:
+		return _mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)b), a);
+	default:
+		return a;
+	}
+}
+
+static inline __m256i load256(const unit_t *a, const unit_t *b, size_t i, BitOp op) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)(a + i));
+	return op == BITOP_NONE ? v : combine256(v, b + i, op);
+}
+#endif
+
+#if defined(__AVX2__) && !defined(__AVX512VPOPCNTDQ__)
+// Per-nibble table lookup (Mula et al.), summed into four 64-bit lanes
+static inline __m256i popcount256(__m256i v) {
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+	                                        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(v, low_mask);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+	__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+	return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+// Carry-save adder: the bitwise sum a + b + c as a high and a low bit
+static inline void csa256(__m256i *high, __m256i *low, __m256i a, __m256i b, __m256i c) {
+	__m256i u = _mm256_xor_si256(a, b);
+	*high = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+	*low = _mm256_xor_si256(u, c);
+}
+
+// Harley-Seal (Mula, Kurz and Lemire): a tree of carry-save adders reduces
+// 16 vectors to one vector of weight-16 bits, so only one popcount256 runs
+// per 16 vectors. Counts the first `blocks` * 64 words.
+static __m256i popcount_harley_seal(const unit_t *a, const unit_t *b, size_t blocks, BitOp op) {
+	__m256i total = _mm256_setzero_si256();
+	__m256i ones = _mm256_setzero_si256(), twos = _mm256_setzero_si256();
+	__m256i fours = _mm256_setzero_si256(), eights = _mm256_setzero_si256();
+	__m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b, sixteens;
+	for (size_t i = 0; i < blocks * 64; i += 64) {
+		csa256(&twos_a, &ones, ones, load256(a, b, i, op), load256(a, b, i + 4, op));
+		csa256(&twos_b, &ones, ones, load256(a, b, i + 8, op), load256(a, b, i + 12, op));
+		csa256(&fours_a, &twos, twos, twos_a, twos_b);
+		csa256(&twos_a, &ones, ones, load256(a, b, i + 16, op), load256(a, b, i + 20, op));
+		csa256(&twos_b, &ones, ones, load256(a, b, i + 24, op), load256(a, b, i + 28, op));
+		csa256(&fours_b, &twos, twos, twos_a, twos_b);
+		csa256(&eights_a, &fours, fours, fours_a, fours_b);
+		csa256(&twos_a, &ones, ones, load256(a, b, i + 32, op), load256(a, b, i + 36, op));
+		csa256(&twos_b, &ones, ones, load256(a, b, i + 40, op), load256(a, b, i + 44, op));
+		csa256(&fours_a, &twos, twos, twos_a, twos_b);
+		csa256(&twos_a, &ones, ones, load256(a, b, i + 48, op), load256(a, b, i + 52, op));
+		csa256(&twos_b, &ones, ones, load256(a, b, i + 56, op), load256(a, b, i + 60, op));
+		csa256(&fours_b, &twos, twos, twos_a, twos_b);
+		csa256(&eights_b, &fours, fours, fours_a, fours_b);
+		csa256(&sixteens, &eights, eights, eights_a, eights_b);
+		total = _mm256_add_epi64(total, popcount256(sixteens));
+	}
+	total = _mm256_slli_epi64(total, 4);
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+	return _mm256_add_epi64(total, popcount256(ones));
+}
+#endif
+
+// Population count of `a` (op == BITOP_NONE) or of `a op b`, without
+// materializing the combined array.
+static size_t popcount_units(const unit_t *a, const unit_t *b, size_t n, BitOp op) {
+	size_t count = 0;
+	size_t i = 0;
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+	__m512i acc = _mm512_setzero_si512();
+	for (; i + 8 <= n; i += 8) {
+		__m512i v = _mm512_loadu_si512((const void *)(a + i));
+		v = op == BITOP_NONE ? v : combine512(v, b + i, op);
+		acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+	}
+	count += (size_t)_mm512_reduce_add_epi64(acc);
+#elif defined(__AVX2__)
+	__m256i acc = popcount_harley_seal(a, b, n / 64, op);
+	i = n / 64 * 64;
+	for (; i + 4 <= n; i += 4) {
+		acc = _mm256_add_epi64(acc, popcount256(load256(a, b, i, op)));
+	}
+	count += (size_t)(_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+	                  _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+#endif
+	for (; i < n; i++) {
+		count += (size_t)__builtin_popcountll(combine_unit(a[i], b ? b[i] : 0, op));
+	}
+	return count;
+}
+
+static void combine_units(unit_t *dest, const unit_t *src, size_t n, BitOp op) {
+	size_t i = 0;
+#if defined(__AVX512F__)
+	for (; i + 8 <= n; i += 8) {
+		__m512i d = combine512(_mm512_loadu_si512((const void *)(dest + i)), src + i, op);
+		_mm512_storeu_si512((void *)(dest + i), d);
+	}
+#elif defined(__AVX2__)
+	for (; i + 4 <= n; i += 4) {
+		_mm256_storeu_si256((__m256i *)(dest + i), load256(dest, src, i, op));
+	}
+#endif
+	for (; i < n; i++) {
+		dest[i] = combine_unit(dest[i], src[i], op);
+	}
+}
+
+static int check_same_size(const BitArray *a, const BitArray *b) {
+	if (a->size != b->size) {
+		fprintf(stderr, "Error: BitArrays have different sizes (%zu != %zu).\n", a->size, b->size);
+		return 0;
+	}
+	return 1;
+}
+
+size_t BitArray_popcount(const BitArray *bits) {
+	return popcount_units(bits->data, NULL, BIT_UNITS(bits), BITOP_NONE);
+}
+
+size_t BitArray_popcount_or(const BitArray *a, const BitArray *b) {
+	return check_same_size(a, b) ? popcount_units(a->data, b->data, BIT_UNITS(a), BITOP_OR) : 0;
+}
+
+size_t BitArray_popcount_and(const BitArray *a, const BitArray *b) {
+	return check_same_size(a, b) ? popcount_units(a->data, b->data, BIT_UNITS(a), BITOP_AND) : 0;
+}
+
+void BitArray_or(BitArray *dest, const BitArray *src) {
+	if (check_same_size(dest, src)) {
+		combine_units(dest->data, src->data, BIT_UNITS(dest), BITOP_OR);
+	}
+}
+
+void BitArray_and(BitArray *dest, const BitArray *src) {
+	if (check_same_size(dest, src)) {
+		combine_units(dest->data, src->data, BIT_UNITS(dest), BITOP_AND);
+	}
+}
+
+void BitArray_xor(BitArray *dest, const BitArray *src) {
+	if (check_same_size(dest, src)) {
+		combine_units(dest->data, src->data, BIT_UNITS(dest), BITOP_XOR);
+	}
+}
+
+// dest &= ~src
+void BitArray_andnot(BitArray *dest, const BitArray *src) {
+	if (check_same_size(dest, src)) {
+		combine_units(dest->data, src->data, BIT_UNITS(dest), BITOP_ANDNOT);
+	}
+}
+
+// Set bits in [start, end): the whole words in between go through the
+// vector kernel, the partial words at either end are masked
+size_t BitArray_popcount_range(const BitArray *bits, size_t start, size_t end) {
+	if (end > bits->size) {
+		end = bits->size;
+	}
+	if (start >= end) {
+		return 0;
+	}
+	size_t first = BIT_INDEX(start), last = BIT_INDEX(end - 1);
+	unit_t head = bits->data[first] & (~(unit_t)0 << BIT_OFFSET(start));
+	unit_t tail_mask = ~(unit_t)0 >> (BITS_PER_UNIT - 1 - BIT_OFFSET(end - 1));
+	if (first == last) {
+		return (size_t)__builtin_popcountll(head & tail_mask);
+	}
+	return (size_t)__builtin_popcountll(head) +
+	       popcount_units(bits->data + first + 1, NULL, last - first - 1, BITOP_NONE) +
+	       (size_t)__builtin_popcountll(bits->data[last] & tail_mask);
+}
+
+// Rank/select directory: the number of set bits before every block of
+// BITARRAY_RANK_BLOCK_BITS (one cache line of words), plus the total at the
+// end. It costs 64 bits per 512 and must be rebuilt after the array changes.
+BitArrayRankIndex *BitArray_build_rank_index(const BitArray *bits) {
+	BitArrayRankIndex *index = (BitArrayRankIndex *)malloc(sizeof(BitArrayRankIndex));
+	size_t num_blocks = (bits->size + BITARRAY_RANK_BLOCK_BITS - 1) / BITARRAY_RANK_BLOCK_BITS;
+	uint64_t *blocks = (uint64_t *)malloc((num_blocks + 1) * sizeof(uint64_t));
+	if (NULL == index || NULL == blocks) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t units = BIT_UNITS(bits);
+	const size_t block_units = BITARRAY_RANK_BLOCK_BITS / BITS_PER_UNIT;
+	uint64_t total = 0;
+	for (size_t b = 0; b < num_blocks; b++) {
+		blocks[b] = total;
+		size_t begin = b * block_units;
+		size_t n = units - begin < block_units ? units - begin : block_units;
+		total += popcount_units(bits->data + begin, NULL, n, BITOP_NONE);
+	}
+	blocks[num_blocks] = total;
+	index->bits = bits;
+	index->blocks = blocks;
+	index->num_blocks = num_blocks;
+	return index;
+}
+
+// Set bits in [0, i): one directory entry plus at most 8 word popcounts
+size_t BitArray_rank(const BitArrayRankIndex *index, size_t i) {
+	if (i >= index->bits->size) {
+		return (size_t)index->blocks[index->num_blocks];
+	}
+	const unit_t *data = index->bits->data;
+	size_t block = i / BITARRAY_RANK_BLOCK_BITS;
+	size_t count = (size_t)index->blocks[block];
+	for (size_t w = block * (BITARRAY_RANK_BLOCK_BITS / BITS_PER_UNIT); w < BIT_INDEX(i); w++) {
+		count += (size_t)__builtin_popcountll(data[w]);
+	}
+	if (BIT_OFFSET(i)) {
+		count += (size_t)__builtin_popcountll(data[BIT_INDEX(i)] << (BITS_PER_UNIT - BIT_OFFSET(i)));
+	}
+	return count;
+}
+
+// Position of the k-th set bit of a word, k counted from 0
+static inline size_t select_in_unit(unit_t w, size_t k) {
+#if defined(__BMI2__)
+	return (size_t)__builtin_ctzll(_pdep_u64((unit_t)1 << k, w));
+#else
+	for (; k > 0; k--) {
+		w &= w - 1;
+	}
+	return (size_t)__builtin_ctzll(w);
+#endif
+}
+
+// Position of the k-th set bit (counted from 0), or the array size when
+// there are no more than k set bits. A binary search over the directory
+// finds the block, then the words of the block are scanned.
+size_t BitArray_select(const BitArrayRankIndex *index, size_t k) {
+	if (k >= index->blocks[index->num_blocks]) {
+		return index->bits->size;
+	}
+	size_t lo = 0, hi = index->num_blocks;  // Last block starting at or before k
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->blocks[mid] <= k) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	k -= (size_t)index->blocks[lo];
+	const unit_t *data = index->bits->data;
+	for (size_t w = lo * (BITARRAY_RANK_BLOCK_BITS / BITS_PER_UNIT);; w++) {
+		size_t ones = (size_t)__builtin_popcountll(data[w]);
+		if (k < ones) {
+			return w * BITS_PER_UNIT + select_in_unit(data[w], k);
+		}
+		k -= ones;
+	}
+}
+
+void free_BitArrayRankIndex(BitArrayRankIndex *index) {
+	free(index->blocks);
+	free(index);
+}
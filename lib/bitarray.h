@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "alloc.h"
 
 typedef uint64_t unit_t;
 
@@ -16,17 +17,49 @@ typedef uint64_t unit_t;
 #define BIT_CLEAR(bits, i) ((bits)[BIT_INDEX(i)] &= ~((unit_t)1 << BIT_OFFSET(i)))
 #define BIT_GET(bits, i) (((bits)[BIT_INDEX(i)] >> BIT_OFFSET(i)) & (unit_t)1)
 #define BIT_FLIP(bits, i) ((bits)[BIT_INDEX(i)] ^= ((unit_t)1 << BIT_OFFSET(i)))
+// Thread-safe variants; BIT_SET_ATOMIC evaluates to the previous value of the bit
+#define BIT_SET_ATOMIC(bits, i) \
+	((__atomic_fetch_or(&(bits)[BIT_INDEX(i)], (unit_t)1 << BIT_OFFSET(i), __ATOMIC_RELAXED) >> BIT_OFFSET(i)) & (unit_t)1)
+#define BIT_GET_ATOMIC(bits, i) ((__atomic_load_n(&(bits)[BIT_INDEX(i)], __ATOMIC_RELAXED) >> BIT_OFFSET(i)) & (unit_t)1)
 
 typedef struct {
 	unit_t *data;
 	size_t size;        // Number of elements
+	Allocation storage; // How `data` was obtained, for freeBitArray
 } BitArray;
 
 BitArray *createBitArray(size_t num_bits);
+BitArray *createAlignedBitArray(size_t num_bits, size_t alignment);
+BitArray *createBitArrayWith(size_t num_bits, AllocPolicy policy);
 void freeBitArray(BitArray *bits);
 void printBits(BitArray *bits, size_t size);
 void unit_to_binary(unit_t input, BitArray *bits);
 void printBinary(unit_t num, size_t len);
 size_t msb_position(unit_t w, size_t max);
 
+// Word-wise kernels (AVX-512/AVX2 when compiled in, scalar otherwise). Binary
+// operations require both arrays to have the same size.
+size_t BitArray_popcount(const BitArray *bits);
+size_t BitArray_popcount_or(const BitArray *a, const BitArray *b);
+size_t BitArray_popcount_and(const BitArray *a, const BitArray *b);
+size_t BitArray_popcount_range(const BitArray *bits, size_t start, size_t end);
+void BitArray_or(BitArray *dest, const BitArray *src);
+void BitArray_and(BitArray *dest, const BitArray *src);
+void BitArray_xor(BitArray *dest, const BitArray *src);
+void BitArray_andnot(BitArray *dest, const BitArray *src);
+
+#define BITARRAY_RANK_BLOCK_BITS 512
+
+// Rank/select over a BitArray that is no longer modified
+typedef struct {
+	const BitArray *bits;
+	uint64_t *blocks;   // Set bits before each block; blocks[num_blocks] is the total
+	size_t num_blocks;
+} BitArrayRankIndex;
+
+BitArrayRankIndex *BitArray_build_rank_index(const BitArray *bits);
+size_t BitArray_rank(const BitArrayRankIndex *index, size_t i);
+size_t BitArray_select(const BitArrayRankIndex *index, size_t k);
+void free_BitArrayRankIndex(BitArrayRankIndex *index);
+
 #endif
@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L
+#include "concurrent_hash_table.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Sharded hash table for many readers and occasional writers. The top bits
+// of a key's hash pick a shard; writers take the shard mutex, readers never
+// lock. Slots only ever go from free to full and a slot's key is published
+// last with release order, so a reader that acquires a key pointer sees the
+// hash, length and value written before it. Keys live in a per-shard arena.
+//
+// A full shard does not rehash in one go: it publishes an array twice the
+// size that points back at the old one, and each later insert copies
+// CONCURRENT_HASH_TABLE_MIGRATE_STEP old slots over. Readers search the new
+// array first and the old one only while it is being migrated. Old arrays
+// stay allocated until the table is freed, since a reader may still be
+// probing one; they add at most the size of the current array.
+
+#define CONCURRENT_HASH_TABLE_MAX_LOAD_NUM 3  // Resize past 3/4 full
+#define CONCURRENT_HASH_TABLE_MAX_LOAD_DEN 4
+
+static ConcurrentHashTableArray *ConcurrentHashTable_array(size_t capacity) {
+  ConcurrentHashTableArray *array = (ConcurrentHashTableArray *)calloc(
+      1, sizeof(ConcurrentHashTableArray) + capacity * sizeof(ConcurrentHashTableSlot));
+  if (NULL == array) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  array->capacity = capacity;
+  return array;
+}
+
+ConcurrentHashTable *ConcurrentHashTable_create(size_t num_shards, void (*free_value)(void *)) {
+  if (num_shards == 0 || (num_shards & (num_shards - 1)) != 0) {
+    fprintf(stderr, "Invalid parameter num_shards=%zu, a power of two\n", num_shards);
+    exit(EXIT_FAILURE);
+  }
+  ConcurrentHashTable *table = (ConcurrentHashTable *)malloc(sizeof(ConcurrentHashTable));
+  void *shards = NULL;
+  if (NULL == table ||
+      posix_memalign(&shards, CONCURRENT_HASH_TABLE_CACHE_LINE, num_shards * sizeof(ConcurrentHashTableShard)) != 0) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  table->shards = (ConcurrentHashTableShard *)shards;
+  table->num_shards = num_shards;
+  table->shard_shift = 64 - (size_t)__builtin_ctzll(num_shards);
+  table->free_value = free_value;
+  for (size_t i = 0; i < num_shards; i++) {
+    pthread_mutex_init(&table->shards[i].lock, NULL);
+    table->shards[i].array = ConcurrentHashTable_array(CONCURRENT_HASH_TABLE_INITIAL_CAPACITY);
+    table->shards[i].keys = Arena_create(CONCURRENT_HASH_TABLE_ARENA_BLOCK);
+  }
+  return table;
+}
+
+static inline ConcurrentHashTableShard *ConcurrentHashTable_shard(const ConcurrentHashTable *table, uint64_t hash) {
+  // A shift by 64 is undefined, so one shard is special-cased
+  return &table->shards[table->num_shards == 1 ? 0 : (size_t)(hash >> table->shard_shift)];
+}
+
+// Lock-free probe of one array
+static ConcurrentHashTableSlot *ConcurrentHashTable_find(ConcurrentHashTableArray *array, const void *key,
+                                                         size_t length, uint64_t hash) {
+  const size_t mask = array->capacity - 1;
+  for (size_t index = (size_t)hash & mask;; index = (index + 1) & mask) {
+    ConcurrentHashTableSlot *slot = &array->slots[index];
+    const char *stored = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (stored == NULL) {
+      return NULL;
+    }
+    if (slot->hash == hash && slot->length == length && memcmp(stored, key, length) == 0) {
+      return slot;
+    }
+  }
+}
+
+// Writes a key that is not in `array` yet into its first free slot
+static void ConcurrentHashTable_publish(ConcurrentHashTableArray *array, const char *key, size_t length,
+                                        uint64_t hash, void *value) {
+  const size_t mask = array->capacity - 1;
+  size_t index = (size_t)hash & mask;
+  while (array->slots[index].key != NULL) {
+    index = (index + 1) & mask;
+  }
+  ConcurrentHashTableSlot *slot = &array->slots[index];
+  slot->length = length;
+  slot->hash = hash;
+  __atomic_store_n(&slot->value, value, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->key, key, __ATOMIC_RELEASE);
+  array->count++;
+}
+
+// Copies up to `steps` slots of the array being migrated. Keys already in
+// the new array were updated there after the resize and are kept as they are.
+static void ConcurrentHashTable_migrate(ConcurrentHashTableArray *array, size_t steps) {
+  ConcurrentHashTableArray *prev = array->prev;
+  size_t end = array->migrated + steps < prev->capacity ? array->migrated + steps : prev->capacity;
+  for (size_t i = array->migrated; i < end; i++) {
+    const ConcurrentHashTableSlot *slot = &prev->slots[i];
+    if (slot->key != NULL && NULL == ConcurrentHashTable_find(array, slot->key, slot->length, slot->hash)) {
+      ConcurrentHashTable_publish(array, slot->key, slot->length, slot->hash, slot->value);
+    }
+  }
+  array->migrated = end;
+  if (end == prev->capacity) {
+    // Readers that see NULL also see every copied slot
+    __atomic_store_n(&array->prev, NULL, __ATOMIC_RELEASE);
+  }
+}
+
+// Publishes a twice larger array, finishing any migration still running
+static ConcurrentHashTableArray *ConcurrentHashTable_grow(ConcurrentHashTableShard *shard) {
+  ConcurrentHashTableArray *array = shard->array;
+  if (array->prev) {
+    ConcurrentHashTable_migrate(array, array->prev->capacity);
+  }
+  ConcurrentHashTableArray *grown = ConcurrentHashTable_array(array->capacity * 2);
+  grown->prev = array;
+  grown->retired = array;
+  __atomic_store_n(&shard->array, grown, __ATOMIC_RELEASE);
+  return grown;
+}
+
+void *ConcurrentHashTable_get(const ConcurrentHashTable *table, const void *key, size_t length) {
+  uint64_t hash = wyhash64a(key, length);
+  ConcurrentHashTableShard *shard = ConcurrentHashTable_shard(table, hash);
+  ConcurrentHashTableArray *array = __atomic_load_n(&shard->array, __ATOMIC_ACQUIRE);
+  // Loaded before searching `array`: if it is NULL the migration was complete
+  ConcurrentHashTableArray *prev = __atomic_load_n(&array->prev, __ATOMIC_ACQUIRE);
+  ConcurrentHashTableSlot *slot = ConcurrentHashTable_find(array, key, length, hash);
+  if (NULL == slot && prev) {
+    slot = ConcurrentHashTable_find(prev, key, length, hash);
+  }
+  return slot ? __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE) : NULL;
+}
+
+void *ConcurrentHashTable_getStr(const ConcurrentHashTable *table, const char *key) {
+  return ConcurrentHashTable_get(table, key, strlen(key));
+}
+
+// Insert or update with the shard lock held
+static const char *ConcurrentHashTable_set_locked(ConcurrentHashTableShard *shard, const void *key, size_t length,
+                                                  uint64_t hash, void *value) {
+  ConcurrentHashTableArray *array = shard->array;
+  if (array->prev) {
+    ConcurrentHashTable_migrate(array, CONCURRENT_HASH_TABLE_MIGRATE_STEP);
+  }
+  ConcurrentHashTableSlot *slot = ConcurrentHashTable_find(array, key, length, hash);
+  if (slot) {
+    __atomic_store_n(&slot->value, value, __ATOMIC_RELEASE);
+    return slot->key;
+  }
+
+  // A key that is only in the array being migrated moves over now, with its
+  // new value, and shadows the old copy
+  const char *stored;
+  slot = array->prev ? ConcurrentHashTable_find(array->prev, key, length, hash) : NULL;
+  if (slot) {
+    stored = slot->key;
+  } else {
+    char *copy = (char *)Arena_alloc(shard->keys, length + 1);
+    if (NULL == copy) {
+      return NULL;
+    }
+    memcpy(copy, key, length);
+    copy[length] = '\0';
+    stored = copy;
+  }
+  if ((array->count + 1) * CONCURRENT_HASH_TABLE_MAX_LOAD_DEN > array->capacity * CONCURRENT_HASH_TABLE_MAX_LOAD_NUM) {
+    array = ConcurrentHashTable_grow(shard);
+  }
+  ConcurrentHashTable_publish(array, stored, length, hash, value);
+  return stored;
+}
+
+// Inserts or updates `key`. Returns the table's copy of the key, or NULL if
+// it could not be allocated.
+const char *ConcurrentHashTable_set(ConcurrentHashTable *table, const void *key, size_t length, void *value) {
+  assert(value != NULL);
+
+  uint64_t hash = wyhash64a(key, length);
+  ConcurrentHashTableShard *shard = ConcurrentHashTable_shard(table, hash);
+  pthread_mutex_lock(&shard->lock);
+  const char *stored = ConcurrentHashTable_set_locked(shard, key, length, hash, value);
+  pthread_mutex_unlock(&shard->lock);
+  return stored;
+}
+
+const char *ConcurrentHashTable_setStr(ConcurrentHashTable *table, const char *key, void *value) {
+  return ConcurrentHashTable_set(table, key, strlen(key), value);
+}
+
+// Keys whose insert has completed; concurrent inserts may or may not be counted
+size_t ConcurrentHashTable_size(const ConcurrentHashTable *table) {
+  size_t total = 0;
+  for (size_t i = 0; i < table->num_shards; i++) {
+    ConcurrentHashTableShard *shard = &table->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    ConcurrentHashTableArray *array = shard->array;
+    total += array->count;
+    if (array->prev) {
+      // Keys not copied yet, minus those already updated in the new array
+      for (size_t j = array->migrated; j < array->prev->capacity; j++) {
+        const ConcurrentHashTableSlot *slot = &array->prev->slots[j];
+        total += slot->key != NULL && NULL == ConcurrentHashTable_find(array, slot->key, slot->length, slot->hash);
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return total;
+}
+
+size_t ConcurrentHashTable_memory_usage(const ConcurrentHashTable *table) {
+  size_t total = sizeof(*table) + table->num_shards * sizeof(ConcurrentHashTableShard);
+  for (size_t i = 0; i < table->num_shards; i++) {
+    ConcurrentHashTableShard *shard = &table->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    for (ConcurrentHashTableArray *array = shard->array; array; array = array->retired) {
+      total += sizeof(ConcurrentHashTableArray) + array->capacity * sizeof(ConcurrentHashTableSlot);
+    }
+    total += Arena_memory_usage(shard->keys);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return total;
+}
+
+// Must not run concurrently with any other call
+void ConcurrentHashTable_free(ConcurrentHashTable *table) {
+  for (size_t i = 0; i < table->num_shards; i++) {
+    ConcurrentHashTableShard *shard = &table->shards[i];
+    ConcurrentHashTableArray *array = shard->array;
+    if (array->prev) {
+      ConcurrentHashTable_migrate(array, array->prev->capacity);
+    }
+    for (size_t j = 0; table->free_value && j < array->capacity; j++) {
+      if (array->slots[j].key != NULL) {
+        table->free_value(array->slots[j].value);
+      }
+    }
+    while (array) {
+      ConcurrentHashTableArray *retired = array->retired;
+      free(array);
+      array = retired;
+    }
+    Arena_free(shard->keys);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(table->shards);
+  free(table);
+}
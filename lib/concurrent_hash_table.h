@@ -0,0 +1,61 @@
+#ifndef CONCURRENT_HASH_TABLE_H
+#define CONCURRENT_HASH_TABLE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+#include "hash.h"
+
+#define CONCURRENT_HASH_TABLE_CACHE_LINE 64
+#define CONCURRENT_HASH_TABLE_INITIAL_CAPACITY 16  // Slots per shard
+#define CONCURRENT_HASH_TABLE_MIGRATE_STEP 64      // Old slots moved by each insert during a resize
+#define CONCURRENT_HASH_TABLE_ARENA_BLOCK ((size_t)1 << 16)  // Key storage grows by this much per shard
+
+typedef struct {
+	const char *key;    // Published last, with release order; NULL = free
+	size_t length;
+	uint64_t hash;
+	void *value;        // Replaced atomically by updates
+} ConcurrentHashTableSlot;
+
+// Open-addressing array of one shard. A resize publishes a twice larger array
+// whose `prev` is the old one until every old slot has been copied over.
+typedef struct ConcurrentHashTableArray ConcurrentHashTableArray;
+struct ConcurrentHashTableArray {
+	size_t capacity;                   // Power of two
+	size_t count;
+	size_t migrated;                   // Slots of `prev` copied so far
+	ConcurrentHashTableArray *prev;    // Array still being migrated, NULL when done
+	ConcurrentHashTableArray *retired; // Older array, kept for readers until the table is freed
+	ConcurrentHashTableSlot slots[];
+};
+
+// Padded to a cache line so that writers on neighbouring shards do not share one
+typedef struct {
+	pthread_mutex_t lock;              // Writers only
+	ConcurrentHashTableArray *array;   // Read with acquire order
+	Arena *keys;
+	char padding[CONCURRENT_HASH_TABLE_CACHE_LINE -
+	             (sizeof(pthread_mutex_t) + sizeof(ConcurrentHashTableArray *) + sizeof(Arena *)) %
+	                 CONCURRENT_HASH_TABLE_CACHE_LINE];
+} ConcurrentHashTableShard;
+
+typedef struct {
+	ConcurrentHashTableShard *shards;
+	size_t num_shards;      // Power of two
+	size_t shard_shift;     // 64 - log2(num_shards): the top hash bits pick the shard
+	void (*free_value)(void *);  // NULL = caller owns values
+} ConcurrentHashTable;
+
+ConcurrentHashTable *ConcurrentHashTable_create(size_t num_shards, void (*free_value)(void *));
+void ConcurrentHashTable_free(ConcurrentHashTable *table);
+void *ConcurrentHashTable_get(const ConcurrentHashTable *table, const void *key, size_t length);
+void *ConcurrentHashTable_getStr(const ConcurrentHashTable *table, const char *key);
+const char *ConcurrentHashTable_set(ConcurrentHashTable *table, const void *key, size_t length, void *value);
+const char *ConcurrentHashTable_setStr(ConcurrentHashTable *table, const char *key, void *value);
+size_t ConcurrentHashTable_size(const ConcurrentHashTable *table);
+size_t ConcurrentHashTable_memory_usage(const ConcurrentHashTable *table);
+
+#endif
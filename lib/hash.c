@@ -1,9 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
 #include "hash.h"
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__AVX2__) || (defined(__AVX512F__) && defined(__AVX512DQ__))
+#include <immintrin.h>
+#endif
 
 uint64_t djb2(const void *buf, size_t length) {
   uint64_t hash = DJB2_INIT;
@@ -52,7 +57,18 @@ uint64_t fnv_64(const void *buf, size_t len, uint64_t hval) {
   return hval;
 }
 
-uint64_t murmur64(const void *key, size_t len, uint64_t seed) {
+static inline uint64_t fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// MurmurHash3 x64 body, tail and length mixing; h1 and h2 are left for the
+// caller to finalize
+static inline void murmur64_state(const void *key, size_t len, uint64_t seed, uint64_t *ph1, uint64_t *ph2) {
   const uint8_t *data = (const uint8_t *)key;
   const int nblocks = len / 16;
 
@@ -138,17 +154,369 @@ uint64_t murmur64(const void *key, size_t len, uint64_t seed) {
   h1 += h2;
   h2 += h1;
 
-  // fmix64
-  h1 ^= h1 >> 33;
-  h1 *= 0xff51afd7ed558ccdULL;
-  h1 ^= h1 >> 33;
-  h1 *= 0xc4ceb9fe1a85ec53ULL;
-  h1 ^= h1 >> 33;
+  *ph1 = h1;
+  *ph2 = h2;
+}
+
+uint64_t murmur64(const void *key, size_t len, uint64_t seed) {
+  uint64_t h1, h2;
+  murmur64_state(key, len, seed, &h1, &h2);
+  return fmix64(h1);
+}
 
-  return h1;
+// Both halves of the state murmur64 computes: h1 is exactly murmur64 and h2
+// is finalized the same way, so one call yields two hashes of the key.
+Hash128 murmur64_128(const void *key, size_t len, uint64_t seed) {
+  uint64_t h1, h2;
+  murmur64_state(key, len, seed, &h1, &h2);
+  Hash128 hash = {fmix64(h1), fmix64(h2)};
+  return hash;
 }
 
-HashTable *HashTable_create(void (*free_value)(void *)) {
+// Hashes several keys at once, one per 64-bit SIMD lane, with the same
+// result as murmur64 for each. Keys of different lengths share the lanes:
+// lanes that have run out of 16-byte blocks keep their state through a mask,
+// and the zero-padded tail words are mixed unconditionally, since mixing a
+// zero word leaves h1 and h2 unchanged just like the scalar switch.
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+#define MURMUR64_LANES 8
+typedef __m512i murmur64_vec;
+typedef __mmask8 murmur64_mask;
+#define MV_LOAD(p) _mm512_loadu_si512((const void *)(p))
+#define MV_STORE(p, v) _mm512_storeu_si512((void *)(p), v)
+#define MV_SET1(x) _mm512_set1_epi64((long long)(x))
+#define MV_ADD(a, b) _mm512_add_epi64(a, b)
+#define MV_XOR(a, b) _mm512_xor_si512(a, b)
+#define MV_MUL(a, b) _mm512_mullo_epi64(a, b)
+#define MV_ROTL(v, r) _mm512_rol_epi64(v, r)
+#define MV_SRLI(v, r) _mm512_srli_epi64(v, r)
+#define MV_LESS(a, b) _mm512_cmplt_epu64_mask(a, b)
+#define MV_SELECT(mask, a, b) _mm512_mask_mov_epi64(b, mask, a)
+#elif defined(__AVX2__)
+#define MURMUR64_LANES 4
+typedef __m256i murmur64_vec;
+typedef __m256i murmur64_mask;
+#define MV_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define MV_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define MV_SET1(x) _mm256_set1_epi64x((long long)(x))
+#define MV_ADD(a, b) _mm256_add_epi64(a, b)
+#define MV_XOR(a, b) _mm256_xor_si256(a, b)
+#define MV_MUL(a, b) mullo_epi64_avx2(a, b)
+#define MV_ROTL(v, r) _mm256_or_si256(_mm256_slli_epi64(v, r), _mm256_srli_epi64(v, 64 - (r)))
+#define MV_SRLI(v, r) _mm256_srli_epi64(v, r)
+#define MV_LESS(a, b) _mm256_cmpgt_epi64(b, a)  // Block counts never reach 2^63
+#define MV_SELECT(mask, a, b) _mm256_blendv_epi8(b, a, mask)
+
+// AVX2 has no 64-bit multiply: lo * lo + ((hi * lo + lo * hi) << 32)
+static inline __m256i mullo_epi64_avx2(__m256i a, __m256i b) {
+  __m256i lo = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                   _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+#endif
+
+#ifdef MURMUR64_LANES
+// The first n <= 8 bytes of p as a little-endian word, zero-extended, without
+// reading past p + n: overlapping loads instead of a byte loop
+static inline uint64_t load_partial_le64(const uint8_t *p, size_t n) {
+  if (n >= 4) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + n - 4, 4);
+    return (uint64_t)lo | (uint64_t)hi << (8 * (n - 4));
+  }
+  if (n > 0) {
+    return (uint64_t)p[0] | (uint64_t)p[n / 2] << (8 * (n / 2)) | (uint64_t)p[n - 1] << (8 * (n - 1));
+  }
+  return 0;
+}
+
+static inline murmur64_vec murmur64_fmix_vec(murmur64_vec h) {
+  h = MV_XOR(h, MV_SRLI(h, 33));
+  h = MV_MUL(h, MV_SET1(0xff51afd7ed558ccdULL));
+  h = MV_XOR(h, MV_SRLI(h, 33));
+  h = MV_MUL(h, MV_SET1(0xc4ceb9fe1a85ec53ULL));
+  return MV_XOR(h, MV_SRLI(h, 33));
+}
+
+// out2, when not NULL, receives the second half as murmur64_128 returns it
+static void murmur64_lanes(const void *const *keys, const size_t *lens, uint64_t seed, uint64_t *out,
+                           uint64_t *out2) {
+  const murmur64_vec c1 = MV_SET1(0x87c37b91114253d5ULL);
+  const murmur64_vec c2 = MV_SET1(0x4cf5ad432745937fULL);
+  uint64_t nblocks[MURMUR64_LANES], length[MURMUR64_LANES];
+  uint64_t w1[MURMUR64_LANES], w2[MURMUR64_LANES];
+  uint64_t max_blocks = 0;
+  for (int l = 0; l < MURMUR64_LANES; l++) {
+    length[l] = lens[l];
+    nblocks[l] = lens[l] / 16;
+    max_blocks = nblocks[l] > max_blocks ? nblocks[l] : max_blocks;
+  }
+  const murmur64_vec blocks = MV_LOAD(nblocks);
+  murmur64_vec h1 = MV_SET1(seed);
+  murmur64_vec h2 = MV_SET1(seed);
+
+  // Body
+  for (uint64_t i = 0; i < max_blocks; i++) {
+    for (int l = 0; l < MURMUR64_LANES; l++) {
+      if (i < nblocks[l]) {
+        memcpy(&w1[l], (const uint8_t *)keys[l] + i * 16, 8);
+        memcpy(&w2[l], (const uint8_t *)keys[l] + i * 16 + 8, 8);
+      } else {
+        w1[l] = w2[l] = 0;
+      }
+    }
+    murmur64_vec k1 = MV_MUL(MV_ROTL(MV_MUL(MV_LOAD(w1), c1), 31), c2);
+    murmur64_vec k2 = MV_MUL(MV_ROTL(MV_MUL(MV_LOAD(w2), c2), 33), c1);
+    murmur64_vec n1 = MV_ADD(MV_ROTL(MV_XOR(h1, k1), 27), h2);
+    n1 = MV_ADD(MV_MUL(n1, MV_SET1(5)), MV_SET1(0x52dce729));
+    murmur64_vec n2 = MV_ADD(MV_ROTL(MV_XOR(h2, k2), 31), n1);
+    n2 = MV_ADD(MV_MUL(n2, MV_SET1(5)), MV_SET1(0x38495ab5));
+    murmur64_mask active = MV_LESS(MV_SET1(i), blocks);
+    h1 = MV_SELECT(active, n1, h1);
+    h2 = MV_SELECT(active, n2, h2);
+  }
+
+  // Tail, read as two little-endian words of the zero-padded remainder
+  for (int l = 0; l < MURMUR64_LANES; l++) {
+    const uint8_t *tail = (const uint8_t *)keys[l] + nblocks[l] * 16;
+    size_t rest = length[l] & 15;
+    w1[l] = load_partial_le64(tail, rest < 8 ? rest : 8);
+    w2[l] = rest > 8 ? load_partial_le64(tail + 8, rest - 8) : 0;
+  }
+  murmur64_vec k1 = MV_MUL(MV_ROTL(MV_MUL(MV_LOAD(w1), c1), 31), c2);
+  murmur64_vec k2 = MV_MUL(MV_ROTL(MV_MUL(MV_LOAD(w2), c2), 33), c1);
+  h1 = MV_XOR(h1, k1);
+  h2 = MV_XOR(h2, k2);
+
+  // Finalization
+  const murmur64_vec len = MV_LOAD(length);
+  h1 = MV_XOR(h1, len);
+  h2 = MV_XOR(h2, len);
+  h1 = MV_ADD(h1, h2);
+  MV_STORE(out, murmur64_fmix_vec(h1));
+  if (out2) {
+    MV_STORE(out2, murmur64_fmix_vec(MV_ADD(h2, h1)));
+  }
+}
+#endif
+
+void murmur64_batch(const void *const *keys, const size_t *lens, size_t n, uint64_t seed, uint64_t *out) {
+  size_t vectorized = 0;
+#ifdef MURMUR64_LANES
+  vectorized = n - n % MURMUR64_LANES;
+  for (size_t i = 0; i < vectorized; i += MURMUR64_LANES) {
+    murmur64_lanes(keys + i, lens + i, seed, out + i, NULL);
+  }
+#endif
+  for (size_t i = vectorized; i < n; i++) {
+    out[i] = murmur64(keys[i], lens[i], seed);
+  }
+}
+
+// h1[i] and h2[i] are the halves of murmur64_128(keys[i], lens[i], seed)
+void murmur64_128_batch(const void *const *keys, const size_t *lens, size_t n, uint64_t seed, uint64_t *h1,
+                        uint64_t *h2) {
+  size_t vectorized = 0;
+#ifdef MURMUR64_LANES
+  vectorized = n - n % MURMUR64_LANES;
+  for (size_t i = 0; i < vectorized; i += MURMUR64_LANES) {
+    murmur64_lanes(keys + i, lens + i, seed, h1 + i, h2 + i);
+  }
+#endif
+  for (size_t i = vectorized; i < n; i++) {
+    Hash128 hash = murmur64_128(keys[i], lens[i], seed);
+    h1[i] = hash.h1;
+    h2[i] = hash.h2;
+  }
+}
+
+uint64_t murmur64a(const void *key, size_t len) {
+  return murmur64(key, len, DEFAULT_MURMUR64_KEY);
+}
+
+uint64_t murmur64b(const void *key, size_t len) {
+  return murmur64(key, len, 1337);
+}
+
+Hash128 murmur128a(const void *key, size_t len) {
+  return murmur64_128(key, len, DEFAULT_MURMUR64_KEY);
+}
+
+// wyhash (final4 construction): every step is a 64x64->128 bit multiply
+// whose halves are folded together. Keys of up to 16 bytes are read with at
+// most four overlapping loads and no loop, which keeps the short keys most
+// callers hash down to a handful of instructions.
+static const uint64_t WYHASH_SECRET[4] = {0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL,
+                                          0x4d5a2da51de1aa47ULL};
+
+static inline void wymum(uint64_t *a, uint64_t *b) {
+  __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+  wymum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t wyr8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+// Shared by wyhash64 and wyhash128: the seed and the two words left after
+// absorbing the key, already multiplied together
+static inline void wyhash_state(const void *key, size_t len, uint64_t seed, uint64_t *pa, uint64_t *pb) {
+  const uint8_t *p = (const uint8_t *)key;
+  const uint64_t *secret = WYHASH_SECRET;
+  uint64_t a, b;
+  seed ^= wymix(seed ^ secret[0], secret[1]);
+  if (__builtin_expect(len <= 16, 1)) {
+    if (len >= 4) {
+      a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+      b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+        see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+        see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wyr8(p + i - 16);
+    b = wyr8(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= seed;
+  wymum(&a, &b);
+  *pa = a;
+  *pb = b;
+}
+
+uint64_t wyhash64(const void *key, size_t len, uint64_t seed) {
+  uint64_t a, b;
+  wyhash_state(key, len, seed, &a, &b);
+  return wymix(a ^ WYHASH_SECRET[0] ^ len, b ^ WYHASH_SECRET[1]);
+}
+
+// h1 is wyhash64; h2 folds the same product with the other two secrets
+Hash128 wyhash128(const void *key, size_t len, uint64_t seed) {
+  uint64_t a, b;
+  wyhash_state(key, len, seed, &a, &b);
+  Hash128 hash = {wymix(a ^ WYHASH_SECRET[0] ^ len, b ^ WYHASH_SECRET[1]),
+                  wymix(a ^ WYHASH_SECRET[2] ^ len, b ^ WYHASH_SECRET[3])};
+  return hash;
+}
+
+uint64_t wyhash64a(const void *key, size_t len) {
+  return wyhash64(key, len, DEFAULT_WYHASH_SEED);
+}
+
+Hash128 wyhash128a(const void *key, size_t len) {
+  return wyhash128(key, len, DEFAULT_WYHASH_SEED);
+}
+
+// out[i] = func(keys[i], lens[i]), through murmur64_batch when func is one
+// of the seeded murmur64 variants
+void hash64_batch(hash64_func func, const void *const *keys, const size_t *lens, size_t n, uint64_t *out) {
+  if (func == murmur64a) {
+    murmur64_batch(keys, lens, n, DEFAULT_MURMUR64_KEY, out);
+  } else if (func == murmur64b) {
+    murmur64_batch(keys, lens, n, 1337, out);
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      out[i] = func(keys[i], lens[i]);
+    }
+  }
+}
+
+// The two halves of func(keys[i], lens[i]), through murmur64_128_batch when
+// func is murmur128a
+void hash128_batch(hash128_func func, const void *const *keys, const size_t *lens, size_t n, uint64_t *h1,
+                   uint64_t *h2) {
+  if (func == murmur128a) {
+    murmur64_128_batch(keys, lens, n, DEFAULT_MURMUR64_KEY, h1, h2);
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      Hash128 hash = func(keys[i], lens[i]);
+      h1[i] = hash.h1;
+      h2[i] = hash.h2;
+    }
+  }
+}
+
+// `wide` is the 128-bit function whose h1 equals `func`, if there is one
+static const struct {
+  HashId id;
+  hash64_func func;
+  hash128_func wide;
+} hash64_registry[] = {
+  {HASH_ID_MURMUR64_42, murmur64a, murmur128a},
+  {HASH_ID_MURMUR64_1337, murmur64b, NULL},
+  {HASH_ID_FNV1A, hash_64, NULL},
+  {HASH_ID_DJB2, djb2, NULL},
+  {HASH_ID_SDBM, sdbm, NULL},
+  {HASH_ID_WYHASH_42, wyhash64a, wyhash128a},
+};
+#define HASH64_REGISTRY_SIZE (sizeof(hash64_registry) / sizeof(hash64_registry[0]))
+
+uint32_t hash64_id(hash64_func func) {
+  for (size_t i = 0; i < HASH64_REGISTRY_SIZE; ++i) {
+    if (hash64_registry[i].func == func) {
+      return hash64_registry[i].id;
+    }
+  }
+  return HASH_ID_UNKNOWN;
+}
+
+hash64_func hash64_from_id(uint32_t id) {
+  for (size_t i = 0; i < HASH64_REGISTRY_SIZE; ++i) {
+    if (hash64_registry[i].id == id) {
+      return hash64_registry[i].func;
+    }
+  }
+  return NULL;
+}
+
+// Lets structures built on a hash64_func get both halves from one call
+hash128_func hash128_from_hash64(hash64_func func) {
+  for (size_t i = 0; i < HASH64_REGISTRY_SIZE; ++i) {
+    if (hash64_registry[i].func == func) {
+      return hash64_registry[i].wide;
+    }
+  }
+  return NULL;
+}
+
+// Flags select the key storage and probing scheme; 0 is the original table:
+// strdup'd keys, linear probing and doubling at half load.
+HashTable *HashTable_create_with(void (*free_value)(void *), unsigned flags) {
   HashTable *ht = malloc(sizeof(HashTable));
   if (NULL == ht) {
     fprintf(stderr, "Unable to initialize HashTable: out of memory.\n");
@@ -156,114 +524,274 @@ HashTable *HashTable_create(void (*free_value)(void *)) {
   }
   ht->length = 0;
   ht->capacity = INITIAL_HASH_TABLE_CAPACITY;
+  ht->flags = flags;
   ht->entries = calloc(ht->capacity, sizeof(HashTableEntry));
-  if (NULL == ht->entries) {
+  ht->distances = (flags & HASH_TABLE_ROBIN_HOOD) ? calloc(ht->capacity, sizeof(uint8_t)) : NULL;
+  if (NULL == ht->entries || ((flags & HASH_TABLE_ROBIN_HOOD) && NULL == ht->distances)) {
     fprintf(stderr, "Unable to initialize HashTableEntries: out of memory.\n");
+    free(ht->entries);
     free(ht);
     exit(EXIT_FAILURE);
   }
   ht->free_value = free_value;
+  // Keys are copied into an arena as HashTableKey records, back to back, and
+  // released together with the table. Lookups compare the cached hash and
+  // length before any key bytes, and resizing reuses the cached hash.
+  ht->arena = (flags & HASH_TABLE_ARENA) ? Arena_create(ARENA_DEFAULT_BLOCK_SIZE) : NULL;
   return ht;
 }
 
+HashTable *HashTable_create(void (*free_value)(void *)) {
+  return HashTable_create_with(free_value, 0);
+}
+
+HashTable *HashTable_create_arena(void (*free_value)(void *)) {
+  return HashTable_create_with(free_value, HASH_TABLE_ARENA);
+}
+
+// Arena record of a key; entries point at `bytes`
+typedef struct {
+  uint64_t hash;
+  size_t length;
+  char bytes[];
+} HashTableKey;
+#define HASH_TABLE_KEY(key) ((const HashTableKey *)((key) - offsetof(HashTableKey, bytes)))
+
 void HashTable_free(HashTable *ht) {
-  for (size_t i = 0; i < ht->capacity; ++i) {
-    if (ht->entries[i].key != NULL) {
-      free((void*)ht->entries[i].key);
-      if (ht->free_value)
-        ht->free_value(ht->entries[i].value);
+  // Arena keys go with the arena, so only values may need a pass
+  if (ht->arena == NULL || ht->free_value) {
+    for (size_t i = 0; i < ht->capacity; ++i) {
+      if (ht->entries[i].key != NULL) {
+        if (ht->arena == NULL)
+          free((void*)ht->entries[i].key);
+        if (ht->free_value)
+          ht->free_value(ht->entries[i].value);
+      }
     }
   }
+  if (ht->arena) {
+    Arena_free(ht->arena);
+  }
   free(ht->entries);
+  free(ht->distances);
   free(ht);
 }
 
-void *HashTable_get(HashTable *ht, const char *key) {
-  uint64_t hash = murmur64(key, strlen(key), DEFAULT_MURMUR64_KEY);
-  size_t index = (size_t)(hash & (uint64_t)(ht->capacity - 1));
-  // Loop until we find an empty entry
+static inline uint64_t HashTable_hash(const char *key, size_t length) {
+  return murmur64(key, length, DEFAULT_MURMUR64_KEY);
+}
+
+// Hash of a stored key, without hashing again when it is cached
+static inline uint64_t HashTable_entry_hash(const HashTable *ht, const char *key) {
+  return ht->arena ? HASH_TABLE_KEY(key)->hash : HashTable_hash(key, strlen(key));
+}
+
+static inline bool HashTable_key_equals(const HashTable *ht, const char *stored, const char *key, size_t length,
+                                        uint64_t hash) {
+  if (ht->arena) {
+    const HashTableKey *record = HASH_TABLE_KEY(stored);
+    return record->hash == hash && record->length == length && memcmp(record->bytes, key, length) == 0;
+  }
+  return strcmp(key, stored) == 0;
+}
+
+// Index of `key`, or SIZE_MAX when it is absent. Robin Hood tables keep
+// every entry at least as far from its home slot as the entries before it,
+// so a miss stops at the first entry closer to home than the probe.
+static size_t HashTable_find(const HashTable *ht, const char *key, size_t length, uint64_t hash) {
+  // AND hash with capacity - 1 to ensure it's within entries array
+  const size_t mask = ht->capacity - 1;
+  size_t index = (size_t)(hash & (uint64_t)mask);
+  if (ht->distances) {
+    for (size_t distance = 0; ht->entries[index].key != NULL && ht->distances[index] >= distance; distance++) {
+      if (HashTable_key_equals(ht, ht->entries[index].key, key, length, hash)) {
+        return index;
+      }
+      index = (index + 1) & mask;
+    }
+    return SIZE_MAX;
+  }
+  // Loop until we find an empty entry (linear probing)
   while (ht->entries[index].key != NULL) {
-    if (strcmp(key, ht->entries[index].key) == 0) {
-      // Found key, return value
-      return ht->entries[index].value;
+    if (HashTable_key_equals(ht, ht->entries[index].key, key, length, hash)) {
+      return index;
     }
-    // Key not in slot, move to next (linear probing)
-    index++;
-    // At end of entries array, wrap around
-    if (index >= ht->capacity)
-      index = 0;
+    index = (index + 1) & mask;
   }
-  return NULL;
+  return SIZE_MAX;
 }
 
-// Internal function to set an entry without expanding the table
-static const char *HashTable_set_entry(HashTableEntry *entries, size_t capacity,
-                                       const char *key, void *value,
-                                       size_t *plength) {
-  // AND hash with capacity - 1 to ensure it's within entries array
-  uint64_t hash = murmur64(key, strlen(key), DEFAULT_MURMUR64_KEY);
-  size_t index = (size_t)(hash & (uint64_t)(capacity - 1));
-
-  // Loop till we find an empty slot
-  while (entries[index].key != NULL) {
-    if (strcmp(key, entries[index].key) == 0) {
-      // Found key (already exists), update value
-      entries[index].value = value;
-      return entries[index].key;
+void *HashTable_get(HashTable *ht, const char *key) {
+  size_t length = strlen(key);
+  size_t index = HashTable_find(ht, key, length, HashTable_hash(key, length));
+  return index == SIZE_MAX ? NULL : ht->entries[index].value;
+}
+
+// Copies a new key into the arena, or with strdup without one
+static const char *HashTable_copy_key(HashTable *ht, const char *key, size_t length, uint64_t hash) {
+  if (ht->arena == NULL) {
+    return strdup(key);
+  }
+  HashTableKey *record = (HashTableKey *)Arena_alloc(ht->arena, sizeof(HashTableKey) + length + 1);
+  if (record == NULL) {
+    return NULL;
+  }
+  record->hash = hash;
+  record->length = length;
+  memcpy(record->bytes, key, length + 1);
+  return record->bytes;
+}
+
+// Stores an entry whose key is not in the table. Linear probing takes the
+// first empty slot. Robin Hood probing takes the slot of the first entry
+// closer to its home than the one being placed, and carries that entry on.
+// Returns false, with the entry still to be placed in `entry`, when a probe
+// distance no longer fits in a byte.
+static bool HashTable_place(HashTable *ht, HashTableEntry *entry, uint64_t hash) {
+  const size_t mask = ht->capacity - 1;
+  size_t index = (size_t)(hash & (uint64_t)mask);
+  if (ht->distances == NULL) {
+    while (ht->entries[index].key != NULL) {
+      index = (index + 1) & mask;
     }
-    // Key not in slot, move to next (linear probing)
-    index++;
-    if (index >= capacity) {
-      index = 0;
+    ht->entries[index] = *entry;
+    return true;
+  }
+  size_t distance = 0;
+  while (ht->entries[index].key != NULL) {
+    if (ht->distances[index] < distance) {
+      HashTableEntry resident = ht->entries[index];
+      size_t resident_distance = ht->distances[index];
+      ht->entries[index] = *entry;
+      ht->distances[index] = (uint8_t)distance;
+      *entry = resident;
+      distance = resident_distance;
+    }
+    index = (index + 1) & mask;
+    if (++distance > UINT8_MAX) {
+      return false;
     }
   }
-  // Not found, allocate + copy if necessary
-  if (plength != NULL) {
-    key = strdup(key);
-    if (key == NULL) {
-      return NULL;
+  ht->entries[index] = *entry;
+  ht->distances[index] = (uint8_t)distance;
+  return true;
+}
+
+static bool HashTable_resize(HashTable *ht, size_t capacity);
+
+static void HashTable_insert(HashTable *ht, HashTableEntry entry, uint64_t hash) {
+  while (!HashTable_place(ht, &entry, hash)) {
+    // Only reachable with a degenerate hash: spread the cluster out
+    if (!HashTable_resize(ht, ht->capacity * 2)) {
+      fprintf(stderr, "Unable to resize HashTable: out of memory.\n");
+      exit(EXIT_FAILURE);
     }
-    (*plength)++;
+    hash = HashTable_entry_hash(ht, entry.key);
   }
-  entries[index].key = (char *)key;
-  entries[index].value = value;
-  return key;
 }
 
-static bool HashTable_expand(HashTable *ht) {
-  // Allocate new entries
-  size_t capacity = ht->capacity * 2;
-  if (capacity < ht->capacity) {
+static bool HashTable_resize(HashTable *ht, size_t capacity) {
+  if (capacity < ht->capacity / 2) {
     return false; // overflow (capacity would be too big)
   }
+  // Allocate new entries
   HashTableEntry *entries = calloc(capacity, sizeof(HashTableEntry));
-  if (entries == NULL) {
+  uint8_t *distances = ht->distances ? calloc(capacity, sizeof(uint8_t)) : NULL;
+  if (entries == NULL || (ht->distances && distances == NULL)) {
+    free(entries);
     return false;
   }
-  // Iterate entries and move all non-empty ones to new table
-  for (size_t i = 0; i < ht->capacity; ++i) {
-    HashTableEntry entry = ht->entries[i];
-    if (entry.key != NULL) {
-      HashTable_set_entry(entries, capacity, entry.key, entry.value, NULL);
-    }
-  }
-  free(ht->entries);
+  HashTableEntry *old_entries = ht->entries;
+  uint8_t *old_distances = ht->distances;
+  size_t old_capacity = ht->capacity;
   ht->entries = entries;
+  ht->distances = distances;
   ht->capacity = capacity;
+  // Iterate entries and move all non-empty ones to new table. Keys are
+  // distinct, so none of them needs to be compared.
+  for (size_t i = 0; i < old_capacity; ++i) {
+    if (old_entries[i].key != NULL) {
+      HashTable_insert(ht, old_entries[i], HashTable_entry_hash(ht, old_entries[i].key));
+    }
+  }
+  free(old_entries);
+  free(old_distances);
   return true;
 }
 
+// Linear probing doubles at half load; Robin Hood probing keeps misses short
+// enough to run to 3/4
+static inline bool HashTable_full(const HashTable *ht) {
+  return ht->distances ? ht->length >= ht->capacity / 4 * 3 : ht->length >= ht->capacity / 2;
+}
+
 const char *HashTable_set(HashTable *ht, const char *key, void *value) {
   assert(value != NULL);
 
-  if (ht->length >= ht->capacity / 2) {
-    if (!HashTable_expand(ht)) {
-      return NULL;
+  size_t length = strlen(key);
+  uint64_t hash = HashTable_hash(key, length);
+  size_t index = HashTable_find(ht, key, length, hash);
+  if (index != SIZE_MAX) {
+    // Found key (already exists), update value
+    ht->entries[index].value = value;
+    return ht->entries[index].key;
+  }
+  if (HashTable_full(ht) && !HashTable_resize(ht, ht->capacity * 2)) {
+    return NULL;
+  }
+  // Not found, allocate + copy
+  HashTableEntry entry = {HashTable_copy_key(ht, key, length, hash), value};
+  if (entry.key == NULL) {
+    return NULL;
+  }
+  HashTable_insert(ht, entry, hash);
+  ht->length++;
+  return entry.key;
+}
+
+// Deletes `key` and frees its copy and value, returning false if it was not
+// there. There are no tombstones: the entries after the hole that are not in
+// their home slot shift back by one. Arena keys keep their space until the
+// table is freed.
+bool HashTable_remove(HashTable *ht, const char *key) {
+  size_t length = strlen(key);
+  size_t index = HashTable_find(ht, key, length, HashTable_hash(key, length));
+  if (index == SIZE_MAX) {
+    return false;
+  }
+  HashTableEntry removed = ht->entries[index];
+  const size_t mask = ht->capacity - 1;
+  if (ht->distances) {
+    for (size_t next = (index + 1) & mask; ht->entries[next].key != NULL && ht->distances[next] > 0;
+         next = (next + 1) & mask) {
+      ht->entries[index] = ht->entries[next];
+      ht->distances[index] = ht->distances[next] - 1;
+      index = next;
     }
+  } else {
+    // An entry moves into the hole unless its home lies after the hole
+    for (size_t next = (index + 1) & mask; ht->entries[next].key != NULL; next = (next + 1) & mask) {
+      size_t home = (size_t)(HashTable_entry_hash(ht, ht->entries[next].key) & (uint64_t)mask);
+      if (((next - home) & mask) >= ((next - index) & mask)) {
+        ht->entries[index] = ht->entries[next];
+        index = next;
+      }
+    }
+  }
+  ht->entries[index].key = NULL;
+  ht->entries[index].value = NULL;
+  ht->length--;
+
+  if (ht->arena == NULL)
+    free((void *)removed.key);
+  if (ht->free_value)
+    ht->free_value(removed.value);
+  // A failed shrink leaves the table as it is
+  if ((ht->flags & HASH_TABLE_SHRINK) && ht->capacity > INITIAL_HASH_TABLE_CAPACITY &&
+      ht->length < ht->capacity / 8) {
+    HashTable_resize(ht, ht->capacity / 2);
   }
-  // Set entry and update length
-  return HashTable_set_entry(ht->entries, ht->capacity, key, value,
-                             &ht->length);
+  return true;
 }
 
 size_t HashTable_size(HashTable *ht) { return ht->length; }
@@ -10,16 +10,61 @@
 #define FNV_PRIME 1099511628211UL
 #define INITIAL_HASH_TABLE_CAPACITY 16
 #define DEFAULT_MURMUR64_KEY 42
+#define DEFAULT_WYHASH_SEED 42
+
+// Storage class of the functions generated by the PDS_DEFINE_* macros; a
+// specialization that only uses some of them must not warn about the rest
+#define PDS_SPECIALIZED static inline __attribute__((unused))
 
 #include <stdlib.h>
 #include <stdint.h>
+#include "arena.h"
 
 typedef uint64_t (*hash64_func)(const void *data, size_t length);
+typedef struct {
+  uint64_t h1;
+  uint64_t h2;
+} Hash128;
+typedef Hash128 (*hash128_func)(const void *data, size_t length);
 uint64_t djb2(const void *buf, size_t length);
 uint64_t sdbm(const void *buf, size_t length);
 uint64_t hash_64(const void *buf, size_t len);
 uint64_t fnv_64(const void *buf, size_t len, uint64_t hval);
 uint64_t murmur64(const void *key, size_t len, uint64_t seed);
+uint64_t murmur64a(const void *key, size_t len);
+uint64_t murmur64b(const void *key, size_t len);
+Hash128 murmur64_128(const void *key, size_t len, uint64_t seed);
+Hash128 murmur128a(const void *key, size_t len);
+uint64_t wyhash64(const void *key, size_t len, uint64_t seed);
+Hash128 wyhash128(const void *key, size_t len, uint64_t seed);
+uint64_t wyhash64a(const void *key, size_t len);
+Hash128 wyhash128a(const void *key, size_t len);
+void murmur64_batch(const void *const *keys, const size_t *lens, size_t n, uint64_t seed, uint64_t *out);
+void murmur64_128_batch(const void *const *keys, const size_t *lens, size_t n, uint64_t seed, uint64_t *h1,
+                        uint64_t *h2);
+void hash64_batch(hash64_func func, const void *const *keys, const size_t *lens, size_t n, uint64_t *out);
+void hash128_batch(hash128_func func, const void *const *keys, const size_t *lens, size_t n, uint64_t *h1,
+                   uint64_t *h2);
+
+// Stable identifiers for the hash64_func implementations above, so that
+// serialized structures can record which hash they were built with.
+typedef enum {
+  HASH_ID_UNKNOWN = 0,
+  HASH_ID_MURMUR64_42 = 1,    // murmur64a
+  HASH_ID_MURMUR64_1337 = 2,  // murmur64b
+  HASH_ID_FNV1A = 3,          // hash_64
+  HASH_ID_DJB2 = 4,
+  HASH_ID_SDBM = 5,
+  HASH_ID_WYHASH_42 = 6,      // wyhash64a
+} HashId;
+uint32_t hash64_id(hash64_func func);
+hash64_func hash64_from_id(uint32_t id);
+hash128_func hash128_from_hash64(hash64_func func);
+
+// HashTable_create_with flags
+#define HASH_TABLE_ARENA 1u        // Keys in an arena, with their hash and length
+#define HASH_TABLE_ROBIN_HOOD 2u   // Robin Hood probing, growing at 3/4 load
+#define HASH_TABLE_SHRINK 4u       // Halve the capacity when HashTable_remove leaves it under 1/8 full
 
 typedef struct HashTable HashTable;
 typedef struct {     // HashTable iterator
@@ -38,11 +83,17 @@ struct HashTable {
   size_t capacity;
   size_t length;
   void (*free_value)(void *);  // NULL = caller owns values
+  Arena *arena;                // NULL = keys are strdup'd one by one
+  unsigned flags;
+  uint8_t *distances;          // HASH_TABLE_ROBIN_HOOD only: slots from each entry's home
 };
 HashTable *HashTable_create(void (*free_value)(void *));
+HashTable *HashTable_create_arena(void (*free_value)(void *));
+HashTable *HashTable_create_with(void (*free_value)(void *), unsigned flags);
 void HashTable_free(HashTable *ht);
 void *HashTable_get(HashTable *ht, const char *key);
 const char *HashTable_set(HashTable *ht, const char *key, void *value);
+bool HashTable_remove(HashTable *ht, const char *key);
 size_t HashTable_size(HashTable *ht);
 HashTableIterator HashTable_iterator(HashTable *ht);
 bool HashTable_next(HashTableIterator *hti);
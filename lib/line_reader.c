@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+#include "line_reader.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Lines are views into a read-only mapping of the file. LineReader_open maps
+// the whole file once, which the page cache handles for any size on 64-bit
+// systems. LineReader_open_window maps `window` bytes at a time and unmaps
+// each window as it moves on, so the address space and the pages it pins stay
+// bounded: a line that crosses the end of a window is remapped from its own
+// page, and a line longer than a window doubles it until the line fits.
+
+// First '\n' in [p, end), or NULL. Compares 32 (AVX2) or 16 (SSE2) bytes at
+// a time; loads never read past `end`, which may be the end of the mapping.
+static inline const char *LineReader_find_newline(const char *p, const char *end) {
+#if defined(__AVX2__)
+  const __m256i newline = _mm256_set1_epi8('\n');
+  for (; p + 32 <= end; p += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; p + 16 <= end; p += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == '\n') {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// Replaces the current mapping by `length` bytes from page-aligned `offset`,
+// clamped to the end of the file
+static bool LineReader_map(LineReader *reader, size_t offset, size_t length) {
+  if (reader->base) {
+    munmap((void *)reader->base, reader->mapped);
+    reader->base = NULL;
+  }
+  if (length > reader->size - offset) {
+    length = reader->size - offset;
+  }
+  void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, reader->fd, (off_t)offset);
+  if (base == MAP_FAILED) {
+    perror("Failed to map file");
+    reader->error = true;
+    return false;
+  }
+  posix_madvise(base, length, POSIX_MADV_SEQUENTIAL);
+  reader->base = (const char *)base;
+  reader->base_offset = offset;
+  reader->mapped = length;
+  return true;
+}
+
+LineReader *LineReader_open_window(const char *path, size_t window) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("Failed to open file");
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror("Failed to stat file");
+    close(fd);
+    return NULL;
+  }
+  LineReader *reader = (LineReader *)malloc(sizeof(LineReader));
+  if (NULL == reader) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  reader->base = NULL;
+  reader->base_offset = 0;
+  reader->mapped = 0;
+  reader->size = (size_t)st.st_size;
+  reader->pos = 0;
+  reader->page_size = (size_t)sysconf(_SC_PAGESIZE);
+  reader->window = window < reader->size ? (window + reader->page_size - 1) / reader->page_size * reader->page_size
+                                         : reader->size;
+  if (reader->window == 0) {
+    reader->window = reader->page_size;
+  }
+  reader->fd = fd;
+  reader->error = false;
+  if (reader->size > 0 && !LineReader_map(reader, 0, reader->window)) {
+    close(fd);
+    free(reader);
+    return NULL;
+  }
+  // A file mapped whole never needs the descriptor again
+  if (reader->mapped == reader->size) {
+    close(fd);
+    reader->fd = -1;
+  }
+  return reader;
+}
+
+LineReader *LineReader_open(const char *path) {
+  return LineReader_open_window(path, SIZE_MAX);
+}
+
+// Next line, remapping the window when the line does not end inside it
+// unless `stay` is set, in which case false is returned instead
+static bool LineReader_scan(LineReader *reader, const char **line, size_t *length, bool stay) {
+  while (reader->pos < reader->size && !reader->error) {
+    const char *start = reader->base + (reader->pos - reader->base_offset);
+    const char *end = reader->base + reader->mapped;
+    const char *newline = LineReader_find_newline(start, end);
+    if (newline || reader->base_offset + reader->mapped == reader->size) {
+      // The last line of a file need not end with a newline
+      *line = start;
+      *length = (size_t)((newline ? newline : end) - start);
+      reader->pos += *length + (newline != NULL);
+      return true;
+    }
+    if (stay) {
+      return false;
+    }
+    size_t offset = reader->pos / reader->page_size * reader->page_size;
+    size_t window = offset == reader->base_offset ? reader->mapped * 2 : reader->window;
+    LineReader_map(reader, offset, window);
+  }
+  return false;
+}
+
+// The view stays valid until the next call, or until the reader is closed
+// when the whole file is mapped
+bool LineReader_next(LineReader *reader, const char **line, size_t *length) {
+  return LineReader_scan(reader, line, length, false);
+}
+
+// Fills up to `max_lines` views, all valid until the next call, for
+// HLL_add_batch or BloomFilter_put_batch. A batch ends early at the end of a
+// window rather than invalidate the lines already in it. Returns the number
+// of lines, 0 at the end of the file.
+size_t LineReader_next_batch(LineReader *reader, const char **lines, size_t *lengths, size_t max_lines) {
+  size_t n = 0;
+  if (max_lines > 0 && LineReader_scan(reader, &lines[0], &lengths[0], false)) {
+    for (n = 1; n < max_lines && LineReader_scan(reader, &lines[n], &lengths[n], true); n++) {
+    }
+  }
+  return n;
+}
+
+void LineReader_close(LineReader *reader) {
+  if (reader->base) {
+    munmap((void *)reader->base, reader->mapped);
+  }
+  if (reader->fd >= 0) {
+    close(reader->fd);
+  }
+  free(reader);
+}
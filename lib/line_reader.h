@@ -0,0 +1,30 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LINE_READER_DEFAULT_WINDOW ((size_t)64 << 20)  // Bytes mapped at a time by LineReader_open_window
+
+// Streams the lines of a file as (pointer, length) views into a read-only
+// mapping: nothing is copied or allocated per line and lines have no length
+// limit. The newline itself is not part of a line.
+typedef struct {
+	const char *base;   // Current mapping, NULL for an empty file
+	size_t base_offset; // File offset of `base`, a multiple of the page size
+	size_t mapped;      // Bytes mapped at `base`
+	size_t size;        // File size
+	size_t pos;         // File offset of the next line
+	size_t window;      // Bytes mapped at a time; the file size when it is mapped whole
+	size_t page_size;
+	int fd;             // Kept open while windows are remapped, -1 otherwise
+	bool error;         // A window could not be mapped; iteration stopped early
+} LineReader;
+
+LineReader *LineReader_open(const char *path);
+LineReader *LineReader_open_window(const char *path, size_t window);
+bool LineReader_next(LineReader *reader, const char **line, size_t *length);
+size_t LineReader_next_batch(LineReader *reader, const char **lines, size_t *lengths, size_t max_lines);
+void LineReader_close(LineReader *reader);
+
+#endif
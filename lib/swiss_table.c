@@ -0,0 +1,239 @@
+#include "swiss_table.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open addressing in the style of SwissTable: a control byte per slot holds
+// either SWISS_TABLE_EMPTY or the low 7 bits of the key's hash, and lookups
+// compare a whole group of 16 control bytes against that tag at once. Only
+// slots whose tag matches are visited, and their full hash and length are
+// checked before the key bytes, so a lookup rarely compares more than one
+// key. The remaining 57 bits pick the first group; later groups follow a
+// triangular sequence, which visits every group of a power-of-two table.
+// A group containing an empty byte ends a miss, so the table can run 7/8 full.
+
+#define SWISS_TABLE_TAG(hash) ((uint8_t)((hash) & 0x7f))
+#define SWISS_TABLE_POSITION(hash) ((size_t)((hash) >> 7))
+
+// Bit i set when control byte i of the group equals `tag` (or is empty)
+#if defined(__SSE2__)
+static inline uint32_t SwissTable_match(const uint8_t *group, uint8_t tag) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+}
+
+// SWISS_TABLE_EMPTY is the only control byte with its high bit set
+static inline uint32_t SwissTable_match_empty(const uint8_t *group) {
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+#else
+static inline uint32_t SwissTable_match(const uint8_t *group, uint8_t tag) {
+  uint32_t mask = 0;
+  for (int i = 0; i < SWISS_TABLE_GROUP; i++) {
+    mask |= (uint32_t)(group[i] == tag) << i;
+  }
+  return mask;
+}
+
+static inline uint32_t SwissTable_match_empty(const uint8_t *group) {
+  return SwissTable_match(group, SWISS_TABLE_EMPTY);
+}
+#endif
+
+static void SwissTable_alloc(SwissTable *table, size_t capacity) {
+  table->ctrl = (uint8_t *)malloc(capacity + SWISS_TABLE_GROUP);
+  table->slots = (SwissTableSlot *)malloc(capacity * sizeof(SwissTableSlot));
+  if (NULL == table->ctrl || NULL == table->slots) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(table->ctrl, SWISS_TABLE_EMPTY, capacity + SWISS_TABLE_GROUP);
+  table->capacity = capacity;
+  table->growth_left = capacity / SWISS_TABLE_MAX_LOAD_DEN * SWISS_TABLE_MAX_LOAD_NUM - table->length;
+}
+
+SwissTable *SwissTable_create(void (*free_value)(void *)) {
+  SwissTable *table = (SwissTable *)malloc(sizeof(SwissTable));
+  if (NULL == table) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  table->length = 0;
+  table->free_value = free_value;
+  table->arena = NULL;
+  SwissTable_alloc(table, SWISS_TABLE_INITIAL_CAPACITY);
+  return table;
+}
+
+// Key copies are packed into an arena and released with the table
+SwissTable *SwissTable_create_arena(void (*free_value)(void *)) {
+  SwissTable *table = SwissTable_create(free_value);
+  table->arena = Arena_create(ARENA_DEFAULT_BLOCK_SIZE);
+  return table;
+}
+
+void SwissTable_free(SwissTable *table) {
+  if (table->arena == NULL || table->free_value) {
+    for (size_t i = 0; i < table->capacity; ++i) {
+      if (table->ctrl[i] != SWISS_TABLE_EMPTY) {
+        if (table->arena == NULL) {
+          free((void *)table->slots[i].key);
+        }
+        if (table->free_value) {
+          table->free_value(table->slots[i].value);
+        }
+      }
+    }
+  }
+  if (table->arena) {
+    Arena_free(table->arena);
+  }
+  free(table->ctrl);
+  free(table->slots);
+  free(table);
+}
+
+// Writes a control byte and its mirror, which lets a group starting near the
+// end of the array be loaded without wrapping
+static inline void SwissTable_set_ctrl(SwissTable *table, size_t index, uint8_t value) {
+  table->ctrl[index] = value;
+  if (index < SWISS_TABLE_GROUP) {
+    table->ctrl[table->capacity + index] = value;
+  }
+}
+
+static SwissTableSlot *SwissTable_find(const SwissTable *table, const void *key, size_t length, uint64_t hash) {
+  const size_t mask = table->capacity - 1;
+  const uint8_t tag = SWISS_TABLE_TAG(hash);
+  size_t position = SWISS_TABLE_POSITION(hash) & mask;
+  for (size_t step = SWISS_TABLE_GROUP;; step += SWISS_TABLE_GROUP) {
+    const uint8_t *group = table->ctrl + position;
+    for (uint32_t match = SwissTable_match(group, tag); match; match &= match - 1) {
+      SwissTableSlot *slot = &table->slots[(position + (size_t)__builtin_ctz(match)) & mask];
+      if (slot->hash == hash && slot->length == length && memcmp(slot->key, key, length) == 0) {
+        return slot;
+      }
+    }
+    if (SwissTable_match_empty(group)) {
+      return NULL;
+    }
+    position = (position + step) & mask;
+  }
+}
+
+// First empty slot on the probe sequence of `hash`; the load limit
+// guarantees there is one
+static size_t SwissTable_find_empty(const SwissTable *table, uint64_t hash) {
+  const size_t mask = table->capacity - 1;
+  size_t position = SWISS_TABLE_POSITION(hash) & mask;
+  for (size_t step = SWISS_TABLE_GROUP;; step += SWISS_TABLE_GROUP) {
+    uint32_t empty = SwissTable_match_empty(table->ctrl + position);
+    if (empty) {
+      return (position + (size_t)__builtin_ctz(empty)) & mask;
+    }
+    position = (position + step) & mask;
+  }
+}
+
+// Doubles the capacity and moves every slot by its cached hash; no key is
+// hashed or compared again
+static void SwissTable_grow(SwissTable *table) {
+  uint8_t *old_ctrl = table->ctrl;
+  SwissTableSlot *old_slots = table->slots;
+  size_t old_capacity = table->capacity;
+  SwissTable_alloc(table, old_capacity * 2);
+  for (size_t i = 0; i < old_capacity; ++i) {
+    if (old_ctrl[i] != SWISS_TABLE_EMPTY) {
+      size_t index = SwissTable_find_empty(table, old_slots[i].hash);
+      SwissTable_set_ctrl(table, index, old_ctrl[i]);
+      table->slots[index] = old_slots[i];
+    }
+  }
+  free(old_ctrl);
+  free(old_slots);
+}
+
+void *SwissTable_get(const SwissTable *table, const void *key, size_t length) {
+  SwissTableSlot *slot = SwissTable_find(table, key, length, wyhash64a(key, length));
+  return slot ? slot->value : NULL;
+}
+
+void *SwissTable_getStr(const SwissTable *table, const char *key) {
+  return SwissTable_get(table, key, strlen(key));
+}
+
+// Inserts or updates `key`, copying it on insert. Returns the table's copy
+// of the key, or NULL if it could not be allocated.
+const char *SwissTable_set(SwissTable *table, const void *key, size_t length, void *value) {
+  assert(value != NULL);
+
+  uint64_t hash = wyhash64a(key, length);
+  SwissTableSlot *slot = SwissTable_find(table, key, length, hash);
+  if (slot) {
+    slot->value = value;
+    return slot->key;
+  }
+  char *copy = (char *)(table->arena ? Arena_alloc(table->arena, length + 1) : malloc(length + 1));
+  if (NULL == copy) {
+    return NULL;
+  }
+  memcpy(copy, key, length);
+  copy[length] = '\0';
+
+  if (table->growth_left == 0) {
+    SwissTable_grow(table);
+  }
+  size_t index = SwissTable_find_empty(table, hash);
+  SwissTable_set_ctrl(table, index, SWISS_TABLE_TAG(hash));
+  table->slots[index].key = copy;
+  table->slots[index].length = length;
+  table->slots[index].hash = hash;
+  table->slots[index].value = value;
+  table->length++;
+  table->growth_left--;
+  return copy;
+}
+
+const char *SwissTable_setStr(SwissTable *table, const char *key, void *value) {
+  return SwissTable_set(table, key, strlen(key), value);
+}
+
+size_t SwissTable_size(const SwissTable *table) { return table->length; }
+
+// Table arrays plus the key copies
+size_t SwissTable_memory_usage(const SwissTable *table) {
+  size_t total = sizeof(*table) + table->capacity + SWISS_TABLE_GROUP + table->capacity * sizeof(SwissTableSlot);
+  if (table->arena) {
+    return total + Arena_memory_usage(table->arena);
+  }
+  for (size_t i = 0; i < table->capacity; ++i) {
+    if (table->ctrl[i] != SWISS_TABLE_EMPTY) {
+      total += table->slots[i].length + 1;
+    }
+  }
+  return total;
+}
+
+SwissTableIterator SwissTable_iterator(SwissTable *table) {
+  SwissTableIterator it;
+  it._table = table;
+  it._index = 0;
+  return it;
+}
+
+bool SwissTable_next(SwissTableIterator *it) {
+  SwissTable *table = it->_table;
+  while (it->_index < table->capacity) {
+    size_t i = it->_index++;
+    if (table->ctrl[i] != SWISS_TABLE_EMPTY) {
+      it->key = table->slots[i].key;
+      it->length = table->slots[i].length;
+      it->value = table->slots[i].value;
+      return true;
+    }
+  }
+  return false;
+}
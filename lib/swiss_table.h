@@ -0,0 +1,54 @@
+#ifndef SWISS_TABLE_H
+#define SWISS_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+#include "hash.h"
+
+#define SWISS_TABLE_GROUP 16             // Control bytes compared per probe step
+#define SWISS_TABLE_INITIAL_CAPACITY 16
+#define SWISS_TABLE_MAX_LOAD_NUM 7       // Grows past 7/8 full
+#define SWISS_TABLE_MAX_LOAD_DEN 8
+#define SWISS_TABLE_EMPTY 0x80           // Control byte of a free slot; full slots hold a 7-bit tag
+
+typedef struct {
+	const char *key;    // NUL-terminated copy owned by the table
+	size_t length;
+	uint64_t hash;      // Full hash, compared before the key and reused when growing
+	void *value;
+} SwissTableSlot;
+
+typedef struct {
+	uint8_t *ctrl;          // capacity + SWISS_TABLE_GROUP bytes, the first group mirrored at the end
+	SwissTableSlot *slots;
+	size_t capacity;        // Power of two, at least SWISS_TABLE_GROUP
+	size_t length;
+	size_t growth_left;     // Inserts before the next resize
+	void (*free_value)(void *);  // NULL = caller owns values
+	Arena *arena;           // NULL = each key copy is malloc'd
+} SwissTable;
+
+typedef struct {     // SwissTable iterator
+	const char *key;
+	size_t length;
+	void *value;
+	// private
+	SwissTable *_table;
+	size_t _index;
+} SwissTableIterator;
+
+SwissTable *SwissTable_create(void (*free_value)(void *));
+SwissTable *SwissTable_create_arena(void (*free_value)(void *));
+void SwissTable_free(SwissTable *table);
+void *SwissTable_get(const SwissTable *table, const void *key, size_t length);
+void *SwissTable_getStr(const SwissTable *table, const char *key);
+const char *SwissTable_set(SwissTable *table, const void *key, size_t length, void *value);
+const char *SwissTable_setStr(SwissTable *table, const char *key, void *value);
+size_t SwissTable_size(const SwissTable *table);
+size_t SwissTable_memory_usage(const SwissTable *table);
+SwissTableIterator SwissTable_iterator(SwissTable *table);
+bool SwissTable_next(SwissTableIterator *it);
+
+#endif
@@ -0,0 +1,942 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "arena.h"
+#include "bitarray.h"
+#include "concurrent_hash_table.h"
+#include "hash.h"
+#include "line_reader.h"
+#include "swiss_table.h"
+#include "utilities.h"
+
+void test_murmur64_batch(void) {
+  enum { N = 1000 };
+  static uint8_t storage[N][80];
+  static const void *keys[N];
+  static size_t lens[N];
+  for (int i = 0; i < N; ++i) {
+    for (int b = 0; b < 80; ++b) {
+      storage[i][b] = (uint8_t)(i * 31 + b * 7);
+    }
+    keys[i] = storage[i];
+    // Every length from 0 to 79, in mixed orders so lanes disagree
+    lens[i] = (size_t)((i * 37) % 80);
+  }
+
+  static uint64_t batch[N];
+  const uint64_t seeds[] = {0, DEFAULT_MURMUR64_KEY, 1337};
+  for (int s = 0; s < 3; ++s) {
+    murmur64_batch(keys, lens, N, seeds[s], batch);
+    int mismatches = 0;
+    for (int i = 0; i < N; ++i) {
+      mismatches += batch[i] != murmur64(keys[i], lens[i], seeds[s]);
+    }
+    printf("Seed %llu, batch hashes identical to murmur64: ", (unsigned long long)seeds[s]);
+    ASSERT(mismatches == 0, 0, mismatches);
+  }
+
+  hash64_func funcs[] = {murmur64a, murmur64b, hash_64};
+  const char *names[] = {"murmur64a", "murmur64b", "hash_64"};
+  for (int f = 0; f < 3; ++f) {
+    hash64_batch(funcs[f], keys, lens, N, batch);
+    int mismatches = 0;
+    for (int i = 0; i < N; ++i) {
+      mismatches += batch[i] != funcs[f](keys[i], lens[i]);
+    }
+    printf("hash64_batch with %s matches single calls: ", names[f]);
+    ASSERT(mismatches == 0, 0, mismatches);
+  }
+
+  static uint64_t second[N];
+  hash128_func funcs128[] = {murmur128a, wyhash128a};
+  const char *names128[] = {"murmur128a", "wyhash128a"};
+  for (int f = 0; f < 2; ++f) {
+    hash128_batch(funcs128[f], keys, lens, N, batch, second);
+    int mismatches = 0;
+    for (int i = 0; i < N; ++i) {
+      Hash128 hash = funcs128[f](keys[i], lens[i]);
+      mismatches += batch[i] != hash.h1 || second[i] != hash.h2;
+    }
+    printf("hash128_batch with %s matches single calls: ", names128[f]);
+    ASSERT(mismatches == 0, 0, mismatches);
+  }
+}
+
+void test_hash128(void) {
+  uint8_t key[80];
+  for (int b = 0; b < 80; ++b) {
+    key[b] = (uint8_t)(b * 13 + 5);
+  }
+  int mismatches = 0, equal_halves = 0;
+  for (size_t len = 0; len < 80; ++len) {
+    Hash128 m = murmur64_128(key, len, DEFAULT_MURMUR64_KEY);
+    Hash128 w = wyhash128a(key, len);
+    mismatches += m.h1 != murmur64a(key, len) || w.h1 != wyhash64a(key, len);
+    equal_halves += m.h1 == m.h2 || w.h1 == w.h2;
+  }
+  printf("128-bit variants agree with their 64-bit hashes: ");
+  ASSERT(mismatches == 0, 0, mismatches);
+  printf("Second halves differ from the first: ");
+  ASSERT(equal_halves == 0, 0, equal_halves);
+
+  int registered = hash64_from_id(hash64_id(wyhash64a)) == wyhash64a &&
+                   hash128_from_hash64(wyhash64a) == wyhash128a && hash128_from_hash64(murmur64a) == murmur128a &&
+                   hash128_from_hash64(hash_64) == NULL;
+  printf("wyhash registered with its 128-bit pair: ");
+  ASSERT(registered, 1, registered);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void test_wyhash(void) {
+  // Test vectors of the reference implementation (wyhash final4, default
+  // secret): message i hashed with seed i
+  static const struct {
+    const char *message;
+    uint64_t hash;
+  } vectors[] = {
+      {"", 0x93228a4de0eec5a2ULL},
+      {"a", 0xc5bac3db178713c4ULL},
+      {"abc", 0xa97f2f7b1d9b3314ULL},
+      {"message digest", 0x786d1f1df3801df4ULL},
+      {"abcdefghijklmnopqrstuvwxyz", 0xdca5a8138ad37c87ULL},
+      {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 0xb9e734f117cfaf70ULL},
+      {"12345678901234567890123456789012345678901234567890123456789012345678901234567890", 0x6cc5eab49a92d617ULL},
+  };
+  int wrong = 0;
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+    wrong += wyhash64(vectors[i].message, strlen(vectors[i].message), i) != vectors[i].hash;
+  }
+  printf("wyhash64 matches the reference test vectors: ");
+  ASSERT(wrong == 0, 0, wrong);
+
+  // Every short-key path: empty, 1-3, 4-16, 17-48 and the 48-byte loop
+  uint8_t key[128] = {0};
+  uint64_t hashes[129];
+  for (size_t len = 0; len <= 128; ++len) {
+    hashes[len] = wyhash64a(key, len);
+  }
+  qsort(hashes, 129, sizeof(uint64_t), compare_u64);
+  int duplicates = 0;
+  for (int i = 1; i < 129; ++i) {
+    duplicates += hashes[i] == hashes[i - 1];
+  }
+  printf("Zero keys of every length hash apart: ");
+  ASSERT(duplicates == 0, 0, duplicates);
+
+  int seeded = wyhash64(key, 8, 1) != wyhash64(key, 8, 2);
+  printf("Seed changes the hash: ");
+  ASSERT(seeded, 1, seeded);
+
+  // Flipping one input bit should flip about half of the output bits
+  enum { TRIALS = 2000 };
+  uint64_t flipped = 0;
+  char buf[32];
+  for (int t = 0; t < TRIALS; ++t) {
+    size_t len = (size_t)snprintf(buf, sizeof(buf), "key:%d", t);
+    uint64_t base = wyhash64a(buf, len);
+    size_t bit = (size_t)t % (len * 8);
+    buf[bit / 8] ^= (char)(1 << (bit % 8));
+    flipped += (uint64_t)__builtin_popcountll(base ^ wyhash64a(buf, len));
+  }
+  double average = (double)flipped / TRIALS;
+  int avalanche = average > 30.0 && average < 34.0;
+  printf("Average bits flipped by a one-bit change (%.2f): ", average);
+  ASSERT(avalanche, 1, avalanche);
+}
+
+void test_murmur64_batch_speed(void) {
+  enum { N = 1 << 16, ROUNDS = 64 };
+  static char storage[N][24];
+  static const void *keys[N];
+  static size_t lens[N];
+  static uint64_t out[N];
+  for (int i = 0; i < N; ++i) {
+    lens[i] = (size_t)snprintf(storage[i], sizeof(storage[i]), "user:%d", i * 7919);
+    keys[i] = storage[i];
+  }
+
+  uint64_t sink = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (int i = 0; i < N; ++i) {
+      out[i] = murmur64a(keys[i], lens[i]);
+    }
+    sink ^= out[r];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double scalar_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < ROUNDS; ++r) {
+    murmur64_batch(keys, lens, N, DEFAULT_MURMUR64_KEY, out);
+    sink ^= out[r];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double batch_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (int i = 0; i < N; ++i) {
+      out[i] = wyhash64a(keys[i], lens[i]);
+    }
+    sink ^= out[r];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wyhash_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("Short keys: murmur64 %.1f Mkeys/s, murmur64_batch %.1f Mkeys/s, wyhash64 %.1f Mkeys/s (%llx)\n",
+         (double)N * ROUNDS / scalar_sec / 1e6, (double)N * ROUNDS / batch_sec / 1e6,
+         (double)N * ROUNDS / wyhash_sec / 1e6, (unsigned long long)(sink & 0xf));
+}
+
+void test_swiss_table(void) {
+  enum { N = 100000 };
+  static int values[N];
+  SwissTable *table = SwissTable_create(NULL);
+  char buf[32];
+  for (int i = 0; i < N; ++i) {
+    values[i] = i;
+    snprintf(buf, sizeof(buf), "key_%d", i);
+    SwissTable_setStr(table, buf, &values[i]);
+  }
+  printf("Size after %d inserts: ", N);
+  ASSERT(SwissTable_size(table) == N, N, (int)SwissTable_size(table));
+
+  int wrong = 0;
+  for (int i = 0; i < N; ++i) {
+    snprintf(buf, sizeof(buf), "key_%d", i);
+    int *value = (int *)SwissTable_getStr(table, buf);
+    wrong += value == NULL || *value != i;
+  }
+  printf("Every key finds its value: ");
+  ASSERT(wrong == 0, 0, wrong);
+
+  int found = 0;
+  for (int i = N; i < 2 * N; ++i) {
+    snprintf(buf, sizeof(buf), "key_%d", i);
+    found += SwissTable_getStr(table, buf) != NULL;
+  }
+  printf("Absent keys are not found: ");
+  ASSERT(found == 0, 0, found);
+
+  // Keys are compared by length and bytes, so prefixes and embedded NULs differ
+  static int a = 1, b = 2, c = 3;
+  SwissTable_set(table, "key_1", 4, &a);
+  SwissTable_set(table, "ab\0c", 4, &b);
+  SwissTable_set(table, "ab\0d", 4, &c);
+  int binary = SwissTable_get(table, "key_", 4) == &a && SwissTable_get(table, "ab\0c", 4) == &b &&
+               SwissTable_get(table, "ab\0d", 4) == &c && SwissTable_getStr(table, "key_1") == &values[1];
+  printf("Binary keys and prefixes are distinct: ");
+  ASSERT(binary, 1, binary);
+
+  SwissTable_setStr(table, "key_7", &a);
+  int updated = SwissTable_getStr(table, "key_7") == &a && SwissTable_size(table) == N + 3;
+  printf("Setting an existing key updates it: ");
+  ASSERT(updated, 1, updated);
+
+  // Every pair must be one that was set, and each key is visited once
+  static bool visited[N];
+  size_t iterated = 0, unexpected = 0;
+  SwissTableIterator it = SwissTable_iterator(table);
+  while (SwissTable_next(&it)) {
+    iterated++;
+    int i = -1;
+    if (it.length > 4 && memcmp(it.key, "key_", 4) == 0 && it.key[it.length] == '\0') {
+      i = atoi(it.key + 4);
+      snprintf(buf, sizeof(buf), "key_%d", i);
+      i = i >= 0 && i < N && strcmp(buf, it.key) == 0 && !visited[i] ? i : -1;
+    }
+    if (i >= 0) {
+      visited[i] = true;
+      unexpected += it.value != (i == 7 ? &a : &values[i]);
+    } else {
+      unexpected += !((it.length == 4 && memcmp(it.key, "key_", 4) == 0 && it.value == &a) ||
+                      (it.length == 4 && memcmp(it.key, "ab\0c", 4) == 0 && it.value == &b) ||
+                      (it.length == 4 && memcmp(it.key, "ab\0d", 4) == 0 && it.value == &c));
+    }
+  }
+  printf("Iterator visits every key once: ");
+  ASSERT(iterated == N + 3, N + 3, (int)iterated);
+  printf("Iterated pairs are the ones set: ");
+  ASSERT(unexpected == 0, 0, (int)unexpected);
+
+  double load = (double)SwissTable_size(table) / (double)table->capacity;
+  printf("Load factor %.2f, %zu bytes\n", load, SwissTable_memory_usage(table));
+  SwissTable_free(table);
+}
+
+void test_swiss_table_speed(void) {
+  enum { N = 1 << 20 };
+  static char storage[N][24];
+  static int present = 1;
+  for (int i = 0; i < N; ++i) {
+    snprintf(storage[i], sizeof(storage[i]), "user:%lld", (long long)i * 7919);
+  }
+
+  // Inserts, then lookups of every key, with and without an arena for the
+  // keys, timed apart: inserts pay for the key copies, lookups only for the
+  // probes and comparisons
+  struct timespec start, middle, end;
+  double insert_sec[4], lookup_sec[4];
+  size_t hits = 0;
+  for (int arena = 0; arena < 2; ++arena) {
+    HashTable *ht = arena ? HashTable_create_arena(NULL) : HashTable_create(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < N; ++i) {
+      HashTable_set(ht, storage[i], &present);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    for (int i = 0; i < N; ++i) {
+      hits += HashTable_get(ht, storage[i]) != NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert_sec[arena] = (middle.tv_sec - start.tv_sec) + (middle.tv_nsec - start.tv_nsec) / 1e9;
+    lookup_sec[arena] = (end.tv_sec - middle.tv_sec) + (end.tv_nsec - middle.tv_nsec) / 1e9;
+    HashTable_free(ht);
+
+    SwissTable *table = arena ? SwissTable_create_arena(NULL) : SwissTable_create(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < N; ++i) {
+      SwissTable_setStr(table, storage[i], &present);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    for (int i = 0; i < N; ++i) {
+      hits += SwissTable_getStr(table, storage[i]) != NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert_sec[2 + arena] = (middle.tv_sec - start.tv_sec) + (middle.tv_nsec - start.tv_nsec) / 1e9;
+    lookup_sec[2 + arena] = (end.tv_sec - middle.tv_sec) + (end.tv_nsec - middle.tv_nsec) / 1e9;
+    SwissTable_free(table);
+  }
+
+  const char *names[4] = {"HashTable", "HashTable (arena)", "SwissTable", "SwissTable (arena)"};
+  for (int t = 0; t < 4; ++t) {
+    printf("%d keys: %s inserts %.1f Mops/s, lookups %.1f Mops/s\n", N, names[t], N / insert_sec[t] / 1e6,
+           N / lookup_sec[t] / 1e6);
+  }
+  printf("All lookups hit: ");
+  ASSERT(hits == 4 * (size_t)N, 4 * N, (int)hits);
+}
+
+void test_arena(void) {
+  Arena *arena = Arena_create(256);
+  int misaligned = 0, overlapping = 0;
+  uint8_t *previous = NULL;
+  for (size_t size = 1; size < 100; ++size) {
+    uint8_t *data = (uint8_t *)Arena_alloc(arena, size);
+    misaligned += (uintptr_t)data % ARENA_ALIGNMENT != 0;
+    memset(data, (int)size, size);
+    overlapping += previous != NULL && previous[0] != (uint8_t)(size - 1);
+    previous = data;
+  }
+  printf("Allocations are aligned: ");
+  ASSERT(misaligned == 0, 0, misaligned);
+  printf("Allocations do not overlap: ");
+  ASSERT(overlapping == 0, 0, overlapping);
+
+  // Larger than a block: gets its own block and the current one keeps filling
+  uint8_t *large = (uint8_t *)Arena_alloc(arena, 1000);
+  memset(large, 0xab, 1000);
+  uint8_t *small = (uint8_t *)Arena_alloc(arena, 8);
+  int separate = small != NULL && (small + 8 <= large || small >= large + 1000);
+  printf("Oversized allocation gets a block of its own: ");
+  ASSERT(separate, 1, separate);
+  Arena_free(arena);
+}
+
+void test_hash_table_arena(void) {
+  enum { N = 200000 };
+  static int values[N];
+  HashTable *tables[2] = {HashTable_create(NULL), HashTable_create_arena(NULL)};
+  const char *names[2] = {"strdup", "arena"};
+  char buf[32];
+  for (int t = 0; t < 2; ++t) {
+    for (int i = 0; i < N; ++i) {
+      values[i] = i;
+      snprintf(buf, sizeof(buf), "key_%d", i);
+      HashTable_set(tables[t], buf, &values[i]);
+    }
+    snprintf(buf, sizeof(buf), "key_%d", 5);
+    HashTable_set(tables[t], buf, &values[6]);
+
+    int wrong = 0;
+    for (int i = 0; i < 2 * N; ++i) {
+      snprintf(buf, sizeof(buf), "key_%d", i);
+      void *expected = i >= N ? NULL : i == 5 ? &values[6] : &values[i];
+      wrong += HashTable_get(tables[t], buf) != expected;
+    }
+    printf("%s keys: lookups after %d inserts and an update: ", names[t], N);
+    ASSERT(wrong == 0, 0, wrong);
+    printf("%s keys: size: ", names[t]);
+    ASSERT(HashTable_size(tables[t]) == N, N, (int)HashTable_size(tables[t]));
+  }
+
+  // Keys that share a prefix must still be told apart by length
+  HashTable_set(tables[1], "key_1", &values[2]);
+  int prefix = HashTable_get(tables[1], "key_") == NULL && HashTable_get(tables[1], "key_1") == &values[2];
+  printf("Arena keys compare by length: ");
+  ASSERT(prefix, 1, prefix);
+  printf("Arena holds %.1f bytes per key, hash and length included\n",
+         (double)Arena_memory_usage(tables[1]->arena) / N);
+  HashTable_free(tables[0]);
+  HashTable_free(tables[1]);
+}
+
+// Random sets and removes against a presence array, for every table layout
+void test_hash_table_remove(void) {
+  enum { KEYS = 20000, OPS = 200000 };
+  static int values[KEYS];
+  static bool present[KEYS];
+  const unsigned configs[] = {0, HASH_TABLE_ARENA, HASH_TABLE_ROBIN_HOOD, HASH_TABLE_ROBIN_HOOD | HASH_TABLE_ARENA,
+                              HASH_TABLE_ROBIN_HOOD | HASH_TABLE_SHRINK, HASH_TABLE_SHRINK};
+  const char *names[] = {"Linear", "Linear, arena", "Robin Hood", "Robin Hood, arena", "Robin Hood, shrinking",
+                         "Linear, shrinking"};
+  char buf[32];
+  for (int c = 0; c < 6; ++c) {
+    HashTable *ht = HashTable_create_with(NULL, configs[c]);
+    memset(present, 0, sizeof(present));
+    size_t expected_size = 0;
+    int wrong = 0;
+    uint64_t state = 88172645463325252ULL;
+    for (int op = 0; op < OPS; ++op) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      int i = (int)(state % KEYS);
+      snprintf(buf, sizeof(buf), "key_%d", i);
+      // Insert-heavy first half, remove-heavy second half
+      if ((state >> 32) % 4 < (op < OPS / 2 ? 3u : 1u)) {
+        values[i] = i;
+        HashTable_set(ht, buf, &values[i]);
+        expected_size += !present[i];
+        present[i] = true;
+      } else {
+        wrong += HashTable_remove(ht, buf) != present[i];
+        expected_size -= present[i];
+        present[i] = false;
+      }
+    }
+    for (int i = 0; i < KEYS; ++i) {
+      snprintf(buf, sizeof(buf), "key_%d", i);
+      wrong += (HashTable_get(ht, buf) != NULL) != present[i];
+    }
+    printf("%s: lookups and removes agree with the reference: ", names[c]);
+    ASSERT(wrong == 0, 0, wrong);
+    printf("%s: size: ", names[c]);
+    ASSERT(HashTable_size(ht) == expected_size, (int)expected_size, (int)HashTable_size(ht));
+
+    if (ht->distances) {
+      size_t longest = 0;
+      for (size_t j = 0; j < ht->capacity; ++j) {
+        longest = ht->entries[j].key && ht->distances[j] > longest ? ht->distances[j] : longest;
+      }
+      printf("%s: %zu keys in %zu slots, longest probe %zu\n", names[c], HashTable_size(ht), ht->capacity, longest);
+    }
+
+    // Emptying a shrinking table brings it back to its initial size
+    for (int i = 0; i < KEYS; ++i) {
+      snprintf(buf, sizeof(buf), "key_%d", i);
+      HashTable_remove(ht, buf);
+    }
+    if (configs[c] & HASH_TABLE_SHRINK) {
+      printf("%s: capacity after removing every key: ", names[c]);
+      ASSERT(ht->capacity == INITIAL_HASH_TABLE_CAPACITY, INITIAL_HASH_TABLE_CAPACITY, (int)ht->capacity);
+    }
+    HashTable_free(ht);
+  }
+}
+
+void test_concurrent_hash_table(void) {
+  enum { N = 100000 };
+  static int values[N];
+  ConcurrentHashTable *table = ConcurrentHashTable_create(4, NULL);
+  char buf[32];
+  int wrong = 0;
+  for (int i = 0; i < N; ++i) {
+    values[i] = i;
+    snprintf(buf, sizeof(buf), "key_%d", i);
+    ConcurrentHashTable_setStr(table, buf, &values[i]);
+    // Keys inserted earlier stay visible while their shard is migrating
+    snprintf(buf, sizeof(buf), "key_%d", i / 2);
+    wrong += ConcurrentHashTable_getStr(table, buf) != &values[i / 2];
+  }
+  printf("Keys stay visible through incremental resizes: ");
+  ASSERT(wrong == 0, 0, wrong);
+  printf("Size after %d inserts: ", N);
+  ASSERT(ConcurrentHashTable_size(table) == N, N, (int)ConcurrentHashTable_size(table));
+
+  for (int i = 0; i < N; i += 2) {
+    snprintf(buf, sizeof(buf), "key_%d", i);
+    ConcurrentHashTable_setStr(table, buf, &values[(i + 1) % N]);
+  }
+  wrong = 0;
+  for (int i = 0; i < 2 * N; ++i) {
+    snprintf(buf, sizeof(buf), "key_%d", i);
+    void *expected = i >= N ? NULL : &values[i % 2 ? i : (i + 1) % N];
+    wrong += ConcurrentHashTable_getStr(table, buf) != expected;
+  }
+  printf("Updates and misses: ");
+  ASSERT(wrong == 0, 0, wrong);
+  printf("Updates do not change the size: ");
+  ASSERT(ConcurrentHashTable_size(table) == N, N, (int)ConcurrentHashTable_size(table));
+  ConcurrentHashTable_free(table);
+}
+
+#define CONCURRENT_TABLE_KEYS (1 << 18)
+#define CONCURRENT_TABLE_MAX_THREADS 8
+static char concurrent_table_keys[CONCURRENT_TABLE_KEYS][24];
+static size_t concurrent_table_published;  // Keys [0, published) are in the table
+
+typedef struct {
+  ConcurrentHashTable *table;
+  size_t thread_id;
+  size_t lookups;
+  size_t misses;
+} ConcurrentTableArgs;
+
+// One writer inserts the keys in order and publishes its progress
+static void *concurrent_table_writer(void *arg) {
+  ConcurrentTableArgs *args = (ConcurrentTableArgs *)arg;
+  for (size_t i = 0; i < CONCURRENT_TABLE_KEYS; ++i) {
+    ConcurrentHashTable_setStr(args->table, concurrent_table_keys[i], concurrent_table_keys[i]);
+    __atomic_store_n(&concurrent_table_published, i + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+// Readers look up published keys, which must always be found
+static void *concurrent_table_reader(void *arg) {
+  ConcurrentTableArgs *args = (ConcurrentTableArgs *)arg;
+  uint64_t state = args->thread_id * 0x9e3779b97f4a7c15ULL + 1;
+  for (size_t n = 0; n < args->lookups; ++n) {
+    size_t published = __atomic_load_n(&concurrent_table_published, __ATOMIC_ACQUIRE);
+    if (published == 0) {
+      continue;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    size_t i = (size_t)(state % published);
+    args->misses += ConcurrentHashTable_getStr(args->table, concurrent_table_keys[i]) != concurrent_table_keys[i];
+  }
+  return NULL;
+}
+
+void test_concurrent_hash_table_threads(void) {
+  for (size_t i = 0; i < CONCURRENT_TABLE_KEYS; ++i) {
+    snprintf(concurrent_table_keys[i], sizeof(concurrent_table_keys[i]), "user:%zu", i * 7919);
+  }
+  size_t misses = 0;
+  for (size_t readers = 1; readers < CONCURRENT_TABLE_MAX_THREADS; readers *= 2) {
+    ConcurrentHashTable *table = ConcurrentHashTable_create(16, NULL);
+    concurrent_table_published = 0;
+    pthread_t handles[CONCURRENT_TABLE_MAX_THREADS];
+    ConcurrentTableArgs args[CONCURRENT_TABLE_MAX_THREADS];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    args[0] = (ConcurrentTableArgs){table, 0, 0, 0};
+    pthread_create(&handles[0], NULL, concurrent_table_writer, &args[0]);
+    for (size_t t = 1; t <= readers; ++t) {
+      args[t] = (ConcurrentTableArgs){table, t, CONCURRENT_TABLE_KEYS, 0};
+      pthread_create(&handles[t], NULL, concurrent_table_reader, &args[t]);
+    }
+    for (size_t t = 0; t <= readers; ++t) {
+      pthread_join(handles[t], NULL);
+      misses += args[t].misses;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("1 writer, %zu readers: %.1f Mops/s, %.1f MB\n", readers,
+           (double)CONCURRENT_TABLE_KEYS * (readers + 1) / seconds / 1e6,
+           ConcurrentHashTable_memory_usage(table) / 1024.0 / 1024.0);
+    ConcurrentHashTable_free(table);
+  }
+  printf("Readers found every published key: ");
+  ASSERT(misses == 0, 0, (int)misses);
+}
+
+// Random bits with the given density in 1/256ths
+static void fill_random_bits(BitArray *bits, uint64_t seed, unsigned density) {
+  uint64_t state = seed * 0x9e3779b97f4a7c15ULL + 1;
+  for (size_t i = 0; i < bits->size; ++i) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    if ((state & 0xff) < density) {
+      BIT_SET(bits->data, i);
+    }
+  }
+}
+
+void test_bitarray_ops(void) {
+  // Sizes around the 16-vector popcount block and with partial last words
+  const size_t sizes[] = {1, 63, 64, 65, 4095, 4096, 4097, 100003};
+  int popcounts_ok = 1, ops_ok = 1, ranges_ok = 1;
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    size_t n = sizes[s];
+    BitArray *a = createBitArray(n), *b = createBitArray(n);
+    fill_random_bits(a, s, 128);
+    fill_random_bits(b, s + 100, 64);
+    size_t count = 0, or_count = 0, and_count = 0, xor_count = 0, andnot_count = 0;
+    for (size_t i = 0; i < n; ++i) {
+      unit_t x = BIT_GET(a->data, i), y = BIT_GET(b->data, i);
+      count += x;
+      or_count += x | y;
+      and_count += x & y;
+      xor_count += x ^ y;
+      andnot_count += x & !y;
+    }
+    popcounts_ok &= BitArray_popcount(a) == count && BitArray_popcount_or(a, b) == or_count &&
+                    BitArray_popcount_and(a, b) == and_count;
+
+    BitArray *c = createBitArray(n);
+    const size_t expected[] = {xor_count, andnot_count};
+    for (int op = 0; op < 2; ++op) {
+      memcpy(c->data, a->data, (n + BITS_PER_UNIT - 1) / BITS_PER_UNIT * sizeof(unit_t));
+      if (op == 0) {
+        BitArray_xor(c, b);
+      } else {
+        BitArray_andnot(c, b);
+      }
+      ops_ok &= BitArray_popcount(c) == expected[op];
+    }
+    freeBitArray(c);
+
+    for (size_t start = 0; start <= n; start += n / 7 + 1) {
+      for (size_t end = start; end <= n + 1; end += n / 5 + 1) {
+        size_t slow = 0;
+        for (size_t i = start; i < end && i < n; ++i) {
+          slow += BIT_GET(a->data, i);
+        }
+        ranges_ok &= BitArray_popcount_range(a, start, end) == slow;
+      }
+    }
+    ranges_ok &= BitArray_popcount_range(a, 0, n) == count;
+    freeBitArray(a);
+    freeBitArray(b);
+  }
+  printf("Popcount, OR and AND counts match bit-by-bit counts: ");
+  ASSERT(popcounts_ok, 1, popcounts_ok);
+  printf("XOR and AND NOT match bit-by-bit results: ");
+  ASSERT(ops_ok, 1, ops_ok);
+  printf("Range popcounts match bit-by-bit counts: ");
+  ASSERT(ranges_ok, 1, ranges_ok);
+}
+
+void test_bitarray_rank_select(void) {
+  const size_t sizes[] = {1, 511, 512, 513, 100003};
+  const unsigned densities[] = {0, 3, 128, 256};
+  int rank_ok = 1, select_ok = 1, past_end_ok = 1;
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+      size_t n = sizes[s];
+      BitArray *bits = createBitArray(n);
+      fill_random_bits(bits, s * 4 + d, densities[d]);
+      BitArrayRankIndex *index = BitArray_build_rank_index(bits);
+      size_t rank = 0;
+      for (size_t i = 0; i < n; ++i) {
+        rank_ok &= BitArray_rank(index, i) == rank;
+        if (BIT_GET(bits->data, i)) {
+          select_ok &= BitArray_select(index, rank) == i;
+          rank++;
+        }
+      }
+      rank_ok &= BitArray_rank(index, n) == rank;
+      past_end_ok &= BitArray_select(index, rank) == n;
+      free_BitArrayRankIndex(index);
+      freeBitArray(bits);
+    }
+  }
+  printf("Rank matches a running count: ");
+  ASSERT(rank_ok, 1, rank_ok);
+  printf("Select inverts rank: ");
+  ASSERT(select_ok, 1, select_ok);
+  printf("Select past the last set bit returns the size: ");
+  ASSERT(past_end_ok, 1, past_end_ok);
+}
+
+void test_bitarray_speed(void) {
+  enum { BITS = 1 << 24, ROUNDS = 20, QUERIES = 1 << 20 };
+  BitArray *a = createBitArray(BITS), *b = createBitArray(BITS);
+  fill_random_bits(a, 1, 128);
+  fill_random_bits(b, 2, 128);
+  struct timespec start, end;
+  size_t total = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < ROUNDS; ++r) {
+    total += BitArray_popcount_and(a, b);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("popcount_and: %.1f GB/s (%zu)\n", 2.0 * ROUNDS * BITS / 8 / seconds / 1e9, total);
+
+  BitArrayRankIndex *index = BitArray_build_rank_index(a);
+  size_t ones = BitArray_rank(index, BITS);
+  uint64_t state = 88172645463325252ULL;
+  total = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int q = 0; q < QUERIES; ++q) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    total += BitArray_select(index, (size_t)(state % ones));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("select over %d bits: %.0f ns per query (%zu)\n", BITS, seconds / QUERIES * 1e9, total % 1000);
+  free_BitArrayRankIndex(index);
+  freeBitArray(a);
+  freeBitArray(b);
+}
+
+void test_alloc(void) {
+  const AllocKind kinds[] = {ALLOC_HEAP, ALLOC_ALIGNED, ALLOC_HUGE_PAGES, ALLOC_HUGETLB};
+  const char *names[] = {"Heap", "Aligned", "Huge pages", "Hugetlb"};
+  const size_t size = 3 * ALLOC_HUGE_PAGE + 12345;
+  for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+    Allocation allocation;
+    int ok = Alloc_zeroed(&allocation, size, ALLOC_POLICY(kinds[k]));
+    const uint8_t *bytes = (const uint8_t *)allocation.data;
+    for (size_t i = 0; ok && i < size; i += 4093) {
+      ok &= bytes[i] == 0;
+    }
+    printf("%s: zeroed: ", names[k]);
+    ASSERT(ok, 1, ok);
+    size_t alignment = kinds[k] == ALLOC_HEAP ? 1 : kinds[k] == ALLOC_ALIGNED ? ALLOC_ALIGNMENT : ALLOC_HUGE_PAGE;
+    int aligned = (uintptr_t)allocation.data % alignment == 0;
+    printf("%s: aligned to %zu bytes: ", names[k], alignment);
+    ASSERT(aligned, 1, aligned);
+    memset(allocation.data, 0xab, size);
+    Alloc_release(&allocation);
+  }
+
+  char path[] = "/tmp/pds_alloc_XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+  BitArray *bits = createBitArrayWith(100000, ALLOC_POLICY_FILE(path));
+  for (size_t i = 0; i < bits->size; i += 7) {
+    BIT_SET(bits->data, i);
+  }
+  size_t expected = BitArray_popcount(bits);
+  freeBitArray(bits);
+  bits = createBitArrayWith(100000, ALLOC_POLICY_FILE(path));
+  size_t reopened = BitArray_popcount(bits);
+  printf("File-backed bits survive a remap: ");
+  ASSERT(reopened == expected, (int)expected, (int)reopened);
+  freeBitArray(bits);
+  BitArray *other = createBitArrayWith(50000, ALLOC_POLICY_FILE(path));
+  printf("A file holding another size is refused: ");
+  ASSERT(other == NULL, 1, other == NULL);
+  bits = createBitArrayWith(100000, ALLOC_POLICY_FILE(path));
+  reopened = BitArray_popcount(bits);
+  printf("Refused file is left untouched: ");
+  ASSERT(reopened == expected, (int)expected, (int)reopened);
+  freeBitArray(bits);
+
+  // Files that are not arrays are never truncated
+  FILE *file = fopen(path, "wb");
+  fputs("not an array", file);
+  fclose(file);
+  other = createBitArrayWith(100000, ALLOC_POLICY_FILE(path));
+  struct stat st;
+  int kept = other == NULL && stat(path, &st) == 0 && st.st_size == 12;
+  printf("Foreign file is refused and keeps its size: ");
+  ASSERT(kept, 1, kept);
+  unlink(path);
+}
+
+// Random bit probes over an array much larger than the TLB reach of 4 KB pages
+void test_alloc_speed(void) {
+  enum { BITS_LOG2 = 30, PROBES = 1 << 23 };
+  const AllocKind kinds[] = {ALLOC_HEAP, ALLOC_HUGE_PAGES};
+  const char *names[] = {"4 KB pages", "huge pages"};
+  for (size_t k = 0; k < 2; ++k) {
+    BitArray *bits = createBitArrayWith((size_t)1 << BITS_LOG2, ALLOC_POLICY(kinds[k]));
+    memset(bits->data, 0x55, ((size_t)1 << BITS_LOG2) / 8);
+    uint64_t state = 88172645463325252ULL;
+    size_t total = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < PROBES; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      total += BIT_GET(bits->data, state >> (64 - BITS_LOG2));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Random probes of a %zu MB array on %s: %.1f ns per probe (%zu)\n", ((size_t)1 << BITS_LOG2) >> 23,
+           names[k], seconds / PROBES * 1e9, total % 10);
+    freeBitArray(bits);
+  }
+}
+
+// Writes `n` lines whose lengths cycle through short, empty and multi-page
+// ones, the last without a trailing newline. Returns the file size.
+static size_t write_line_file(const char *path, size_t n, size_t *lengths) {
+  FILE *file = fopen(path, "wb");
+  size_t total = 0;
+  for (size_t i = 0; i < n; ++i) {
+    lengths[i] = i % 97 == 5 ? 10000 + i : i % 13 == 0 ? 0 : (i * 7) % 61 + 1;
+    for (size_t b = 0; b < lengths[i]; ++b) {
+      fputc('a' + (int)((i + b) % 26), file);
+    }
+    if (i + 1 < n) {
+      fputc('\n', file);
+    }
+    total += lengths[i] + (i + 1 < n);
+  }
+  fclose(file);
+  return total;
+}
+
+void test_line_reader(void) {
+  enum { LINES = 5000 };
+  static size_t lengths[LINES];
+  char path[] = "/tmp/pds_lines_XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+  write_line_file(path, LINES, lengths);
+
+  // Whole file, then windows smaller than the longest line
+  const size_t windows[] = {SIZE_MAX, 4096, 1 << 16};
+  const char *names[] = {"Whole file", "4 KB windows", "64 KB windows"};
+  for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+    LineReader *reader = LineReader_open_window(path, windows[w]);
+    const char *line;
+    size_t length, n = 0;
+    int ok = 1;
+    while (LineReader_next(reader, &line, &length)) {
+      ok &= n < LINES && length == lengths[n] && (length == 0 || (line[0] == 'a' + (int)(n % 26) &&
+                                                                  line[length - 1] == 'a' + (int)((n + length - 1) % 26)));
+      n++;
+    }
+    printf("%s: every line whole, in order: ", names[w]);
+    ASSERT(ok && n == LINES && !reader->error, LINES, (int)n);
+    LineReader_close(reader);
+
+    // Batches hold views that are all valid at once
+    reader = LineReader_open_window(path, windows[w]);
+    const char *lines[64];
+    size_t lens[64];
+    size_t batch, total = 0;
+    ok = 1;
+    while ((batch = LineReader_next_batch(reader, lines, lens, 64)) > 0) {
+      for (size_t i = 0; i < batch; ++i) {
+        ok &= lens[i] == lengths[total + i] && (lens[i] == 0 || lines[i][0] == 'a' + (int)((total + i) % 26));
+      }
+      total += batch;
+    }
+    printf("%s: batches cover every line: ", names[w]);
+    ASSERT(ok && total == LINES, LINES, (int)total);
+    LineReader_close(reader);
+  }
+
+  long count;
+  char **sentences = load_sentences(path, &count);
+  size_t longest = 0;
+  for (long i = 0; i < count; ++i) {
+    size_t length = strlen(sentences[i]);
+    longest = length > longest ? length : longest;
+    free(sentences[i]);
+  }
+  free(sentences);
+  size_t expected = 0;
+  long non_empty = 0;
+  for (size_t i = 0; i < LINES; ++i) {
+    expected = lengths[i] > expected ? lengths[i] : expected;
+    non_empty += lengths[i] > 0;
+  }
+  printf("load_sentences skips empty lines: ");
+  ASSERT(count == non_empty, (int)non_empty, (int)count);
+  printf("load_sentences keeps long lines whole: ");
+  ASSERT(longest == expected, (int)expected, (int)longest);
+
+  FILE *file = fopen(path, "wb");
+  fclose(file);
+  LineReader *reader = LineReader_open(path);
+  const char *line;
+  size_t length;
+  int any = LineReader_next(reader, &line, &length);
+  printf("Empty file has no lines: ");
+  ASSERT(!any, 0, any);
+  LineReader_close(reader);
+  unlink(path);
+}
+
+// Hashing every line of a file: copies from load_sentences against views
+void test_line_reader_speed(void) {
+  enum { LINES = 1 << 20 };
+  char path[] = "/tmp/pds_lines_XXXXXX";
+  int fd = mkstemp(path);
+  FILE *file = fdopen(fd, "wb");
+  for (int i = 0; i < LINES; ++i) {
+    fprintf(file, "phrase number %d about user:%lld\n", i, (long long)i * 7919);
+  }
+  fclose(file);
+
+  struct timespec start, end;
+  uint64_t sums[2] = {0, 0};
+  double seconds[2];
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long count;
+  char **sentences = load_sentences(path, &count);
+  for (long i = 0; i < count; ++i) {
+    sums[0] += wyhash64a(sentences[i], strlen(sentences[i]));
+    free(sentences[i]);
+  }
+  free(sentences);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds[0] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  LineReader *reader = LineReader_open(path);
+  const char *line;
+  size_t length;
+  while (LineReader_next(reader, &line, &length)) {
+    sums[1] += wyhash64a(line, length);
+  }
+  LineReader_close(reader);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds[1] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%d lines: load_sentences %.1f Mlines/s, LineReader %.1f Mlines/s\n", LINES, LINES / seconds[0] / 1e6,
+         LINES / seconds[1] / 1e6);
+  printf("Both see the same lines: ");
+  ASSERT(sums[0] == sums[1], 1, sums[0] == sums[1]);
+  unlink(path);
+}
+
+int main(void) {
+  RUN_TEST(test_murmur64_batch);
+  RUN_TEST(test_hash128);
+  RUN_TEST(test_wyhash);
+  RUN_TEST(test_murmur64_batch_speed);
+  RUN_TEST(test_swiss_table);
+  RUN_TEST(test_swiss_table_speed);
+  RUN_TEST(test_arena);
+  RUN_TEST(test_hash_table_arena);
+  RUN_TEST(test_hash_table_remove);
+  RUN_TEST(test_concurrent_hash_table);
+  RUN_TEST(test_concurrent_hash_table_threads);
+  RUN_TEST(test_bitarray_ops);
+  RUN_TEST(test_bitarray_rank_select);
+  RUN_TEST(test_bitarray_speed);
+  RUN_TEST(test_alloc);
+  RUN_TEST(test_alloc_speed);
+  RUN_TEST(test_line_reader);
+  RUN_TEST(test_line_reader_speed);
+  return 0;
+}
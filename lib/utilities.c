@@ -4,11 +4,13 @@ void printSeparator(void) {
 	printf("%s", SEPARATOR);
 }
 
+// Copies every non-empty line into its own NUL-terminated string. Lines come
+// from a LineReader, so they are kept whole whatever their length; callers
+// that only hash the lines should iterate a LineReader and skip the copies.
 char **load_sentences(const char *filename, long *out_count) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    LineReader *reader = LineReader_open(filename);
+    if (!reader) {
         printf("%s", filename);
-        perror("Failed to open file");
 		exit(EXIT_FAILURE);
     }
 
@@ -16,17 +18,15 @@ char **load_sentences(const char *filename, long *out_count) {
     char **sentences = (char **)malloc(capacity * sizeof(char*));
     if (!sentences) {
         fprintf(stderr, "Memory allocation failed\n");
-        fclose(file);
+        LineReader_close(reader);
         exit(EXIT_FAILURE);
     }
-    char buffer[MAX_LINE_LEN];
+    const char *line;
+    size_t length;
     long count = 0;
 
-    while (fgets(buffer, sizeof(buffer), file)) {
-        // Remove newline character if present
-        buffer[strcspn(buffer, "\n")] = '\0';
-
-		if (strlen(buffer) == 0) {
+    while (LineReader_next(reader, &line, &length)) {
+		if (length == 0) {
 			continue;
 		}
 
@@ -42,7 +42,7 @@ char **load_sentences(const char *filename, long *out_count) {
         }
 
         // Allocate memory and copy the sentence
-        sentences[count] = strdup(buffer);
+        sentences[count] = strndup(line, length);
         if (!sentences[count]) {
             fprintf(stderr, "Memory allocation failed\n");
 			exit(EXIT_FAILURE);
@@ -50,7 +50,7 @@ char **load_sentences(const char *filename, long *out_count) {
         count++;
     }
 
-    fclose(file);
+    LineReader_close(reader);
 	*out_count = count;
 	return sentences;
 }
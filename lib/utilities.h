@@ -2,8 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "line_reader.h"
 
-#define MAX_LINE_LEN 2048
 #define INITIAL_CAPACITY 1024
 #define SEPARATOR "\n\n******************************\n"
 #define ASSERT(condition, expected, value) do {	\